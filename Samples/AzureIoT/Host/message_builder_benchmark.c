@@ -0,0 +1,160 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host benchmark for the message builder. It prints the cost of adding a temperature reading to
+// a telemetry batch with the builder, as a string and as a number, against the snprintf
+// templates the sample used before, and the cost of a whole single message from the pool.
+//
+// Usage: message_builder_benchmark [--iterations N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "message_builder.h"
+
+typedef void (*ReadingWriter)(MessageBuilder *builder, int reading);
+
+static double GetSeconds(void);
+static float GetReading(int reading);
+static void WriteStringReading(MessageBuilder *builder, int reading);
+static void WriteNumberReading(MessageBuilder *builder, int reading);
+static double MeasureBuilderBatch(int iterations, ReadingWriter writeReading);
+
+// Keeps the compiler from dropping work whose result is otherwise unused.
+static volatile size_t benchmarkSink;
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/// <summary>
+///     Returns a simulated temperature that changes with each reading, like the sample's.
+/// </summary>
+static float GetReading(int reading)
+{
+    return 30.0f + (float)(reading & 15) * 0.05f;
+}
+
+static void WriteStringReading(MessageBuilder *builder, int reading)
+{
+    (void)reading;
+    MessageBuilder_AddString(builder, "30.25");
+}
+
+static void WriteNumberReading(MessageBuilder *builder, int reading)
+{
+    MessageBuilder_AddNumber(builder, GetReading(reading), 2);
+}
+
+/// <summary>
+///     Adds iterations readings to batches the way AddTelemetryReading in main.c does, sending
+///     (here, dropping) each batch when the next reading no longer fits.
+/// </summary>
+/// <returns>The seconds taken, or a negative number if the pool had no builder</returns>
+static double MeasureBuilderBatch(int iterations, ReadingWriter writeReading)
+{
+    MessageBuilder *batch = MessageBuilder_Acquire();
+    if (batch == NULL) {
+        return -1;
+    }
+    MessageBuilder_BeginArray(batch);
+
+    double started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        MessageBuilder batchBefore = *batch;
+        MessageBuilder_BeginObject(batch);
+        MessageBuilder_AddKey(batch, "Temperature");
+        writeReading(batch, i);
+        MessageBuilder_EndObject(batch);
+        if (MessageBuilder_HasFailed(batch)) {
+            *batch = batchBefore;
+            MessageBuilder_EndArray(batch);
+            size_t length;
+            benchmarkSink = (size_t)MessageBuilder_GetData(batch, &length) + length;
+            MessageBuilder_Init(batch, batch->buffer, batch->capacity);
+            MessageBuilder_BeginArray(batch);
+        }
+    }
+    double seconds = GetSeconds() - started;
+
+    MessageBuilder_Release(batch);
+    return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 1000000;
+    if (argc == 3 && strcmp(argv[1], "--iterations") == 0) {
+        iterations = atoi(argv[2]);
+    }
+    if ((argc != 1 && argc != 3) || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The single message template and its separately formatted reading, before batching.
+    double started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        char readingBuffer[20];
+        char eventBuffer[100];
+        snprintf(readingBuffer, sizeof(readingBuffer), "%3.2f", GetReading(i));
+        int length = snprintf(eventBuffer, sizeof(eventBuffer), "{ \"%s\": \"%s\" }",
+                              "Temperature", readingBuffer);
+        benchmarkSink = (size_t)length + strlen(eventBuffer);
+    }
+    double templateSeconds = GetSeconds() - started;
+
+    // The batch template, with the reading already formatted.
+    char batch[MESSAGE_BUILDER_BUFFER_BYTES];
+    size_t batchLength = 0;
+    started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        int length = snprintf(batch + batchLength, sizeof(batch) - batchLength - 1,
+                              "%c{\"%s\":\"%s\"}", batchLength == 0 ? '[' : ',', "Temperature",
+                              "30.25");
+        batchLength += (size_t)length;
+        if (batchLength > sizeof(batch) - 100) {
+            benchmarkSink = batchLength;
+            batchLength = 0;
+        }
+    }
+    double batchTemplateSeconds = GetSeconds() - started;
+
+    double stringSeconds = MeasureBuilderBatch(iterations, WriteStringReading);
+    double numberSeconds = MeasureBuilderBatch(iterations, WriteNumberReading);
+    if (stringSeconds < 0 || numberSeconds < 0) {
+        fprintf(stderr, "ERROR: The message builder pool is empty.\n");
+        return EXIT_FAILURE;
+    }
+
+    // A whole message, from taking a builder from the pool to giving it back.
+    started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        MessageBuilder *builder = MessageBuilder_Acquire();
+        MessageBuilder_BeginObject(builder);
+        MessageBuilder_AddKey(builder, "Temperature");
+        MessageBuilder_AddNumber(builder, GetReading(i), 2);
+        MessageBuilder_EndObject(builder);
+        size_t length;
+        benchmarkSink = (size_t)MessageBuilder_GetData(builder, &length) + length;
+        MessageBuilder_Release(builder);
+    }
+    double messageSeconds = GetSeconds() - started;
+
+    printf("%-40s %8.1f ns/reading\n", "snprintf reading and message template",
+           templateSeconds / iterations * 1e9);
+    printf("%-40s %8.1f ns/reading\n", "snprintf template into a batch",
+           batchTemplateSeconds / iterations * 1e9);
+    printf("%-40s %8.1f ns/reading\n", "builder, string into a batch",
+           stringSeconds / iterations * 1e9);
+    printf("%-40s %8.1f ns/reading\n", "builder, number into a batch",
+           numberSeconds / iterations * 1e9);
+    printf("%-40s %8.1f ns/message\n", "builder, acquire, message and release",
+           messageSeconds / iterations * 1e9);
+    return EXIT_SUCCESS;
+}
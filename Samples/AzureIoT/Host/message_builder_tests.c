@@ -0,0 +1,225 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Tests for the message builder that writes telemetry messages, built for the development
+// machine with the address and undefined behavior sanitizers where the compiler has them. Each
+// test returns the number of checks that failed; the program fails if any did.
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "message_builder.h"
+#include "parson.h"
+
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition);        \
+            ++failures;                                                                  \
+        }                                                                                \
+    } while (0)
+
+static bool HasData(const MessageBuilder *builder, const char *expected);
+static int TestEscaping(void);
+static int TestIntegers(void);
+static int TestNumberRounding(void);
+static int TestNonFiniteNumbers(void);
+static int TestPoolExhaustion(void);
+static int TestEveryCapacity(void);
+
+/// <summary>
+///     Checks that the builder holds expected, with the length it reports.
+/// </summary>
+static bool HasData(const MessageBuilder *builder, const char *expected)
+{
+    size_t length;
+    const char *data = MessageBuilder_GetData(builder, &length);
+    return data != NULL && length == strlen(expected) && strcmp(data, expected) == 0;
+}
+
+/// <summary>
+///     Keys and strings are escaped as JSON requires, and parse back to what was added.
+/// </summary>
+static int TestEscaping(void)
+{
+    int failures = 0;
+    static const char Key[] = "q\"k";
+    static const char Value[] = "a\\b\n\t\x01\x1f\xc3\xa9/";
+
+    char buffer[128];
+    MessageBuilder builder;
+    MessageBuilder_Init(&builder, buffer, sizeof(buffer));
+    MessageBuilder_BeginObject(&builder);
+    MessageBuilder_AddKey(&builder, Key);
+    MessageBuilder_AddString(&builder, Value);
+    MessageBuilder_AddKey(&builder, "empty");
+    MessageBuilder_AddString(&builder, "");
+    MessageBuilder_EndObject(&builder);
+    CHECK(HasData(&builder,
+                  "{\"q\\\"k\":\"a\\\\b\\n\\t\\u0001\\u001f\xc3\xa9/\",\"empty\":\"\"}"));
+
+    size_t length;
+    JSON_Value *value = json_parse_string(MessageBuilder_GetData(&builder, &length));
+    const char *parsed = json_object_get_string(json_value_get_object(value), Key);
+    CHECK(parsed != NULL && strcmp(parsed, Value) == 0);
+    json_value_free(value);
+    return failures;
+}
+
+/// <summary>
+///     Integers are written in full, including the one whose magnitude a long long can't hold.
+/// </summary>
+static int TestIntegers(void)
+{
+    int failures = 0;
+    char buffer[128];
+    MessageBuilder builder;
+    MessageBuilder_Init(&builder, buffer, sizeof(buffer));
+    MessageBuilder_BeginArray(&builder);
+    MessageBuilder_AddInteger(&builder, LLONG_MIN);
+    MessageBuilder_AddInteger(&builder, LLONG_MAX);
+    MessageBuilder_AddInteger(&builder, 0);
+    MessageBuilder_AddInteger(&builder, -7);
+    MessageBuilder_AddBool(&builder, true);
+    MessageBuilder_AddBool(&builder, false);
+    MessageBuilder_EndArray(&builder);
+    CHECK(HasData(&builder,
+                  "[-9223372036854775808,9223372036854775807,0,-7,true,false]"));
+    return failures;
+}
+
+/// <summary>
+///     Numbers are rounded half away from zero to the decimals asked for, at most 9, and a
+///     negative number that rounds to zero has no sign.
+/// </summary>
+static int TestNumberRounding(void)
+{
+    int failures = 0;
+    char buffer[128];
+    MessageBuilder builder;
+    MessageBuilder_Init(&builder, buffer, sizeof(buffer));
+    MessageBuilder_BeginArray(&builder);
+    MessageBuilder_AddNumber(&builder, 30.125, 2);
+    MessageBuilder_AddNumber(&builder, -12.5, 0);
+    MessageBuilder_AddNumber(&builder, -0.001, 2);
+    MessageBuilder_AddNumber(&builder, 0.001, 3);
+    MessageBuilder_AddNumber(&builder, 1.5, 12);
+    MessageBuilder_AddNumber(&builder, 99.996, 2);
+    MessageBuilder_EndArray(&builder);
+    CHECK(HasData(&builder, "[30.13,-13,0.00,0.001,1.500000000,100.00]"));
+    return failures;
+}
+
+/// <summary>
+///     Numbers JSON can't represent, or too large to write in fixed point, fail the builder.
+/// </summary>
+static int TestNonFiniteNumbers(void)
+{
+    int failures = 0;
+    const double Invalid[] = {NAN, INFINITY, -INFINITY, 1e17, -1e17};
+    for (size_t i = 0; i < sizeof(Invalid) / sizeof(Invalid[0]); ++i) {
+        char buffer[64];
+        MessageBuilder builder;
+        MessageBuilder_Init(&builder, buffer, sizeof(buffer));
+        MessageBuilder_BeginArray(&builder);
+        MessageBuilder_AddNumber(&builder, Invalid[i], 2);
+        MessageBuilder_EndArray(&builder);
+        size_t length;
+        CHECK(MessageBuilder_HasFailed(&builder));
+        CHECK(MessageBuilder_GetData(&builder, &length) == NULL);
+    }
+    return failures;
+}
+
+/// <summary>
+///     The pool hands out MESSAGE_BUILDER_POOL_SIZE builders, counts each time it has none
+///     left, and reuses released ones.
+/// </summary>
+static int TestPoolExhaustion(void)
+{
+    int failures = 0;
+    MessageBuilder *builders[MESSAGE_BUILDER_POOL_SIZE];
+    for (size_t i = 0; i < MESSAGE_BUILDER_POOL_SIZE; ++i) {
+        builders[i] = MessageBuilder_Acquire();
+        CHECK(builders[i] != NULL);
+        CHECK(i == 0 || builders[i]->buffer != builders[i - 1]->buffer);
+    }
+
+    unsigned long exhausted = MessageBuilder_GetPoolExhaustedCount();
+    CHECK(MessageBuilder_Acquire() == NULL);
+    CHECK(MessageBuilder_GetPoolExhaustedCount() == exhausted + 1);
+
+    MessageBuilder_AddString(builders[1], "used");
+    MessageBuilder_Release(builders[1]);
+    MessageBuilder *reused = MessageBuilder_Acquire();
+    CHECK(reused == builders[1]);
+    CHECK(reused != NULL && reused->capacity == MESSAGE_BUILDER_BUFFER_BYTES);
+    CHECK(reused != NULL && HasData(reused, ""));
+    for (size_t i = 0; i < MESSAGE_BUILDER_POOL_SIZE; ++i) {
+        MessageBuilder_Release(builders[i]);
+    }
+    return failures;
+}
+
+/// <summary>
+///     At every capacity, a batch built the way main.c builds telemetry batches, undoing the
+///     reading that doesn't fit, is either failed or a complete array that parson accepts.
+/// </summary>
+static int TestEveryCapacity(void)
+{
+    int failures = 0;
+    for (size_t capacity = 1; capacity < 80; ++capacity) {
+        char *buffer = malloc(capacity); // exactly capacity bytes, for the address sanitizer
+        MessageBuilder builder;
+        MessageBuilder_Init(&builder, buffer, capacity);
+        MessageBuilder_BeginArray(&builder);
+        size_t added = 0;
+        for (int i = 0; i < 10; ++i) {
+            MessageBuilder before = builder;
+            MessageBuilder_BeginObject(&builder);
+            MessageBuilder_AddKey(&builder, "Temperature");
+            MessageBuilder_AddNumber(&builder, 30.0 + i, 2);
+            MessageBuilder_EndObject(&builder);
+            if (MessageBuilder_HasFailed(&builder)) {
+                builder = before;
+                break;
+            }
+            ++added;
+        }
+        MessageBuilder_EndArray(&builder);
+
+        size_t length;
+        const char *data = MessageBuilder_GetData(&builder, &length);
+        if (capacity < 3) {
+            CHECK(data == NULL); // not even "[]" fits
+        } else {
+            CHECK(data != NULL && length < capacity);
+            JSON_Value *value = data == NULL ? NULL : json_parse_string(data);
+            CHECK(value != NULL && json_array_get_count(json_value_get_array(value)) == added);
+            json_value_free(value);
+        }
+        free(buffer);
+    }
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    failures += TestEscaping();
+    failures += TestIntegers();
+    failures += TestNumberRounding();
+    failures += TestNonFiniteNumbers();
+    failures += TestPoolExhaustion();
+    failures += TestEveryCapacity();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All message builder tests passed\n");
+    return EXIT_SUCCESS;
+}
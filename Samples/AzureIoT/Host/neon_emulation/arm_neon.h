@@ -0,0 +1,129 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Portable C versions of the NEON intrinsics parson.c uses, with the lane order of a
+// little-endian ARM target, so that its NEON scanners can be built and tested on the development
+// machine. Only for the parson_tests_neon_emulated target: the device build uses the compiler's
+// own arm_neon.h.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t val[16];
+} uint8x16_t;
+
+typedef struct {
+    uint8_t val[8];
+} uint8x8_t;
+
+typedef struct {
+    uint16_t val[8];
+} uint16x8_t;
+
+typedef struct {
+    uint64_t val[1];
+} uint64x1_t;
+
+#define NEON_EMULATION_LANEWISE(result, expression) \
+    for (int lane = 0; lane < 16; ++lane) {         \
+        (result).val[lane] = (uint8_t)(expression); \
+    }
+
+static inline uint8x16_t vld1q_u8(const uint8_t *ptr)
+{
+    uint8x16_t result;
+    memcpy(result.val, ptr, sizeof(result.val));
+    return result;
+}
+
+static inline uint8x16_t vdupq_n_u8(uint8_t value)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, value);
+    return result;
+}
+
+static inline uint8x16_t vceqq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, a.val[lane] == b.val[lane] ? 0xFF : 0);
+    return result;
+}
+
+static inline uint8x16_t vcltq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, a.val[lane] < b.val[lane] ? 0xFF : 0);
+    return result;
+}
+
+static inline uint8x16_t vcleq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, a.val[lane] <= b.val[lane] ? 0xFF : 0);
+    return result;
+}
+
+static inline uint8x16_t vtstq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, (a.val[lane] & b.val[lane]) != 0 ? 0xFF : 0);
+    return result;
+}
+
+static inline uint8x16_t vorrq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, a.val[lane] | b.val[lane]);
+    return result;
+}
+
+static inline uint8x16_t vsubq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, a.val[lane] - b.val[lane]);
+    return result;
+}
+
+static inline uint8x16_t vmvnq_u8(uint8x16_t a)
+{
+    uint8x16_t result;
+    NEON_EMULATION_LANEWISE(result, ~a.val[lane]);
+    return result;
+}
+
+static inline uint16x8_t vreinterpretq_u16_u8(uint8x16_t a)
+{
+    uint16x8_t result;
+    for (int lane = 0; lane < 8; ++lane) {
+        result.val[lane] = (uint16_t)(a.val[2 * lane] | a.val[2 * lane + 1] << 8);
+    }
+    return result;
+}
+
+// A macro on ARM, as the shift has to be a constant.
+static inline uint8x8_t vshrn_n_u16(uint16x8_t a, int shift)
+{
+    uint8x8_t result;
+    for (int lane = 0; lane < 8; ++lane) {
+        result.val[lane] = (uint8_t)(a.val[lane] >> shift);
+    }
+    return result;
+}
+
+static inline uint64x1_t vreinterpret_u64_u8(uint8x8_t a)
+{
+    uint64x1_t result = {{0}};
+    for (int lane = 0; lane < 8; ++lane) {
+        result.val[0] |= (uint64_t)a.val[lane] << (8 * lane);
+    }
+    return result;
+}
+
+static inline uint64_t vget_lane_u64(uint64x1_t a, int lane)
+{
+    return a.val[lane];
+}
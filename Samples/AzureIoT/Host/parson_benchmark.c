@@ -0,0 +1,1180 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host benchmark for parson over a corpus of device twin documents. For each document it prints
+// the allocations, peak heap and time of a parse and of a serialization, as counted by parson
+// built with PARSON_STATS. With --limits, it fails if a document needs more allocations than the
+// limit recorded for it, so regressions in allocation count are caught by ctest; times depend on
+// the machine, so they are printed only.
+//
+// With --case, it runs one of the cases in BenchmarkCases instead, each of which measures one
+// feature of parson, or all of them. parson_benchmark_baseline is the same program built with
+// parson's optional speedups turned off, to compare against.
+//
+// Usage: parson_benchmark [--iterations N] [--limits FILE] DOCUMENT...
+//        parson_benchmark [--iterations N] --case NAME|all [DOCUMENT...]
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parson.h"
+#include "parson_schema.h"
+
+#define NAME_MAX_LENGTH 127
+#define PATH_MAX_LENGTH 127
+#define PATH_CASE_LEAVES 4096
+#define PATH_CASE_QUERIES 8
+#define STACK_CASE_STACK_SIZE (1024 * 1024)
+#define STACK_CASE_PAINT 0xA5
+#define INTERNING_CASE_COPIES 100
+
+// The twin properties main.c decodes, and a telemetry message of a few fields to encode.
+#define STATUS_LED_PROPERTY_FIELDS(FIELD) FIELD(BOOLEAN, value, 0)
+#define AGGREGATION_PROPERTY_FIELDS(FIELD) \
+    FIELD(INTEGER, windowSeconds, 0) FIELD(INTEGER, slideSeconds, 0)
+#define DESIRED_PROPERTIES_FIELDS(FIELD)        \
+    FIELD(OBJECT, StatusLED, StatusLedProperty) \
+    FIELD(OBJECT, TemperatureAggregation, AggregationProperty)
+#define TWIN_DOCUMENT_FIELDS(FIELD)                                                       \
+    FIELD(OBJECT, desired, DesiredProperties) FIELD(OBJECT, StatusLED, StatusLedProperty) \
+    FIELD(OBJECT, TemperatureAggregation, AggregationProperty)
+#define TELEMETRY_MESSAGE_FIELDS(FIELD)                                        \
+    FIELD(NUMBER, Temperature, 0) FIELD(NUMBER, Humidity, 0)                   \
+    FIELD(INTEGER, ButtonPresses, 0) FIELD(STRING, Orientation, 8)
+
+JSON_SCHEMA_STRUCT(StatusLedProperty, STATUS_LED_PROPERTY_FIELDS)
+JSON_SCHEMA_STRUCT(AggregationProperty, AGGREGATION_PROPERTY_FIELDS)
+JSON_SCHEMA_STRUCT(DesiredProperties, DESIRED_PROPERTIES_FIELDS)
+JSON_SCHEMA_STRUCT(TwinDocument, TWIN_DOCUMENT_FIELDS)
+JSON_SCHEMA_STRUCT(TelemetryMessage, TELEMETRY_MESSAGE_FIELDS)
+JSON_SCHEMA_DEFINE(StatusLedProperty, STATUS_LED_PROPERTY_FIELDS)
+JSON_SCHEMA_DEFINE(AggregationProperty, AGGREGATION_PROPERTY_FIELDS)
+JSON_SCHEMA_DEFINE(DesiredProperties, DESIRED_PROPERTIES_FIELDS)
+JSON_SCHEMA_DEFINE(TwinDocument, TWIN_DOCUMENT_FIELDS)
+JSON_SCHEMA_DEFINE(TelemetryMessage, TELEMETRY_MESSAGE_FIELDS)
+
+// Work the stack case runs on a thread of its own, to measure the stack it uses.
+typedef enum { StackNothing, StackParse, StackSerialize, StackSerializePretty } StackOperation;
+typedef struct {
+    StackOperation operation;
+    const char *text;  // to parse
+    JSON_Value *value; // parsed, or to serialize
+} StackProbe;
+
+typedef struct {
+    char name[NAME_MAX_LENGTH + 1];
+    size_t parseAllocations;
+    size_t serializeAllocations;
+} AllocationLimit;
+
+static char *ReadFile(const char *path, size_t *length);
+static const char *GetBaseName(const char *path);
+static AllocationLimit *ReadLimits(const char *path, size_t *count);
+static const AllocationLimit *FindLimit(const AllocationLimit *limits, size_t count,
+                                        const char *name);
+static int MeasureDocument(const char *path, int iterations, const AllocationLimit *limits,
+                           size_t limitCount);
+static double GetSeconds(void);
+static int RequireDocuments(const char *caseName, int pathCount);
+static int RunLookupCase(int iterations, char *paths[], int pathCount);
+static int RunArenaCase(int iterations, char *paths[], int pathCount);
+static JSON_Status CountEvent(const JSON_Event *event, void *context);
+static int RunScanCase(int iterations, char *paths[], int pathCount);
+static int RunNumbersCase(int iterations, char *paths[], int pathCount);
+static size_t CollectLeafPaths(const JSON_Object *object, char *prefix, size_t prefixLength,
+                               char (*leaves)[PATH_MAX_LENGTH + 1], size_t leafCount,
+                               size_t maxLeaves);
+static int RunPathCase(int iterations, char *paths[], int pathCount);
+static size_t ReadTwinWithDom(const char *text);
+static int RunSchemaCase(int iterations, char *paths[], int pathCount);
+static size_t CountNodes(const JSON_Value *value);
+static int RunAllocationsCase(int iterations, char *paths[], int pathCount);
+static void *RunStackProbe(void *context);
+static size_t MeasureStack(StackProbe *probe);
+static char *MakeNestedDocument(int depth, int objects);
+static int MeasureStackOfDocument(const char *name, const char *text, int iterations,
+                                  size_t threadStack);
+static int RunStackCase(int iterations, char *paths[], int pathCount);
+static JSON_Value *MakeTwin(int settingCount);
+static int RunCopyCase(int iterations, char *paths[], int pathCount);
+static int RunInterningCase(int iterations, char *paths[], int pathCount);
+
+// A case runs iterations times its own unit of work, over the documents at paths if it takes
+// any, and returns 0 unless it could not run.
+typedef int (*BenchmarkCaseFunction)(int iterations, char *paths[], int pathCount);
+typedef struct {
+    const char *name;
+    BenchmarkCaseFunction run;
+} BenchmarkCase;
+
+static const BenchmarkCase BenchmarkCases[] = {
+    {"lookup", RunLookupCase},
+    {"arena", RunArenaCase},
+    {"scan", RunScanCase},
+    {"numbers", RunNumbersCase},
+    {"path", RunPathCase},
+    {"schema", RunSchemaCase},
+    {"allocations", RunAllocationsCase},
+    {"stack", RunStackCase},
+    {"copy", RunCopyCase},
+    {"interning", RunInterningCase},
+};
+
+// Keeps the compiler from dropping work whose result is otherwise unused.
+static volatile size_t benchmarkSink;
+
+static char *ReadFile(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open '%s': %s (%d).\n", path, strerror(errno), errno);
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    size_t used = 0;
+    char *text = malloc(capacity);
+    while (text != NULL) {
+        used += fread(text + used, 1, capacity - used - 1, file);
+        if (used < capacity - 1) {
+            break;
+        }
+        capacity *= 2;
+        char *grown = realloc(text, capacity);
+        if (grown == NULL) {
+            free(text);
+        }
+        text = grown;
+    }
+    fclose(file);
+
+    if (text == NULL) {
+        fprintf(stderr, "ERROR: Out of memory reading '%s'.\n", path);
+        return NULL;
+    }
+    text[used] = '\0';
+    *length = used;
+    return text;
+}
+
+static const char *GetBaseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash == NULL ? path : slash + 1;
+}
+
+static AllocationLimit *ReadLimits(const char *path, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open '%s': %s (%d).\n", path, strerror(errno), errno);
+        return NULL;
+    }
+
+    size_t capacity = 16;
+    AllocationLimit *limits = malloc(capacity * sizeof(*limits));
+    char line[256];
+    *count = 0;
+    while (limits != NULL && fgets(line, sizeof(line), file) != NULL) {
+        AllocationLimit limit;
+        if (line[0] == '#' || sscanf(line, "%127s %zu %zu", limit.name, &limit.parseAllocations,
+                                     &limit.serializeAllocations) != 3) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            AllocationLimit *grown = realloc(limits, capacity * sizeof(*limits));
+            if (grown == NULL) {
+                free(limits);
+            }
+            limits = grown;
+            if (limits == NULL) {
+                break;
+            }
+        }
+        limits[(*count)++] = limit;
+    }
+    fclose(file);
+
+    if (limits == NULL) {
+        fprintf(stderr, "ERROR: Out of memory reading '%s'.\n", path);
+    }
+    return limits;
+}
+
+static const AllocationLimit *FindLimit(const AllocationLimit *limits, size_t count,
+                                        const char *name)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(limits[i].name, name) == 0) {
+            return &limits[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Prints the cost of parsing and serializing one document.
+/// </summary>
+/// <returns>0 if the document was measured and is within its limits, otherwise -1.</returns>
+static int MeasureDocument(const char *path, int iterations, const AllocationLimit *limits,
+                           size_t limitCount)
+{
+    size_t length;
+    char *text = ReadFile(path, &length);
+    if (text == NULL) {
+        return -1;
+    }
+
+    const char *name = GetBaseName(path);
+    JSON_Stats parse, serialize, timed;
+
+    json_stats_reset();
+    JSON_Value *value = json_parse_string(text);
+    json_stats_get(&parse);
+    if (value == NULL) {
+        fprintf(stderr, "ERROR: Could not parse '%s'.\n", path);
+        free(text);
+        return -1;
+    }
+
+    json_stats_reset();
+    char *serialized = json_serialize_to_string(value);
+    json_stats_get(&serialize);
+    json_free_serialized_string(serialized);
+    json_value_free(value);
+
+    json_stats_reset();
+    for (int i = 0; i < iterations; ++i) {
+        value = json_parse_string(text);
+        serialized = json_serialize_to_string(value);
+        json_free_serialized_string(serialized);
+        json_value_free(value);
+    }
+    json_stats_get(&timed);
+
+    printf("%-28s %7zu | %7zu %8zu %9.2f | %7zu %8zu %9.2f\n", name, length, parse.allocations,
+           parse.bytes_peak, timed.parse_seconds / iterations * 1e6, serialize.allocations,
+           serialize.bytes_peak, timed.serialize_seconds / iterations * 1e6);
+    free(text);
+
+    const AllocationLimit *limit = FindLimit(limits, limitCount, name);
+    if (limit != NULL && (parse.allocations > limit->parseAllocations ||
+                          serialize.allocations > limit->serializeAllocations)) {
+        fprintf(stderr,
+                "ERROR: '%s' needs %zu allocations to parse and %zu to serialize, over its "
+                "limits of %zu and %zu.\n",
+                name, parse.allocations, serialize.allocations, limit->parseAllocations,
+                limit->serializeAllocations);
+        return -1;
+    }
+    return 0;
+}
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/// <summary>
+///     Times json_object_get_value on objects of increasing size, looking up each member in
+///     turn, iterations * 1000 times per size. The baseline build has no lookup index, so it
+///     shows the linear search.
+/// </summary>
+static int RunLookupCase(int iterations, char *paths[], int pathCount)
+{
+    (void)paths;
+    (void)pathCount;
+    static const size_t Sizes[] = {4, 8, 16, 64, 256, 512};
+    char names[512][16];
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        snprintf(names[i], sizeof(names[i]), "setting%zu", i);
+    }
+
+    printf("%-8s %10s\n", "members", "ns/lookup");
+    for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); ++s) {
+        JSON_Value *value = json_value_init_object();
+        JSON_Object *object = json_value_get_object(value);
+        for (size_t i = 0; i < Sizes[s]; ++i) {
+            json_object_set_number(object, names[i], (double)i);
+        }
+
+        size_t lookups = (size_t)iterations * 1000;
+        size_t found = 0;
+        double started = GetSeconds();
+        for (size_t i = 0; i < lookups; ++i) {
+            found += json_object_get_value(object, names[i % Sizes[s]]) != NULL;
+        }
+        double seconds = GetSeconds() - started;
+        benchmarkSink = found;
+        json_value_free(value);
+
+        printf("%-8zu %10.1f\n", Sizes[s], seconds / (double)lookups * 1e9);
+    }
+    return 0;
+}
+
+static int RequireDocuments(const char *caseName, int pathCount)
+{
+    if (pathCount == 0) {
+        fprintf(stderr, "ERROR: The %s case needs documents to run on.\n", caseName);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Compares parsing each document onto the heap, then freeing it, with parsing it into an
+///     arena of 16 KB blocks, then resetting the arena, by allocations, peak bytes requested
+///     and time.
+/// </summary>
+static int RunArenaCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("arena", pathCount) != 0) {
+        return -1;
+    }
+
+    printf("%-28s | %7s %8s %9s | %7s %8s %9s\n", "document", "heap", "peak B", "us", "arena",
+           "peak B", "us");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+
+        JSON_Stats heap, arena;
+        json_stats_reset();
+        JSON_Value *value = json_parse_string(text);
+        json_value_free(value);
+        json_stats_get(&heap);
+        double started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_value_free(json_parse_string(text));
+        }
+        double heapSeconds = GetSeconds() - started;
+
+        json_stats_reset();
+        JSON_Arena *documentArena = json_arena_create(16 * 1024);
+        value = json_parse_string_arena(text, documentArena);
+        json_arena_reset(documentArena);
+        json_stats_get(&arena);
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            benchmarkSink += json_parse_string_arena(text, documentArena) != NULL;
+            json_arena_reset(documentArena);
+        }
+        double arenaSeconds = GetSeconds() - started;
+        json_arena_release(documentArena);
+        free(text);
+
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Could not parse '%s'.\n", paths[p]);
+            return -1;
+        }
+        printf("%-28s | %7zu %8zu %9.2f | %7zu %8zu %9.2f\n", GetBaseName(paths[p]),
+               heap.allocations, heap.bytes_peak, heapSeconds / iterations * 1e6,
+               arena.allocations, arena.bytes_peak, arenaSeconds / iterations * 1e6);
+    }
+    return 0;
+}
+
+static JSON_Status CountEvent(const JSON_Event *event, void *context)
+{
+    (void)event;
+    ++*(size_t *)context;
+    return JSONSuccess;
+}
+
+/// <summary>
+///     Prints the throughput of the tokenizer's scanning, which uses SSE2 or NEON unless the
+///     build (like the baseline) defines PARSON_DISABLE_SIMD: json_parse_events over each
+///     document, which allocates nothing, a parse and free of it, and json_value_init_string
+///     on a 4 KB string, which checks it is UTF-8.
+/// </summary>
+static int RunScanCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("scan", pathCount) != 0) {
+        return -1;
+    }
+
+    printf("%-28s %12s %12s\n", "document", "events MB/s", "parse MB/s");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+
+        size_t events = 0;
+        double started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            if (json_parse_events(text, length, CountEvent, &events) != JSONSuccess) {
+                fprintf(stderr, "ERROR: Could not parse '%s'.\n", paths[p]);
+                free(text);
+                return -1;
+            }
+        }
+        double eventSeconds = GetSeconds() - started;
+        benchmarkSink = events;
+
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_value_free(json_parse_string(text));
+        }
+        double parseSeconds = GetSeconds() - started;
+        free(text);
+
+        double megabytes = (double)length * iterations / 1e6;
+        printf("%-28s %12.1f %12.1f\n", GetBaseName(paths[p]), megabytes / eventSeconds,
+               megabytes / parseSeconds);
+    }
+
+    char string[4096];
+    for (size_t i = 0; i < sizeof(string) - 1; ++i) {
+        string[i] = (char)('a' + i % 26);
+    }
+    string[sizeof(string) - 1] = '\0';
+    double started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        json_value_free(json_value_init_string(string));
+    }
+    printf("%-28s %12.1f\n", "init_string 4 KB",
+           (double)sizeof(string) * iterations / 1e6 / (GetSeconds() - started));
+    return 0;
+}
+
+/// <summary>
+///     Prints the cost of parsing and formatting numbers, which is exact and shortest round-trip
+///     unless the build (like the baseline) defines PARSON_DISABLE_FAST_NUMBERS: parse and
+///     serialize throughput and serialized size of each document, then per number for an array
+///     of 1000 computed readings, such as 20.1, that aren't exact in binary.
+/// </summary>
+static int RunNumbersCase(int iterations, char *paths[], int pathCount)
+{
+    printf("%-28s %10s %14s %10s\n", "document", "parse MB/s", "serialize MB/s", "bytes");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+        JSON_Value *value = json_parse_string(text);
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Could not parse '%s'.\n", paths[p]);
+            free(text);
+            return -1;
+        }
+
+        double started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_value_free(json_parse_string(text));
+        }
+        double parseSeconds = GetSeconds() - started;
+        size_t serializedLength = json_serialization_size(value) - 1;
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_free_serialized_string(json_serialize_to_string(value));
+        }
+        double serializeSeconds = GetSeconds() - started;
+        json_value_free(value);
+        free(text);
+
+        printf("%-28s %10.1f %14.1f %10zu\n", GetBaseName(paths[p]),
+               (double)length * iterations / 1e6 / parseSeconds,
+               (double)serializedLength * iterations / 1e6 / serializeSeconds, serializedLength);
+    }
+
+    enum { ReadingCount = 1000 };
+    JSON_Value *readings = json_value_init_array();
+    for (int i = 0; i < ReadingCount; ++i) {
+        json_array_append_number(json_value_get_array(readings), 20.0 + (i % 200) * 0.05);
+    }
+    double started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        json_free_serialized_string(json_serialize_to_string(readings));
+    }
+    double formatSeconds = GetSeconds() - started;
+    char *serialized = json_serialize_to_string(readings);
+    started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        json_value_free(json_parse_string(serialized));
+    }
+    double parseSeconds = GetSeconds() - started;
+    printf("%-28s %10.1f %14.1f %10zu  (ns/number)\n", "computed readings",
+           parseSeconds / iterations / ReadingCount * 1e9,
+           formatSeconds / iterations / ReadingCount * 1e9, strlen(serialized));
+    json_free_serialized_string(serialized);
+    json_value_free(readings);
+    return 0;
+}
+
+/// <summary>
+///     Appends to leaves the dotted paths of the values under object that aren't objects, up to
+///     maxLeaves, skipping names that have a dot or would make the path too long.
+/// </summary>
+/// <returns>The number of leaves now in leaves</returns>
+static size_t CollectLeafPaths(const JSON_Object *object, char *prefix, size_t prefixLength,
+                               char (*leaves)[PATH_MAX_LENGTH + 1], size_t leafCount,
+                               size_t maxLeaves)
+{
+    for (size_t i = 0; i < json_object_get_count(object) && leafCount < maxLeaves; ++i) {
+        const char *name = json_object_get_name(object, i);
+        size_t nameLength = strlen(name);
+        if (strchr(name, '.') != NULL || prefixLength + nameLength + 1 > PATH_MAX_LENGTH) {
+            continue;
+        }
+        char *end = prefix + prefixLength;
+        if (prefixLength > 0) {
+            *end++ = '.';
+        }
+        memcpy(end, name, nameLength + 1);
+        size_t length = (size_t)(end - prefix) + nameLength;
+
+        const JSON_Object *child = json_object_get_object(object, name);
+        if (child != NULL) {
+            leafCount = CollectLeafPaths(child, prefix, length, leaves, leafCount, maxLeaves);
+        } else {
+            memcpy(leaves[leafCount++], prefix, length + 1);
+        }
+    }
+    return leafCount;
+}
+
+/// <summary>
+///     Compares json_object_dotget_value with compiled paths and json_object_pathget_value on
+///     each document, cycling through PATH_CASE_QUERIES of its leaves, iterations * 1000 times.
+/// </summary>
+static int RunPathCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("path", pathCount) != 0) {
+        return -1;
+    }
+
+    static char leaves[PATH_CASE_LEAVES][PATH_MAX_LENGTH + 1];
+    printf("%-28s %6s %10s %12s\n", "document", "depth", "dotget ns", "compiled ns");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+        JSON_Value *value = json_parse_string(text);
+        free(text);
+        JSON_Object *object = json_value_get_object(value);
+        char prefix[PATH_MAX_LENGTH + 1];
+        size_t leafCount =
+            object == NULL ? 0 : CollectLeafPaths(object, prefix, 0, leaves, 0, PATH_CASE_LEAVES);
+        if (leafCount == 0) {
+            json_value_free(value);
+            continue; // not an object, or nothing to look up in it
+        }
+
+        // Spread the queries over the document, and report the deepest.
+        const char *queries[PATH_CASE_QUERIES];
+        JSON_Path *compiled[PATH_CASE_QUERIES];
+        int depth = 0;
+        for (size_t q = 0; q < PATH_CASE_QUERIES; ++q) {
+            queries[q] = leaves[q * leafCount / PATH_CASE_QUERIES];
+            compiled[q] = json_path_compile(queries[q]);
+            int queryDepth = 1;
+            for (const char *c = queries[q]; *c != '\0'; ++c) {
+                queryDepth += *c == '.';
+            }
+            depth = queryDepth > depth ? queryDepth : depth;
+        }
+
+        size_t lookups = (size_t)iterations * 1000;
+        size_t found = 0;
+        double started = GetSeconds();
+        for (size_t i = 0; i < lookups; ++i) {
+            found += json_object_dotget_value(object, queries[i % PATH_CASE_QUERIES]) != NULL;
+        }
+        double dotgetSeconds = GetSeconds() - started;
+        started = GetSeconds();
+        for (size_t i = 0; i < lookups; ++i) {
+            found += json_object_pathget_value(object, compiled[i % PATH_CASE_QUERIES]) != NULL;
+        }
+        double compiledSeconds = GetSeconds() - started;
+        benchmarkSink = found;
+
+        for (size_t q = 0; q < PATH_CASE_QUERIES; ++q) {
+            json_path_free(compiled[q]);
+        }
+        json_value_free(value);
+        printf("%-28s %6d %10.1f %12.1f\n", GetBaseName(paths[p]), depth,
+               dotgetSeconds / (double)lookups * 1e9, compiledSeconds / (double)lookups * 1e9);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Reads the properties that TwinDocument binds from a parsed document, the way main.c did
+///     before it decoded twins through a schema.
+/// </summary>
+/// <returns>The number of properties found</returns>
+static size_t ReadTwinWithDom(const char *text)
+{
+    JSON_Value *value = json_parse_string(text);
+    JSON_Object *root = json_value_get_object(value);
+    if (root == NULL) {
+        json_value_free(value);
+        return 0;
+    }
+    JSON_Object *desired = json_object_get_object(root, "desired");
+    if (desired != NULL) {
+        root = desired;
+    }
+    size_t found = json_object_dotget_value(root, "StatusLED.value") != NULL;
+    found += json_object_dotget_value(root, "TemperatureAggregation.windowSeconds") != NULL;
+    found += json_object_dotget_value(root, "TemperatureAggregation.slideSeconds") != NULL;
+    json_value_free(value);
+    return found;
+}
+
+/// <summary>
+///     Compares json_schema_decode of the twin properties main.c reads with a DOM parse and
+///     lookups of the same properties, on each document, then json_schema_encode of a telemetry
+///     message with building it as a JSON_Value and serializing that. Prints us per document and
+///     ns per message, with the heap allocations of each.
+/// </summary>
+static int RunSchemaCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("schema", pathCount) != 0) {
+        return -1;
+    }
+
+    JSON_Stats stats;
+    printf("%-28s %10s %12s %10s %14s\n", "document", "DOM us", "DOM allocs", "schema us",
+           "schema allocs");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+
+        json_stats_reset();
+        double started = GetSeconds();
+        size_t found = 0;
+        for (int i = 0; i < iterations; ++i) {
+            found += ReadTwinWithDom(text);
+        }
+        double domSeconds = GetSeconds() - started;
+        json_stats_get(&stats);
+        size_t domAllocations = stats.allocations;
+
+        json_stats_reset();
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            TwinDocument twin;
+            found += json_schema_decode(TwinDocument_schema(), text, length, &twin) == JSONSuccess;
+        }
+        double schemaSeconds = GetSeconds() - started;
+        json_stats_get(&stats);
+        benchmarkSink = found;
+        free(text);
+
+        printf("%-28s %10.2f %12zu %10.2f %14zu\n", GetBaseName(paths[p]),
+               domSeconds / iterations * 1e6, domAllocations / (size_t)iterations,
+               schemaSeconds / iterations * 1e6, stats.allocations / (size_t)iterations);
+    }
+
+    TelemetryMessage message = {.Temperature = 33.85,
+                                .has_Temperature = 1,
+                                .Humidity = 41.5,
+                                .has_Humidity = 1,
+                                .ButtonPresses = 3,
+                                .has_ButtonPresses = 1,
+                                .Orientation = "Up",
+                                .has_Orientation = 1};
+    char buffer[256];
+    size_t messages = (size_t)iterations * 100;
+    size_t written = 0;
+    json_stats_reset();
+    double started = GetSeconds();
+    for (size_t i = 0; i < messages; ++i) {
+        JSON_Value *value = json_value_init_object();
+        JSON_Object *object = json_value_get_object(value);
+        json_object_set_number(object, "Temperature", message.Temperature);
+        json_object_set_number(object, "Humidity", message.Humidity);
+        json_object_set_number(object, "ButtonPresses", (double)message.ButtonPresses);
+        json_object_set_string(object, "Orientation", message.Orientation);
+        written += json_serialize_to_buffer(value, buffer, sizeof(buffer)) == JSONSuccess;
+        json_value_free(value);
+    }
+    double domSeconds = GetSeconds() - started;
+    json_stats_get(&stats);
+    size_t domAllocations = stats.allocations;
+
+    json_stats_reset();
+    started = GetSeconds();
+    for (size_t i = 0; i < messages; ++i) {
+        written += json_schema_encode(TelemetryMessage_schema(), &message, buffer, sizeof(buffer));
+    }
+    double schemaSeconds = GetSeconds() - started;
+    json_stats_get(&stats);
+    benchmarkSink = written;
+
+    printf("%-28s %10.1f %12zu %10.1f %14zu  (ns/message)\n", "telemetry encode",
+           domSeconds / (double)messages * 1e9, domAllocations / messages,
+           schemaSeconds / (double)messages * 1e9, stats.allocations / messages);
+    return 0;
+}
+
+/// <summary>
+///     Counts value and all the values under it.
+/// </summary>
+static size_t CountNodes(const JSON_Value *value)
+{
+    size_t count = 1;
+    const JSON_Object *object = json_value_get_object(value);
+    for (size_t i = 0; object != NULL && i < json_object_get_count(object); ++i) {
+        count += CountNodes(json_object_get_value_at(object, i));
+    }
+    const JSON_Array *array = json_value_get_array(value);
+    for (size_t i = 0; array != NULL && i < json_array_get_count(array); ++i) {
+        count += CountNodes(json_array_get_value(array, i));
+    }
+    return count;
+}
+
+/// <summary>
+///     Prints, for each document, the heap bytes parson requests and the allocations it makes
+///     per value of the parsed tree, which allocator headers and rounding come on top of, and
+///     the throughput of parsing and freeing it.
+/// </summary>
+static int RunAllocationsCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("allocations", pathCount) != 0) {
+        return -1;
+    }
+
+    printf("%-28s %6s %10s %11s %15s\n", "document", "nodes", "bytes/node", "allocs/node",
+           "parse+free MB/s");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+
+        JSON_Stats stats;
+        json_stats_reset();
+        JSON_Value *value = json_parse_string(text);
+        json_stats_get(&stats);
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Could not parse '%s'.\n", paths[p]);
+            free(text);
+            return -1;
+        }
+        size_t nodes = CountNodes(value);
+        json_value_free(value);
+
+        double started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_value_free(json_parse_string(text));
+        }
+        double seconds = GetSeconds() - started;
+        free(text);
+
+        printf("%-28s %6zu %10.1f %11.2f %15.1f\n", GetBaseName(paths[p]), nodes,
+               (double)stats.bytes_peak / (double)nodes, (double)stats.allocations / (double)nodes,
+               (double)length * iterations / 1e6 / seconds);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Thread function of MeasureStack. A parsed value is handed back rather than freed here,
+///     so that the stack json_value_free uses isn't counted as the parser's.
+/// </summary>
+static void *RunStackProbe(void *context)
+{
+    StackProbe *probe = (StackProbe *)context;
+    switch (probe->operation) {
+    case StackNothing:
+        break;
+    case StackParse:
+        probe->value = json_parse_string(probe->text);
+        break;
+    case StackSerialize:
+        json_free_serialized_string(json_serialize_to_string(probe->value));
+        break;
+    case StackSerializePretty:
+        json_free_serialized_string(json_serialize_to_string_pretty(probe->value));
+        break;
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Runs probe on a thread whose stack is painted with STACK_CASE_PAINT beforehand, and
+///     finds how much of it was used from the deepest byte that isn't paint anymore.
+/// </summary>
+/// <returns>The stack used in bytes, including the thread's own, or 0 if it could not run</returns>
+static size_t MeasureStack(StackProbe *probe)
+{
+    unsigned char *stack = aligned_alloc(4096, STACK_CASE_STACK_SIZE);
+    if (stack == NULL) {
+        return 0;
+    }
+    memset(stack, STACK_CASE_PAINT, STACK_CASE_STACK_SIZE);
+
+    size_t used = 0;
+    pthread_attr_t attributes;
+    pthread_t thread;
+    if (pthread_attr_init(&attributes) == 0) {
+        if (pthread_attr_setstack(&attributes, stack, STACK_CASE_STACK_SIZE) == 0 &&
+            pthread_create(&thread, &attributes, RunStackProbe, probe) == 0) {
+            pthread_join(thread, NULL);
+            // The stack grows down, so its untouched part is at the start of the buffer.
+            size_t untouched = 0;
+            while (untouched < STACK_CASE_STACK_SIZE && stack[untouched] == STACK_CASE_PAINT) {
+                ++untouched;
+            }
+            used = STACK_CASE_STACK_SIZE - untouched;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    free(stack);
+    return used;
+}
+
+/// <summary>
+///     Makes a document of depth arrays, or objects of one member, nested in each other.
+/// </summary>
+/// <returns>The document, which the caller frees, or NULL if out of memory</returns>
+static char *MakeNestedDocument(int depth, int objects)
+{
+    const char *open = objects ? "{\"a\":" : "[";
+    size_t openLength = strlen(open);
+    char *text = malloc((size_t)depth * (openLength + 1) + 2);
+    if (text == NULL) {
+        return NULL;
+    }
+    char *end = text;
+    for (int i = 1; i < depth; ++i, end += openLength) {
+        memcpy(end, open, openLength);
+    }
+    *end++ = objects ? '{' : '[';
+    memset(end, objects ? '}' : ']', (size_t)depth);
+    end[depth] = '\0';
+    return text;
+}
+
+/// <summary>
+///     Prints the stack used to parse text, serialize it and serialize it pretty, less
+///     threadStack, and the throughput of parse+free and of serialization.
+/// </summary>
+static int MeasureStackOfDocument(const char *name, const char *text, int iterations,
+                                  size_t threadStack)
+{
+    // Run everything once on this thread first, so that the dynamic linker binding symbols on
+    // their first call isn't counted.
+    JSON_Value *value = json_parse_string(text);
+    json_free_serialized_string(json_serialize_to_string(value));
+    json_free_serialized_string(json_serialize_to_string_pretty(value));
+    json_value_free(value);
+
+    StackProbe probe = {StackParse, text, NULL};
+    size_t parseStack = MeasureStack(&probe);
+    value = probe.value;
+    if (parseStack == 0 || value == NULL) {
+        fprintf(stderr, "ERROR: Could not parse '%s' on a thread.\n", name);
+        json_value_free(value);
+        return -1;
+    }
+    probe.operation = StackSerialize;
+    size_t serializeStack = MeasureStack(&probe);
+    probe.operation = StackSerializePretty;
+    size_t prettyStack = MeasureStack(&probe);
+
+    size_t length = strlen(text);
+    double started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        json_value_free(json_parse_string(text));
+    }
+    double parseSeconds = GetSeconds() - started;
+    size_t serializedLength = json_serialization_size(value) - 1;
+    started = GetSeconds();
+    for (int i = 0; i < iterations; ++i) {
+        json_free_serialized_string(json_serialize_to_string(value));
+    }
+    double serializeSeconds = GetSeconds() - started;
+    json_value_free(value);
+
+    printf("%-28s %8zu %10zu %8zu %15.1f %14.1f\n", name, parseStack - threadStack,
+           serializeStack - threadStack, prettyStack - threadStack,
+           (double)length * iterations / 1e6 / parseSeconds,
+           (double)serializedLength * iterations / 1e6 / serializeSeconds);
+    return 0;
+}
+
+/// <summary>
+///     Prints the stack high-water mark, in bytes, of parsing and serializing each document
+///     and arrays and objects nested 64 and 2048 deep, with their throughput. The stack a thread
+///     uses doing nothing is left out, so the figures are parson's own.
+/// </summary>
+static int RunStackCase(int iterations, char *paths[], int pathCount)
+{
+    StackProbe nothing = {StackNothing, NULL, NULL};
+    size_t threadStack = MeasureStack(&nothing);
+    if (threadStack == 0) {
+        fprintf(stderr, "ERROR: Could not start a thread on a stack of its own.\n");
+        return -1;
+    }
+
+    printf("%-28s %8s %10s %8s %15s %14s\n", "document", "parse B", "serialize B", "pretty B",
+           "parse+free MB/s", "serialize MB/s");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+        int result = MeasureStackOfDocument(GetBaseName(paths[p]), text, iterations, threadStack);
+        free(text);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    static const int Depths[] = {64, 2048};
+    for (size_t d = 0; d < sizeof(Depths) / sizeof(Depths[0]); ++d) {
+        for (int objects = 0; objects <= 1; ++objects) {
+            char name[NAME_MAX_LENGTH + 1];
+            snprintf(name, sizeof(name), "%s %d deep", objects ? "objects" : "arrays", Depths[d]);
+            char *text = MakeNestedDocument(Depths[d], objects);
+            if (text == NULL) {
+                return -1;
+            }
+            int result = MeasureStackOfDocument(name, text, iterations, threadStack);
+            free(text);
+            if (result != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+///     Builds a twin document of the shape of those in the corpus, with settingCount desired
+///     settings.
+/// </summary>
+/// <returns>The document, or NULL if out of memory</returns>
+static JSON_Value *MakeTwin(int settingCount)
+{
+    JSON_Value *twin = json_value_init_object();
+    JSON_Object *root = json_value_get_object(twin);
+    if (root == NULL) {
+        return NULL;
+    }
+    json_object_dotset_boolean(root, "desired.StatusLED.value", 1);
+    for (int i = 0; i < settingCount; ++i) {
+        char name[NAME_MAX_LENGTH + 1];
+        snprintf(name, sizeof(name), "desired.setting%d", i);
+        JSON_Value *setting = json_parse_string("{\"value\":0,\"unit\":\"celsius\","
+                                                "\"enabled\":false,\"tags\":[\"a\",\"b\\n\"]}");
+        json_object_set_number(json_value_get_object(setting), "value", i * 1.1);
+        json_object_set_boolean(json_value_get_object(setting), "enabled", i % 2);
+        if (json_object_dotset_value(root, name, setting) != JSONSuccess) {
+            json_value_free(setting);
+            json_value_free(twin);
+            return NULL;
+        }
+    }
+    json_object_dotset_number(root, "desired.$version", settingCount);
+    json_object_dotset_boolean(root, "reported.StatusLED", 0);
+    json_object_dotset_number(root, "reported.$version", 7);
+    return twin;
+}
+
+/// <summary>
+///     Prints, for twins of 50, 200 and 500 desired settings, the time and heap bytes of
+///     json_value_deep_copy, the time of a copy that is then serialized in full, and the time
+///     and peak heap of keeping a reported snapshot: copy the twin, change one setting, diff
+///     the copy against the twin, and free the diff and the copy.
+/// </summary>
+static int RunCopyCase(int iterations, char *paths[], int pathCount)
+{
+    (void)paths;
+    (void)pathCount;
+
+    printf("%-10s %8s %10s %14s %9s %13s\n", "settings", "copy us", "copy bytes",
+           "copy+serial us", "cycle us", "cycle peak B");
+    static const int SettingCounts[] = {50, 200, 500};
+    for (size_t n = 0; n < sizeof(SettingCounts) / sizeof(SettingCounts[0]); ++n) {
+        JSON_Value *twin = MakeTwin(SettingCounts[n]);
+        if (twin == NULL) {
+            fprintf(stderr, "ERROR: Out of memory building a twin.\n");
+            return -1;
+        }
+        JSON_Object *root = json_value_get_object(twin);
+        char setting[NAME_MAX_LENGTH + 1];
+        snprintf(setting, sizeof(setting), "desired.setting%d.value", SettingCounts[n] / 2);
+
+        JSON_Stats stats;
+        json_stats_get(&stats);
+        size_t liveBefore = stats.bytes_live;
+        JSON_Value *copy = json_value_deep_copy(twin);
+        json_stats_get(&stats);
+        size_t copyBytes = stats.bytes_live - liveBefore;
+        json_value_free(copy);
+
+        double started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            json_value_free(json_value_deep_copy(twin));
+        }
+        double copySeconds = GetSeconds() - started;
+
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            copy = json_value_deep_copy(twin);
+            json_free_serialized_string(json_serialize_to_string(copy));
+            json_value_free(copy);
+        }
+        double serializeSeconds = GetSeconds() - started;
+
+        json_stats_reset();
+        size_t changes = 0;
+        started = GetSeconds();
+        for (int i = 0; i < iterations; ++i) {
+            JSON_Value *snapshot = json_value_deep_copy(twin);
+            json_object_dotset_number(root, setting, i);
+            JSON_Value *diff = json_value_diff(snapshot, twin);
+            changes += json_value_get_type(diff) == JSONObject;
+            json_value_free(diff);
+            json_value_free(snapshot);
+        }
+        double cycleSeconds = GetSeconds() - started;
+        json_stats_get(&stats);
+        benchmarkSink = changes;
+        json_value_free(twin);
+
+        printf("%-10d %8.2f %10zu %14.1f %9.1f %13zu\n", SettingCounts[n],
+               copySeconds / iterations * 1e6, copyBytes, serializeSeconds / iterations * 1e6,
+               cycleSeconds / iterations * 1e6, stats.bytes_peak - liveBefore);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Holds INTERNING_CASE_COPIES parses of each document at once, as an application keeping
+///     many documents with the same member names would, first with names copied into each
+///     object and then interned. Prints the heap bytes and allocations held, and the time of a
+///     parse.
+/// </summary>
+static int RunInterningCase(int iterations, char *paths[], int pathCount)
+{
+    if (RequireDocuments("interning", pathCount) != 0) {
+        return -1;
+    }
+
+    static JSON_Value *held[INTERNING_CASE_COPIES];
+    printf("%-28s %-8s %10s %8s %9s\n", "document", "names", "bytes", "allocs", "parse us");
+    for (int p = 0; p < pathCount; ++p) {
+        size_t length;
+        char *text = ReadFile(paths[p], &length);
+        if (text == NULL) {
+            return -1;
+        }
+        for (int interning = 0; interning <= 1; ++interning) {
+            json_set_key_interning(interning);
+            JSON_Stats stats;
+            json_stats_get(&stats);
+            size_t liveBefore = stats.bytes_live;
+            json_stats_reset();
+            for (size_t i = 0; i < INTERNING_CASE_COPIES; ++i) {
+                held[i] = json_parse_string(text);
+            }
+            json_stats_get(&stats);
+            for (size_t i = 0; i < INTERNING_CASE_COPIES; ++i) {
+                json_value_free(held[i]);
+            }
+
+            double started = GetSeconds();
+            for (int i = 0; i < iterations; ++i) {
+                json_value_free(json_parse_string(text));
+            }
+            double seconds = GetSeconds() - started;
+
+            printf("%-28s %-8s %10zu %8zu %9.2f\n", GetBaseName(paths[p]),
+                   interning ? "interned" : "copied", stats.bytes_live - liveBefore,
+                   stats.allocations, seconds / iterations * 1e6);
+        }
+        json_set_key_interning(0);
+        free(text);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 1000;
+    AllocationLimit *limits = NULL;
+    size_t limitCount = 0;
+    const char *caseName = NULL;
+    int argi = 1;
+    for (; argi + 1 < argc && strncmp(argv[argi], "--", 2) == 0; argi += 2) {
+        if (strcmp(argv[argi], "--iterations") == 0) {
+            iterations = atoi(argv[argi + 1]);
+        } else if (strcmp(argv[argi], "--case") == 0) {
+            caseName = argv[argi + 1];
+        } else if (strcmp(argv[argi], "--limits") == 0) {
+            free(limits);
+            limits = ReadLimits(argv[argi + 1], &limitCount);
+            if (limits == NULL) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            break;
+        }
+    }
+    if ((argi == argc && caseName == NULL) || iterations <= 0) {
+        fprintf(stderr,
+                "Usage: %s [--iterations N] [--limits FILE] DOCUMENT...\n"
+                "       %s [--iterations N] --case NAME|all [DOCUMENT...]\n",
+                argv[0], argv[0]);
+        free(limits);
+        return EXIT_FAILURE;
+    }
+
+    if (caseName != NULL) {
+        free(limits);
+        int result = EXIT_FAILURE;
+        for (size_t i = 0; i < sizeof(BenchmarkCases) / sizeof(BenchmarkCases[0]); ++i) {
+            if (strcmp(caseName, "all") != 0 && strcmp(caseName, BenchmarkCases[i].name) != 0) {
+                continue;
+            }
+            printf("== %s\n", BenchmarkCases[i].name);
+            if (BenchmarkCases[i].run(iterations, argv + argi, argc - argi) != 0) {
+                return EXIT_FAILURE;
+            }
+            result = EXIT_SUCCESS;
+        }
+        if (result != EXIT_SUCCESS) {
+            fprintf(stderr, "ERROR: No benchmark case is named '%s'.\n", caseName);
+        }
+        return result;
+    }
+
+    printf("%-28s %7s | %-7s %8s %9s | %-7s %8s %9s\n", "document", "bytes", "parse", "peak B",
+           "us", "serial.", "peak B", "us");
+    int result = EXIT_SUCCESS;
+    for (; argi < argc; ++argi) {
+        if (MeasureDocument(argv[argi], iterations, limits, limitCount) != 0) {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    free(limits);
+    return result;
+}
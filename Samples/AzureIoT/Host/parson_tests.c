@@ -0,0 +1,412 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Regression tests for parson, built for the development machine with the address and undefined
+// behavior sanitizers where the compiler has them. Each test returns the number of checks that
+// failed; the program fails if any did.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parson.h"
+#include "parson_schema.h"
+
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition);        \
+            ++failures;                                                                  \
+        }                                                                                \
+    } while (0)
+
+static JSON_Value *FromCborCopy(const unsigned char *bytes, size_t length);
+static JSON_Status ParseCborEventsCopy(const unsigned char *bytes, size_t length);
+static JSON_Status IgnoreEvent(const JSON_Event *event, void *context);
+static JSON_Status FindNote(const JSON_Event *event, void *context);
+static JSON_Status FindName(const JSON_Event *event, void *context);
+static char *RepeatInto(char *buf, const char *text, int count);
+static char *NestedText(const char *open, const char *inner, const char *close, int depth);
+
+#define STATUS_LED(FIELD) FIELD(BOOLEAN, value, 0)
+#define DESIRED(FIELD) FIELD(STRING, note, 64) FIELD(OBJECT, StatusLED, StatusLedProperty)
+
+JSON_SCHEMA_STRUCT(StatusLedProperty, STATUS_LED)
+JSON_SCHEMA_STRUCT(DesiredProperties, DESIRED)
+JSON_SCHEMA_DEFINE(StatusLedProperty, STATUS_LED)
+JSON_SCHEMA_DEFINE(DesiredProperties, DESIRED)
+
+/// <summary>
+///     Decodes CBOR from a heap copy of exactly length bytes, so that the sanitizer catches any
+///     read past the end.
+/// </summary>
+static JSON_Value *FromCborCopy(const unsigned char *bytes, size_t length)
+{
+    unsigned char *copy = malloc(length);
+    memcpy(copy, bytes, length);
+    JSON_Value *value = json_value_from_cbor(copy, length);
+    free(copy);
+    return value;
+}
+
+static JSON_Status IgnoreEvent(const JSON_Event *event, void *context)
+{
+    (void)event;
+    (void)context;
+    return JSONSuccess;
+}
+
+static JSON_Status ParseCborEventsCopy(const unsigned char *bytes, size_t length)
+{
+    unsigned char *copy = malloc(length);
+    memcpy(copy, bytes, length);
+    JSON_Status status = json_parse_cbor_events(copy, length, IgnoreEvent, NULL);
+    free(copy);
+    return status;
+}
+
+/// <summary>
+///     Unescapes the value of the member named "note" into the char[512] at context.
+/// </summary>
+static JSON_Status FindNote(const JSON_Event *event, void *context)
+{
+    if (event->type != JSONEventString || !json_event_name_equals(event, "note")) {
+        return JSONSuccess;
+    }
+    if (!event->string_escaped) {
+        return JSONFailure; // only long escaped strings are expected here
+    }
+    return json_event_unescape(event->string, event->string_len, (char *)context, 512, NULL);
+}
+
+/// <summary>
+///     Fails unless the boolean member is named as the string at context.
+/// </summary>
+static JSON_Status FindName(const JSON_Event *event, void *context)
+{
+    if (event->type != JSONEventBoolean) {
+        return JSONSuccess;
+    }
+    return event->name_escaped && json_event_name_equals(event, (const char *)context)
+               ? JSONSuccess
+               : JSONFailure;
+}
+
+/// <summary>
+///     Writes count copies of text at buf, NUL terminated.
+/// </summary>
+/// <returns>The end of what was written, where the terminator is.</returns>
+static char *RepeatInto(char *buf, const char *text, int count)
+{
+    size_t length = strlen(text);
+    for (int i = 0; i < count; ++i) {
+        memcpy(buf, text, length);
+        buf += length;
+    }
+    *buf = '\0';
+    return buf;
+}
+
+/// <summary>
+///     Returns depth copies of open, then inner, then depth copies of close, which the caller
+///     frees.
+/// </summary>
+static char *NestedText(const char *open, const char *inner, const char *close, int depth)
+{
+    char *text = malloc((strlen(open) + strlen(close)) * (size_t)depth + strlen(inner) + 1);
+    char *end = RepeatInto(text, open, depth);
+    strcpy(end, inner);
+    RepeatInto(end + strlen(inner), close, depth);
+    return text;
+}
+
+static int TestLazyMalformedSubtree(void)
+{
+    int failures = 0;
+
+    // The document's brackets match up, so only accessing StatusLED finds it malformed.
+    JSON_Value *value =
+        json_parse_string_lazy("{\"desired\":{\"StatusLED\":{\"value\":tru},\"x\":1}}");
+    CHECK(value != NULL);
+    JSON_Object *root = json_value_get_object(value);
+    CHECK(json_object_dotget_number(root, "desired.x") == 1);
+    CHECK(json_object_dotget_object(root, "desired.StatusLED") == NULL);
+    CHECK(json_object_dotget_value(root, "desired.StatusLED.value") == NULL);
+
+    // It fails every time, and so does whatever has to read it.
+    CHECK(json_object_dotget_object(root, "desired.StatusLED") == NULL);
+    CHECK(json_serialize_to_string(value) == NULL);
+    JSON_Value *copy = json_value_deep_copy(value);
+    CHECK(copy != NULL && json_object_dotget_object(json_value_get_object(copy),
+                                                    "desired.StatusLED") == NULL);
+    CHECK(!json_value_equals(value, copy));
+    json_value_free(copy);
+    json_value_free(value);
+
+    value = json_parse_string_lazy("[[1,2],[3,]]");
+    CHECK(json_array_get_array(json_value_get_array(value), 0) != NULL);
+    CHECK(json_array_get_array(json_value_get_array(value), 1) == NULL);
+    json_value_free(value);
+
+    return failures;
+}
+
+static int TestLazyNestingDepth(void)
+{
+    int failures = 0;
+
+    // Lazy parsing takes the same depths as parsing straight away.
+    for (int depth = 2047; depth <= 2050; ++depth) {
+        char *arrays = NestedText("[", "", "]", depth);
+        char *objects = NestedText("{\"a\":", "1", "}", depth);
+        char *mixed = NestedText("[ ", " {} ", " ]", depth - 1);
+        const char *texts[] = {arrays, objects, mixed};
+        for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+            JSON_Value *eager = json_parse_string(texts[i]);
+            JSON_Value *lazy = json_parse_string_lazy(texts[i]);
+            CHECK((eager != NULL) == (lazy != NULL));
+            json_value_free(eager);
+            json_value_free(lazy);
+        }
+        free(arrays);
+        free(objects);
+        free(mixed);
+    }
+
+    return failures;
+}
+
+static int TestScannersAtBlockBoundaries(void)
+{
+    int failures = 0;
+    char json[256];
+    char expected[128];
+
+    // The scanners look at 16 bytes at a time with SSE2 or NEON, so put what they look for at
+    // every offset across three blocks.
+    for (int offset = 0; offset < 48; ++offset) {
+        char *run = RepeatInto(expected, "a", offset);
+
+        // The closing quote, an escape and a control character inside a string.
+        sprintf(json, "[\"%s\"]", expected);
+        JSON_Value *value = json_parse_string(json);
+        CHECK(value != NULL &&
+              strcmp(json_array_get_string(json_value_get_array(value), 0), expected) == 0);
+        json_value_free(value);
+        sprintf(json, "[\"%s\\u00e9bbbbb\"]", expected);
+        strcpy(run, "\xC3\xA9" "bbbbb");
+        value = json_parse_string(json);
+        CHECK(value != NULL &&
+              strcmp(json_array_get_string(json_value_get_array(value), 0), expected) == 0);
+        json_value_free(value);
+        *run = '\0';
+        sprintf(json, "[\"%s\tbbbbbbbbbbbbbbbbbbbb\"]", expected);
+        CHECK(json_parse_string(json) == NULL);
+
+        // A byte that isn't ASCII, valid and not, for the UTF-8 check.
+        strcpy(run, "\xC3\xA9" "bbbbbbbbbbbbbbbbbbbb");
+        value = json_value_init_string(expected);
+        CHECK(value != NULL && strcmp(json_value_get_string(value), expected) == 0);
+        json_value_free(value);
+        strcpy(run, "\xFF" "bbbbbbbbbbbbbbbbbbbb");
+        CHECK(json_value_init_string(expected) == NULL);
+
+        // Whitespace ending at the offset, before a value and before what isn't one.
+        RepeatInto(expected, " \t\r\n", 12);
+        expected[offset] = '\0';
+        sprintf(json, "[%s1%s]", expected, expected);
+        value = json_parse_string(json);
+        CHECK(value != NULL && json_array_get_number(json_value_get_array(value), 0) == 1);
+        json_value_free(value);
+        sprintf(json, "[%s@]", expected);
+        CHECK(json_parse_string(json) == NULL);
+
+        // Brackets inside strings, which skipping a lazy container has to pass over.
+        RepeatInto(expected, "a", offset);
+        sprintf(json, "{\"a\":{\"%s}\\\"]\":1},\"b\":[\"%s{\"]}", expected, expected);
+        value = json_parse_string_lazy(json);
+        JSON_Object *root = json_value_get_object(value);
+        CHECK(json_array_get_count(json_object_get_array(root, "b")) == 1);
+        CHECK(json_object_get_count(json_object_get_object(root, "a")) == 1);
+        json_value_free(value);
+    }
+
+    return failures;
+}
+
+static int TestEventsLongEscapedString(void)
+{
+    int failures = 0;
+    char json[1024];
+    char note[512];
+
+    // A 300-byte escaped string, longer than the event parser's scratch space, ahead of the
+    // property the device acts on.
+    char *end = RepeatInto(json + sprintf(json, "{\"note\":\""), "\\\"", 150);
+    strcpy(end, "\",\"StatusLED\":{\"value\":true}}");
+    CHECK(json_parse_events(json, strlen(json), FindNote, note) == JSONSuccess);
+    CHECK(strlen(note) == 150 && strspn(note, "\"") == 150);
+
+    // Too long for the field it's bound to, the string fails the decode...
+    DesiredProperties desired;
+    CHECK(json_schema_decode(DesiredProperties_schema(), json, strlen(json), &desired) ==
+          JSONFailure);
+
+    // ...but unbound, or short enough once unescaped, it doesn't stop the rest decoding.
+    end = RepeatInto(json + sprintf(json, "{\"other\":\""), "\\u0041", 50);
+    end += sprintf(end, "\",\"note\":\"");
+    end = RepeatInto(end, "\\u0042", 50);
+    strcpy(end, "\",\"StatusLED\":{\"value\":true}}");
+    CHECK(json_schema_decode(DesiredProperties_schema(), json, strlen(json), &desired) ==
+          JSONSuccess);
+    CHECK(desired.has_StatusLED && desired.StatusLED.has_value && desired.StatusLED.value);
+    CHECK(desired.has_note && strlen(desired.note) == 50 && strspn(desired.note, "B") == 50);
+
+    // Long escaped names are compared unescaped.
+    char name[64];
+    RepeatInto(name, "A", 50);
+    end = RepeatInto(json + sprintf(json, "{\""), "\\u0041", 50);
+    strcpy(end, "\":true}");
+    CHECK(json_parse_events(json, strlen(json), FindName, name) == JSONSuccess);
+    name[49] = '\0';
+    CHECK(json_parse_events(json, strlen(json), FindName, name) == JSONFailure);
+
+    // Invalid escapes still fail the parse, however long the string.
+    end = RepeatInto(json + sprintf(json, "[\""), "\\\"", 150);
+    strcpy(end, "\\x\"]");
+    CHECK(json_parse_events(json, strlen(json), IgnoreEvent, NULL) == JSONFailure);
+    end = RepeatInto(json + sprintf(json, "[\""), "\\\"", 150);
+    strcpy(end, "\\ud800\"]");
+    CHECK(json_parse_events(json, strlen(json), IgnoreEvent, NULL) == JSONFailure);
+
+    return failures;
+}
+
+// The event parser and schema decoding report every member of an object, so a name given twice
+// keeps its last value there, while the DOM parser rejects the document.
+static int TestDuplicateMemberNames(void)
+{
+    int failures = 0;
+    static const char json[] = "{\"note\":\"first\",\"note\":\"last\"}";
+
+    CHECK(json_parse_string(json) == NULL);
+
+    DesiredProperties desired;
+    CHECK(json_schema_decode(DesiredProperties_schema(), json, sizeof(json) - 1, &desired) ==
+          JSONSuccess);
+    CHECK(desired.has_note && strcmp(desired.note, "last") == 0);
+
+    return failures;
+}
+
+static int TestCborTruncatedUtf8(void)
+{
+    int failures = 0;
+
+    // Text strings ending in the lead byte of a multi-byte sequence, alone and as a member.
+    static const unsigned char lead3[] = {0x61, 0xE2};
+    static const unsigned char lead3Partial[] = {0x62, 0xE2, 0x82};
+    static const unsigned char lead4Partial[] = {0x63, 0xF0, 0x9F, 0x98};
+    static const unsigned char member[] = {0xA1, 0x61, 0x61, 0x61, 0xE2};
+    static const unsigned char name[] = {0xA1, 0x61, 0xC3};
+
+    CHECK(FromCborCopy(lead3, sizeof(lead3)) == NULL);
+    CHECK(FromCborCopy(lead3Partial, sizeof(lead3Partial)) == NULL);
+    CHECK(FromCborCopy(lead4Partial, sizeof(lead4Partial)) == NULL);
+    CHECK(FromCborCopy(member, sizeof(member)) == NULL);
+    CHECK(FromCborCopy(name, sizeof(name)) == NULL);
+    CHECK(ParseCborEventsCopy(lead3, sizeof(lead3)) == JSONFailure);
+    CHECK(ParseCborEventsCopy(member, sizeof(member)) == JSONFailure);
+
+    // The same sequences complete still decode.
+    static const unsigned char complete[] = {0x63, 0xE2, 0x82, 0xAC};
+    JSON_Value *value = FromCborCopy(complete, sizeof(complete));
+    CHECK(value != NULL && strcmp(json_value_get_string(value), "\xE2\x82\xAC") == 0);
+    json_value_free(value);
+
+    return failures;
+}
+
+static int TestCborRoundTripUtf8(void)
+{
+    int failures = 0;
+    unsigned char buf[64];
+
+    // Valid UTF-8 round trips.
+    JSON_Value *value = json_parse_string("{\"n\\u00e9\":\"\\u20ac\\ud83d\\ude00\"}");
+    size_t length = json_value_to_cbor(value, buf, sizeof(buf));
+    CHECK(length > 0);
+    JSON_Value *decoded = json_value_from_cbor(buf, length);
+    CHECK(decoded != NULL && json_value_equals(value, decoded));
+    json_value_free(decoded);
+    json_value_free(value);
+
+    // A string the parser took as raw bytes, but that isn't UTF-8, isn't encoded, as it
+    // couldn't be decoded again.
+    value = json_parse_string("[\"\xC3\x28\"]");
+    if (value != NULL) {
+        CHECK(json_value_to_cbor(value, buf, sizeof(buf)) == 0);
+        CHECK(json_value_to_cbor(value, NULL, 0) == 0);
+        json_value_free(value);
+    }
+    value = json_parse_string("{\"\xFF\":1}");
+    if (value != NULL) {
+        CHECK(json_value_to_cbor(value, buf, sizeof(buf)) == 0);
+        json_value_free(value);
+    }
+
+    JSON_CBOR_Writer writer;
+    json_cbor_writer_init(&writer, buf, sizeof(buf));
+    CHECK(json_cbor_write_string(&writer, "\xE2\x82") == JSONFailure);
+    CHECK(json_cbor_writer_get_length(&writer) == 0);
+
+    return failures;
+}
+
+static int TestCborLargeNegativeInteger(void)
+{
+    int failures = 0;
+    unsigned char buf[16];
+
+    // Whole numbers beyond 2^53 are written as CBOR integers, and must decode to the same double.
+    static const double numbers[] = {-11481052484747254.0, -9007199254740994.0,
+                                     -9223372036854775808.0, -18446744073709551616.0};
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        JSON_Value *value = json_value_init_number(numbers[i]);
+        size_t length = json_value_to_cbor(value, buf, sizeof(buf));
+        CHECK(length > 0);
+        JSON_Value *decoded = FromCborCopy(buf, length);
+        CHECK(decoded != NULL && json_value_get_number(decoded) == numbers[i]);
+        json_value_free(decoded);
+        json_value_free(value);
+    }
+
+    // The most negative CBOR integer, -2^64.
+    static const unsigned char smallest[] = {0x3B, 0xFF, 0xFF, 0xFF, 0xFF,
+                                             0xFF, 0xFF, 0xFF, 0xFF};
+    JSON_Value *value = FromCborCopy(smallest, sizeof(smallest));
+    CHECK(value != NULL && json_value_get_number(value) == -18446744073709551616.0);
+    json_value_free(value);
+
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    failures += TestScannersAtBlockBoundaries();
+    failures += TestEventsLongEscapedString();
+    failures += TestDuplicateMemberNames();
+    failures += TestCborTruncatedUtf8();
+    failures += TestCborRoundTripUtf8();
+    failures += TestCborLargeNegativeInteger();
+    failures += TestLazyMalformedSubtree();
+    failures += TestLazyNestingDepth();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All parson tests passed\n");
+    return EXIT_SUCCESS;
+}
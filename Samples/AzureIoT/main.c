@@ -50,6 +50,9 @@
 #include <iothubtransportmqtt.h>
 #include <iothub.h>
 #include <azure_sphere_provisioning.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
+#include <azure_prov_client/prov_security_factory.h>
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -74,12 +77,28 @@ typedef enum {
     ExitCode_Init_ButtonPollTimer = 9,
     ExitCode_Init_AzureTimer = 10,
 
-    ExitCode_IsButtonPressed_GetValue = 11
+    ExitCode_IsButtonPressed_GetValue = 11,
+
+    ExitCode_Init_ReportedProperties = 12,
+    ExitCode_Init_TelemetryBatchTimer = 13,
+
+    ExitCode_TelemetryBatchTimer_Consume = 14,
+
+    ExitCode_Init_DoWorkTimer = 15,
+    ExitCode_DoWorkTimer_Consume = 16,
+
+    ExitCode_Init_AggregationTimer = 17,
+    ExitCode_AggregationTimer_Consume = 18
 } ExitCode;
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 #include "parson.h" // used to parse Device Twin messages.
+#include "parson_schema.h"
+#include "telemetry_queue.h" // keeps telemetry in mutable storage while offline.
+#include "message_builder.h" // writes telemetry messages into pooled buffers.
+#include "telemetry_aggregation.h" // summarizes telemetry over time windows.
+#include "provisioning_cache.h" // keeps the IoT Hub assigned by DPS in mutable storage.
 
 // Azure IoT Hub/Central defines.
 #define SCOPEID_LENGTH 20
@@ -89,19 +108,70 @@ static char scopeId[SCOPEID_LENGTH]; // ScopeId for the Azure IoT Central applic
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
 static const int keepalivePeriodSeconds = 20;
 static bool iothubAuthenticated = false;
+static bool iothubConnected = false; // The client reported that it is authenticated.
+
+// The IoT Hub and device ID that the Device Provisioning Service (DPS) assigns are cached in
+// mutable storage, and the client connects straight to that hub, without the DPS round trips.
+// If the cached hub does not authenticate the device within CachedHubConnectTimeoutMs, or fails
+// to, the device is provisioned through DPS instead. The cache is only erased from storage when
+// the hub rejects the device's credentials, or times out while the network is up; after other
+// failures, which may be transient, it is skipped until the application restarts.
+static const char DpsGlobalEndpoint[] = "global.azure-devices-provisioning.net";
+static const long long DpsTimeoutMs = 10000;
+static const struct timespec DpsPollInterval = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+static const long long CachedHubConnectTimeoutMs = 20000;
+// Has DPS and IoT Hub take the device ID from the Azure Sphere device certificate, through their
+// "SetDeviceId" option.
+static const int deviceIdForDaaCertUsage = 1;
+static bool iothubConnectedFromCache = false;
+static bool iothubConnectionVerified = false; // Authenticated since the client was created.
+static bool provisioningCacheStale = false;
+static long long iothubClientCreatedMs = 0;
+
+// Time to first telemetry: from start-up until IoT Hub first acknowledges a message.
+static long long applicationStartMs = 0;
+static bool firstTelemetryAcknowledged = false;
+
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback);
 static void TwinReportBoolState(const char *propertyName, bool propertyValue);
+static void TwinReportChangedProperties(void);
 static void ReportStatusCallback(int result, void *context);
+static void DiscardReportedPropertiesPatch(void *context);
 static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
-static const char *getAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
+static bool ProvisionWithDps(ProvisioningCacheEntry *assignment);
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iothubUri,
+                                      const char *deviceId, void *userContext);
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE CreateHubClient(const ProvisioningCacheEntry *assignment);
+static void AbandonProvisioningCache(const char *reason, bool erase);
+static void RetryAzureClientSetupLater(void);
+static long long GetMonotonicTimeMs(void);
+typedef void (*TelemetryValueWriter)(MessageBuilder *builder, const void *value);
+static void AddTelemetryReading(const char *key, TelemetryValueWriter writeValue,
+                                const void *value);
+static void WriteStringValue(MessageBuilder *builder, const void *value);
+static void WriteTemperatureValue(MessageBuilder *builder, const void *value);
 static void SendTelemetry(const unsigned char *key, const unsigned char *value);
+static void FlushTelemetryBatch(void);
+typedef struct TelemetryReplay TelemetryReplay;
+static bool SendTelemetryMessage(const char *message, size_t length, time_t createdTime,
+                                 TelemetryReplay *replay);
+static void QueueTelemetryMessage(const char *message, size_t length, size_t readings);
+static void ReplayQueuedTelemetry(void);
+static void EndTelemetryReplay(bool delivered);
+static void DiscardTelemetryReplay(void *context);
+static void TelemetryBatchTimerEventHandler(EventLoopTimer *timer);
 static void SetupAzureClient(void);
+static void ScheduleDoWork(const struct timespec *delay);
+static void RequestDoWork(void);
+static void DoWorkTimerEventHandler(EventLoopTimer *timer);
 
 // Function to generate simulated Temperature data/telemetry
 static void SendSimulatedTemperature(void);
+static void ConfigureTemperatureAggregation(long windowSeconds, long slideSeconds);
+static void WriteAggregationSummary(MessageBuilder *builder, const void *value);
+static void AggregationTimerEventHandler(EventLoopTimer *timer);
 
 // Initialization/Cleanup
 static ExitCode InitPeripheralsAndHandlers(void);
@@ -117,10 +187,27 @@ static int sendOrientationButtonGpioFd = -1;
 static int deviceTwinStatusLedGpioFd = -1;
 static bool statusLedOn = false;
 
+// Device Twin reported properties as set by the application, and as last acknowledged by IoT Hub.
+// Only the difference between the two is sent, in at most one report per DoWork() cycle: setting
+// a property marks them dirty, and the next cycle reports all the properties changed since. While
+// a report is in flight, further changes wait for it, and go together in the next one.
+static JSON_Value *reportedProperties = NULL;
+static JSON_Value *lastReportedProperties = NULL;
+static bool reportedPropertiesDirty = false;
+static bool reportedPropertiesInFlight = false;
+
+// Reported property writes, and the reports that carried them; the difference is the number of
+// round trips saved by coalescing.
+static unsigned long reportedPropertyWrites = 0;
+static unsigned long reportedPropertyReports = 0;
+
 // Timer / polling
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *buttonPollTimer = NULL;
 static EventLoopTimer *azureTimer = NULL;
+static EventLoopTimer *telemetryBatchTimer = NULL;
+static EventLoopTimer *doWorkTimer = NULL;
+static EventLoopTimer *aggregationTimer = NULL;
 
 // Azure IoT poll periods
 static const int AzureIoTDefaultPollPeriodSeconds = 5;
@@ -129,6 +216,93 @@ static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60;
 
 static int azureIoTPollPeriodSeconds = -1;
 
+// IoTHubDeviceClient_LL_DoWork() is run as soon as work is enqueued with the client, every
+// DoWorkBusyInterval while it has messages to send or acknowledgements to wait for, and otherwise
+// after an idle interval that doubles from DoWorkIdleMinInterval up to DoWorkIdleMaxInterval. The
+// maximum is kept well below keepalivePeriodSeconds, so the connection stays up while idle.
+static const struct timespec DoWorkNow = {.tv_sec = 0, .tv_nsec = 1};
+static const struct timespec DoWorkBusyInterval = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+static const struct timespec DoWorkIdleMinInterval = {.tv_sec = 1, .tv_nsec = 0};
+static const struct timespec DoWorkIdleMaxInterval = {.tv_sec = 8, .tv_nsec = 0};
+static struct timespec doWorkIdleInterval = {.tv_sec = 1, .tv_nsec = 0};
+static bool doWorkDue = false; // Set when work is enqueued, until DoWork() runs.
+
+// Work enqueued with the IoT Hub client and not yet acknowledged, which is tracked to keep
+// DoWork() busy and to measure the time from enqueueing to acknowledgement. Each entry is the
+// context of the SDK callback, and carries the caller's own context, which is given to discard
+// if the client is destroyed before the callback runs.
+#define IOTHUB_WORK_TRACKED 16
+typedef void (*IoTHubWorkDiscard)(void *context);
+typedef struct {
+    bool inUse;
+    long long enqueuedMs;
+    void *context;
+    IoTHubWorkDiscard discard;
+} IoTHubWork;
+static IoTHubWork ioTHubWork[IOTHUB_WORK_TRACKED];
+static size_t ioTHubWorkPending = 0;
+static unsigned long ioTHubWorkAcknowledged = 0;
+static long long ioTHubAckLatencyTotalMs = 0;
+static long long ioTHubAckLatencyMaxMs = 0;
+
+// Each telemetry reading is sent as its own JSON object message, such as {"Temperature":30.15},
+// which is what IoT Central accepts. Setting TelemetryBatchMaxReadings above 1 batches readings
+// into a single JSON array message instead, for an IoT hub whose consumers read arrays; IoT
+// Central does not accept arrays. A batch is sent once it holds TelemetryBatchMaxReadings
+// readings, once the next reading would not fit in its buffer of MESSAGE_BUILDER_BUFFER_BYTES,
+// or TelemetryBatchMaxLatency after its first reading was added.
+_Static_assert(MESSAGE_BUILDER_BUFFER_BYTES <= TELEMETRY_QUEUE_MESSAGE_MAX_BYTES,
+               "A telemetry batch must fit in the telemetry queue");
+static const size_t TelemetryBatchMaxReadings = 1;
+static const struct timespec TelemetryBatchMaxLatency = {.tv_sec = 30, .tv_nsec = 0};
+
+// The batch being filled, taken from the message builder pool with its first reading.
+static MessageBuilder *telemetryBatch = NULL;
+static size_t telemetryBatchReadings = 0;
+// Monotonic times, in milliseconds, at which the first reading in the batch was added, and the
+// sum of the times at which each of them was added.
+static long long telemetryBatchFirstAddedMs = 0;
+static long long telemetryBatchAddedMs = 0;
+
+// Batching statistics: messages saved is readings sent minus messages sent, and the latency
+// added is how long readings waited in a batch before it was handed to the IoT Hub client.
+static unsigned long telemetryReadingsSent = 0;
+static unsigned long telemetryMessagesSent = 0;
+static unsigned long telemetryReadingsDropped = 0;
+static long long telemetryLatencyAddedTotalMs = 0;
+static long long telemetryLatencyAddedMaxMs = 0;
+
+// Telemetry batches that can't be sent while the device is offline are kept in mutable storage,
+// and replayed oldest first once the client reports that it is connected again. One replayed
+// message is in flight at a time, and it is only removed from the queue once IoT Hub confirms
+// it, so a message the client accepted but could not deliver is replayed again. The provisioning
+// cache follows the queue in mutable storage, and both must fit in the MutableStorage SizeKB of
+// app_manifest.json.
+_Static_assert(TELEMETRY_QUEUE_STORAGE_BYTES + PROVISIONING_CACHE_STORAGE_BYTES <= 8 * 1024,
+               "Mutable storage must hold the telemetry queue and the provisioning cache");
+static const off_t TelemetryQueueStorageOffset = 0;
+static const off_t ProvisioningCacheStorageOffset = TELEMETRY_QUEUE_STORAGE_BYTES;
+static int mutableStorageFd = -1;
+static bool telemetryQueueOpen = false;
+static TelemetryQueue telemetryQueue;
+static unsigned long telemetryMessagesReplayed = 0;
+
+// The replayed message in flight, identified by its queue headSequence when it was sent; given
+// to BeginIoTHubWork() as the context of its confirmation.
+struct TelemetryReplay {
+    bool inFlight;
+    unsigned long sequence;
+};
+static TelemetryReplay telemetryReplay = {.inFlight = false, .sequence = 0};
+
+// When enabled by the TemperatureAggregation desired property, simulated temperatures are
+// summarized over a window of windowSeconds that slides every slideSeconds, or tumbles if the two
+// are equal, and a TemperatureSummary is sent every slideSeconds in place of the readings.
+static AggregationSeries temperatureSeries;
+static bool temperatureAggregationEnabled = false;
+static long temperatureAggregationWindowSeconds = 0;
+static long temperatureAggregationSlideSeconds = 0;
+
 // Button state variables
 static GPIO_Value_Type sendMessageButtonState = GPIO_Value_High;
 static GPIO_Value_Type sendOrientationButtonState = GPIO_Value_High;
@@ -139,6 +313,9 @@ static void SendMessageButtonHandler(void);
 static void SendOrientationButtonHandler(void);
 static bool deviceIsUp = false; // Orientation
 static void AzureTimerEventHandler(EventLoopTimer *timer);
+static IoTHubWork *BeginIoTHubWork(void *context, IoTHubWorkDiscard discard);
+static void *EndIoTHubWork(IoTHubWork *work, bool acknowledged);
+static void DiscardIoTHubWork(void);
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -201,7 +378,8 @@ static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
 }
 
 /// <summary>
-/// Azure timer event:  Check connection status and send telemetry
+/// Azure timer event:  Check connection status and send telemetry. The IoT Hub client does its
+/// work on the DoWork timer.
 /// </summary>
 static void AzureTimerEventHandler(EventLoopTimer *timer)
 {
@@ -211,17 +389,154 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
     }
 
     bool isNetworkReady = false;
-    if (Networking_IsNetworkingReady(&isNetworkReady) != -1) {
-        if (isNetworkReady && !iothubAuthenticated) {
-            SetupAzureClient();
-        }
-    } else {
+    bool isNetworkStateKnown = Networking_IsNetworkingReady(&isNetworkReady) != -1;
+    if (!isNetworkStateKnown) {
         Log_Debug("Failed to get Network state\n");
     }
 
+    if (iothubConnectedFromCache && !iothubConnectionVerified &&
+        GetMonotonicTimeMs() - iothubClientCreatedMs >= CachedHubConnectTimeoutMs) {
+        AbandonProvisioningCache("timed out", isNetworkStateKnown && isNetworkReady);
+        iothubAuthenticated = false;
+    }
+
+    if (isNetworkReady && !iothubAuthenticated) {
+        SetupAzureClient();
+    }
+
     if (iothubAuthenticated) {
         SendSimulatedTemperature();
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    }
+    if (iothubConnected) {
+        ReplayQueuedTelemetry();
+    }
+}
+
+/// <summary>
+///     Runs IoTHubDeviceClient_LL_DoWork() after delay, or sooner if it is already due.
+/// </summary>
+static void ScheduleDoWork(const struct timespec *delay)
+{
+    SetEventLoopTimerOneShot(doWorkTimer, delay);
+}
+
+/// <summary>
+/// DoWork timer event:  Let the IoT Hub client send and receive, and schedule the next run
+/// </summary>
+static void DoWorkTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_DoWorkTimer_Consume;
+        return;
+    }
+
+    // SetupAzureClient() schedules DoWork again once there is a client.
+    if (iothubClientHandle == NULL) {
+        return;
+    }
+
+    if (reportedPropertiesDirty && !reportedPropertiesInFlight) {
+        TwinReportChangedProperties();
+    }
+
+    doWorkDue = false;
+    IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+
+    // Work enqueued by the callbacks DoWork() invoked goes out right away.
+    if (doWorkDue) {
+        ScheduleDoWork(&DoWorkNow);
+        return;
+    }
+
+    IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    IoTHubDeviceClient_LL_GetSendStatus(iothubClientHandle, &sendStatus);
+    if (ioTHubWorkPending > 0 || sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY) {
+        doWorkIdleInterval = DoWorkIdleMinInterval;
+        ScheduleDoWork(&DoWorkBusyInterval);
+        return;
+    }
+
+    ScheduleDoWork(&doWorkIdleInterval);
+    doWorkIdleInterval.tv_sec *= 2;
+    if (doWorkIdleInterval.tv_sec > DoWorkIdleMaxInterval.tv_sec) {
+        doWorkIdleInterval = DoWorkIdleMaxInterval;
+    }
+}
+
+/// <summary>
+///     Has DoWork() run right away, or as soon as the run in progress returns.
+/// </summary>
+static void RequestDoWork(void)
+{
+    doWorkDue = true;
+    ScheduleDoWork(&DoWorkNow);
+}
+
+/// <summary>
+///     Records that work was enqueued with the IoT Hub client, and has DoWork() run right away.
+/// </summary>
+/// <param name="context">The caller's context, returned by EndIoTHubWork()</param>
+/// <param name="discard">Releases context if the work is dropped with the client, or NULL</param>
+/// <returns>The context to give the SDK callback, or NULL if too much work is in flight to
+/// track more</returns>
+static IoTHubWork *BeginIoTHubWork(void *context, IoTHubWorkDiscard discard)
+{
+    RequestDoWork();
+
+    for (size_t i = 0; i < IOTHUB_WORK_TRACKED; ++i) {
+        if (!ioTHubWork[i].inUse) {
+            ioTHubWork[i].inUse = true;
+            ioTHubWork[i].enqueuedMs = GetMonotonicTimeMs();
+            ioTHubWork[i].context = context;
+            ioTHubWork[i].discard = discard;
+            ++ioTHubWorkPending;
+            return &ioTHubWork[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Records that work from BeginIoTHubWork() completed, or was never enqueued.
+/// </summary>
+/// <param name="acknowledged">true if IoT Hub acknowledged the work, which is then included in
+/// the latency statistics</param>
+/// <returns>The caller's context given to BeginIoTHubWork()</returns>
+static void *EndIoTHubWork(IoTHubWork *work, bool acknowledged)
+{
+    void *context = work->context;
+    work->inUse = false;
+    --ioTHubWorkPending;
+
+    if (acknowledged) {
+        long long latencyMs = GetMonotonicTimeMs() - work->enqueuedMs;
+        ++ioTHubWorkAcknowledged;
+        ioTHubAckLatencyTotalMs += latencyMs;
+        if (latencyMs > ioTHubAckLatencyMaxMs) {
+            ioTHubAckLatencyMaxMs = latencyMs;
+        }
+        Log_Debug("INFO: IoT Hub acknowledged after %lld ms (%lld ms on average, %lld ms at "
+                  "most)\n",
+                  latencyMs, ioTHubAckLatencyTotalMs / (long long)ioTHubWorkAcknowledged,
+                  ioTHubAckLatencyMaxMs);
+    }
+    return context;
+}
+
+/// <summary>
+///     Ends the work whose callbacks a destroyed client will no longer invoke, and has each
+///     caller release its context.
+/// </summary>
+static void DiscardIoTHubWork(void)
+{
+    for (size_t i = 0; i < IOTHUB_WORK_TRACKED; ++i) {
+        if (ioTHubWork[i].inUse) {
+            IoTHubWorkDiscard discard = ioTHubWork[i].discard;
+            void *context = EndIoTHubWork(&ioTHubWork[i], false);
+            if (discard != NULL) {
+                discard(context);
+            }
+        }
     }
 }
 
@@ -286,6 +601,51 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_AzureTimer;
     }
 
+    // Armed when the first reading is added to a telemetry batch. Unbatched readings are sent
+    // as they are added, so they need no timer.
+    if (TelemetryBatchMaxReadings > 1) {
+        telemetryBatchTimer =
+            CreateEventLoopDisarmedTimer(eventLoop, &TelemetryBatchTimerEventHandler);
+        if (telemetryBatchTimer == NULL) {
+            return ExitCode_Init_TelemetryBatchTimer;
+        }
+    }
+
+    // Armed once there is an IoT Hub client.
+    doWorkTimer = CreateEventLoopDisarmedTimer(eventLoop, &DoWorkTimerEventHandler);
+    if (doWorkTimer == NULL) {
+        return ExitCode_Init_DoWorkTimer;
+    }
+
+    // Armed when temperature aggregation is enabled.
+    aggregationTimer = CreateEventLoopDisarmedTimer(eventLoop, &AggregationTimerEventHandler);
+    if (aggregationTimer == NULL) {
+        return ExitCode_Init_AggregationTimer;
+    }
+
+    reportedProperties = json_value_init_object();
+    lastReportedProperties = json_value_init_object();
+    if (reportedProperties == NULL || lastReportedProperties == NULL) {
+        Log_Debug("ERROR: Could not allocate the Device Twin reported properties.\n");
+        return ExitCode_Init_ReportedProperties;
+    }
+
+    // Without the queue, telemetry is dropped while offline, and without mutable storage at all,
+    // the device is provisioned through DPS every time, as it would be without storage.
+    mutableStorageFd = Storage_OpenMutableFile();
+    if (mutableStorageFd == -1) {
+        Log_Debug("WARNING: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+    } else if (TelemetryQueue_Open(&telemetryQueue, mutableStorageFd, TelemetryQueueStorageOffset,
+                                   TelemetryQueueOverflow_DropOldest) == 0) {
+        telemetryQueueOpen = true;
+        if (TelemetryQueue_GetCount(&telemetryQueue) > 0) {
+            Log_Debug("INFO: %zu telemetry messages are queued from a previous run.\n",
+                      TelemetryQueue_GetCount(&telemetryQueue));
+        }
+    }
+
+    applicationStartMs = GetMonotonicTimeMs();
+
     return ExitCode_Success;
 }
 
@@ -311,8 +671,15 @@ static void ClosePeripheralsAndHandlers(void)
 {
     DisposeEventLoopTimer(buttonPollTimer);
     DisposeEventLoopTimer(azureTimer);
+    DisposeEventLoopTimer(telemetryBatchTimer);
+    DisposeEventLoopTimer(doWorkTimer);
+    DisposeEventLoopTimer(aggregationTimer);
     EventLoop_Close(eventLoop);
 
+    if (telemetryBatchReadings > 0) {
+        Log_Debug("WARNING: Discarding %zu batched telemetry readings.\n", telemetryBatchReadings);
+    }
+
     Log_Debug("Closing file descriptors\n");
 
     // Leave the LEDs off
@@ -323,6 +690,10 @@ static void ClosePeripheralsAndHandlers(void)
     CloseFdAndPrintError(sendMessageButtonGpioFd, "SendMessageButton");
     CloseFdAndPrintError(sendOrientationButtonGpioFd, "SendOrientationButton");
     CloseFdAndPrintError(deviceTwinStatusLedGpioFd, "StatusLed");
+    CloseFdAndPrintError(mutableStorageFd, "MutableStorage");
+
+    json_value_free(reportedProperties);
+    json_value_free(lastReportedProperties);
 }
 
 /// <summary>
@@ -334,11 +705,31 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         void *userContextCallback)
 {
     iothubAuthenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    iothubConnected = iothubAuthenticated;
     Log_Debug("IoT Hub Authenticated: %s\n", GetReasonString(reason));
+
+    // Telemetry queued while offline goes out as soon as the connection is back.
+    if (iothubConnected) {
+        ReplayQueuedTelemetry();
+    }
+
+    // A cached IoT Hub that fails to authenticate the device is given up on, unless there is no
+    // network, in which case DPS would not be reachable either. Only a hub that rejects the
+    // device's credentials is known not to be the device's hub any more.
+    if (iothubAuthenticated) {
+        iothubConnectionVerified = true;
+    } else if (iothubConnectedFromCache && !iothubConnectionVerified &&
+               reason != IOTHUB_CLIENT_CONNECTION_NO_NETWORK) {
+        bool rejected = reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL ||
+                        reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED ||
+                        reason == IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN;
+        AbandonProvisioningCache(GetReasonString(reason), rejected);
+    }
 }
 
 /// <summary>
-///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
+///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle), to the IoT Hub in
+///     the provisioning cache if there is one, and otherwise to the one DPS assigns.
 ///     When the SAS Token for a device expires the connection needs to be recreated
 ///     which is why this is not simply a one time call.
 /// </summary>
@@ -346,35 +737,41 @@ static void SetupAzureClient(void)
 {
     if (iothubClientHandle != NULL) {
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        iothubClientHandle = NULL;
+        DiscardIoTHubWork();
     }
 
-    AZURE_SPHERE_PROV_RETURN_VALUE provResult =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
-                                                                          &iothubClientHandle);
-    Log_Debug("IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
-              getAzureSphereProvisioningResultString(provResult));
-
-    if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK) {
-
-        // If we fail to connect, reduce the polling frequency, starting at
-        // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
-        // AzureIoTMaxReconnectPeriodSeconds
-        if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds) {
-            azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
-        } else {
-            azureIoTPollPeriodSeconds *= 2;
-            if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
-                azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
-            }
+    ProvisioningCacheEntry assignment;
+    iothubConnectedFromCache = false;
+    if (!provisioningCacheStale && mutableStorageFd != -1 &&
+        ProvisioningCache_Load(mutableStorageFd, ProvisioningCacheStorageOffset, &assignment) ==
+            0) {
+        Log_Debug("INFO: Connecting to IoT Hub '%s' as provisioned before.\n",
+                  assignment.hubHostName);
+        iothubClientHandle = CreateHubClient(&assignment);
+        iothubConnectedFromCache = (iothubClientHandle != NULL);
+        if (!iothubConnectedFromCache) {
+            AbandonProvisioningCache("could not create the client", false);
         }
+    }
 
-        struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+    if (iothubClientHandle == NULL) {
+        if (ProvisionWithDps(&assignment)) {
+            iothubClientHandle = CreateHubClient(&assignment);
+        }
+        if (iothubClientHandle == NULL) {
+            RetryAzureClientSetupLater();
+            return;
+        }
 
-        Log_Debug("ERROR: failure to create IoTHub Handle - will retry in %i seconds.\n",
-                  azureIoTPollPeriodSeconds);
-        return;
+        provisioningCacheStale = false;
+        if (mutableStorageFd != -1) {
+            ProvisioningCache_Save(mutableStorageFd, ProvisioningCacheStorageOffset, &assignment);
+        }
     }
+    iothubClientCreatedMs = GetMonotonicTimeMs();
+    iothubConnectionVerified = false;
+    iothubConnected = false;
 
     // Successfully connected, so make sure the polling frequency is back to the default
     azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
@@ -392,8 +789,33 @@ static void SetupAzureClient(void)
     IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, TwinCallback, NULL);
     IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle,
                                                       HubConnectionStatusCallback, NULL);
+
+    // Connect, and receive the Device Twin, right away.
+    doWorkIdleInterval = DoWorkIdleMinInterval;
+    ScheduleDoWork(&DoWorkNow);
 }
 
+// The parts of a Device Twin document the application reads: StatusLED.value and
+// TemperatureAggregation, at the root in a patch and under "desired" in a full document.
+#define STATUS_LED_PROPERTY_FIELDS(FIELD) FIELD(BOOLEAN, value, 0)
+#define AGGREGATION_PROPERTY_FIELDS(FIELD) \
+    FIELD(INTEGER, windowSeconds, 0) FIELD(INTEGER, slideSeconds, 0)
+#define DESIRED_PROPERTIES_FIELDS(FIELD)        \
+    FIELD(OBJECT, StatusLED, StatusLedProperty) \
+    FIELD(OBJECT, TemperatureAggregation, AggregationProperty)
+#define TWIN_DOCUMENT_FIELDS(FIELD)                                                       \
+    FIELD(OBJECT, desired, DesiredProperties) FIELD(OBJECT, StatusLED, StatusLedProperty) \
+    FIELD(OBJECT, TemperatureAggregation, AggregationProperty)
+
+JSON_SCHEMA_STRUCT(StatusLedProperty, STATUS_LED_PROPERTY_FIELDS)
+JSON_SCHEMA_STRUCT(AggregationProperty, AGGREGATION_PROPERTY_FIELDS)
+JSON_SCHEMA_STRUCT(DesiredProperties, DESIRED_PROPERTIES_FIELDS)
+JSON_SCHEMA_STRUCT(TwinDocument, TWIN_DOCUMENT_FIELDS)
+JSON_SCHEMA_DEFINE(StatusLedProperty, STATUS_LED_PROPERTY_FIELDS)
+JSON_SCHEMA_DEFINE(AggregationProperty, AGGREGATION_PROPERTY_FIELDS)
+JSON_SCHEMA_DEFINE(DesiredProperties, DESIRED_PROPERTIES_FIELDS)
+JSON_SCHEMA_DEFINE(TwinDocument, TWIN_DOCUMENT_FIELDS)
+
 /// <summary>
 ///     Callback invoked when a Device Twin update is received from IoT Hub.
 ///     Updates local state for 'showEvents' (bool).
@@ -403,44 +825,35 @@ static void SetupAzureClient(void)
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
-    }
-
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
-
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
-    if (rootProperties == NULL) {
+    // Only a few desired properties are needed, so decode them straight into a struct in a
+    // single pass over the payload rather than building the whole document.
+    TwinDocument twin;
+    if (json_schema_decode(TwinDocument_schema(), (const char *)payload, payloadSize, &twin) ==
+        JSONFailure) {
         Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
+        return;
     }
 
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-    if (desiredProperties == NULL) {
-        desiredProperties = rootObject;
-    }
+    // A full twin document has its desired properties under "desired", a patch at the root.
+    const StatusLedProperty *statusLed =
+        twin.has_desired ? &twin.desired.StatusLED : &twin.StatusLED;
 
     // Handle the Device Twin Desired Properties here.
-    JSON_Object *LEDState = json_object_dotget_object(desiredProperties, "StatusLED");
-    if (LEDState != NULL) {
-        statusLedOn = (bool)json_object_get_boolean(LEDState, "value");
+    if (statusLed->has_value) {
+        statusLedOn = statusLed->value != 0;
         GPIO_SetValue(deviceTwinStatusLedGpioFd,
                       (statusLedOn == true ? GPIO_Value_Low : GPIO_Value_High));
         TwinReportBoolState("StatusLED", statusLedOn);
     }
 
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    // slideSeconds defaults to windowSeconds, for a tumbling window.
+    const AggregationProperty *aggregation =
+        twin.has_desired ? &twin.desired.TemperatureAggregation : &twin.TemperatureAggregation;
+    if (aggregation->has_windowSeconds) {
+        ConfigureTemperatureAggregation(aggregation->windowSeconds,
+                                        aggregation->has_slideSeconds ? aggregation->slideSeconds
+                                                                      : aggregation->windowSeconds);
+    }
 }
 
 /// <summary>
@@ -475,66 +888,471 @@ static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
     return reasonString;
 }
 
+// The outcome of a DPS registration, filled in by DpsRegisterDeviceCallback().
+typedef struct {
+    bool done;
+    PROV_DEVICE_RESULT result;
+    ProvisioningCacheEntry *assignment;
+} DpsRegistration;
+
+/// <summary>
+///     Registers the device with DPS, using its Azure Sphere device certificate, and returns the
+///     IoT Hub it is assigned to. Blocks for at most DpsTimeoutMs.
+/// </summary>
+/// <returns>true if the device was assigned to an IoT Hub</returns>
+static bool ProvisionWithDps(ProvisioningCacheEntry *assignment)
+{
+    long long startMs = GetMonotonicTimeMs();
+    if (prov_dev_security_init(SECURE_DEVICE_TYPE_X509) != 0) {
+        Log_Debug("ERROR: Could not initialize DPS security.\n");
+        return false;
+    }
+
+    PROV_DEVICE_LL_HANDLE provHandle =
+        Prov_Device_LL_Create(DpsGlobalEndpoint, scopeId, Prov_Device_MQTT_Protocol);
+    if (provHandle == NULL) {
+        Log_Debug("ERROR: Could not create the DPS client.\n");
+        prov_dev_security_deinit();
+        return false;
+    }
+
+    DpsRegistration registration = {
+        .done = false, .result = PROV_DEVICE_RESULT_ERROR, .assignment = assignment};
+    if (Prov_Device_LL_SetOption(provHandle, "SetDeviceId", &deviceIdForDaaCertUsage) !=
+            PROV_DEVICE_RESULT_OK ||
+        Prov_Device_LL_Register_Device(provHandle, DpsRegisterDeviceCallback, &registration,
+                                       NULL, NULL) != PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: Could not start DPS registration.\n");
+    } else {
+        while (!registration.done && GetMonotonicTimeMs() - startMs < DpsTimeoutMs) {
+            Prov_Device_LL_DoWork(provHandle);
+            nanosleep(&DpsPollInterval, NULL);
+        }
+    }
+
+    Prov_Device_LL_Destroy(provHandle);
+    prov_dev_security_deinit();
+
+    if (!registration.done) {
+        Log_Debug("ERROR: DPS registration timed out after %lld ms.\n", DpsTimeoutMs);
+        return false;
+    }
+    if (registration.result != PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: DPS registration failed with result %d.\n", registration.result);
+        return false;
+    }
+    Log_Debug("INFO: DPS assigned IoT Hub '%s' in %lld ms.\n", assignment->hubHostName,
+              GetMonotonicTimeMs() - startMs);
+    return true;
+}
+
 /// <summary>
-///     Converts AZURE_SPHERE_PROV_RETURN_VALUE to a string.
+///     Callback invoked when DPS registration completes.
 /// </summary>
-static const char *getAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iothubUri,
+                                      const char *deviceId, void *userContext)
 {
-    switch (provisioningResult.result) {
-    case AZURE_SPHERE_PROV_RESULT_OK:
-        return "AZURE_SPHERE_PROV_RESULT_OK";
-    case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
-        return "AZURE_SPHERE_PROV_RESULT_INVALID_PARAM";
-    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
-    case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
-    default:
-        return "UNKNOWN_RETURN_VALUE";
+    DpsRegistration *registration = userContext;
+    registration->done = true;
+    registration->result = registerResult;
+    if (registerResult != PROV_DEVICE_RESULT_OK) {
+        return;
+    }
+
+    ProvisioningCacheEntry *assignment = registration->assignment;
+    if (iothubUri == NULL || deviceId == NULL ||
+        strlen(iothubUri) >= sizeof(assignment->hubHostName) ||
+        strlen(deviceId) >= sizeof(assignment->deviceId)) {
+        registration->result = PROV_DEVICE_RESULT_PARSING;
+        return;
+    }
+    strcpy(assignment->hubHostName, iothubUri);
+    strcpy(assignment->deviceId, deviceId);
+}
+
+/// <summary>
+///     Creates an IoT Hub client for the device at the IoT Hub it was assigned to, which
+///     authenticates with the Azure Sphere device certificate.
+/// </summary>
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE CreateHubClient(const ProvisioningCacheEntry *assignment)
+{
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle =
+        IoTHubDeviceClient_LL_CreateWithAzureSphereFromDeviceAuth(assignment->hubHostName,
+                                                                  MQTT_Protocol);
+    if (handle == NULL) {
+        Log_Debug("ERROR: Could not create the IoT Hub client.\n");
+        return NULL;
+    }
+
+    if (IoTHubDeviceClient_LL_SetOption(handle, "SetDeviceId", &deviceIdForDaaCertUsage) !=
+        IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: failure setting option \"SetDeviceId\"\n");
+        IoTHubDeviceClient_LL_Destroy(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+/// <summary>
+///     Skips the cached IoT Hub, which could not be connected to, so that the device is
+///     provisioned through DPS on the next attempt to connect.
+/// </summary>
+/// <param name="erase">true to also erase the cache from mutable storage, once the hub is known
+/// not to be the device's</param>
+static void AbandonProvisioningCache(const char *reason, bool erase)
+{
+    Log_Debug("WARNING: Could not connect to the cached IoT Hub (%s); provisioning through DPS "
+              "instead.\n",
+              reason);
+    iothubConnectedFromCache = false;
+    provisioningCacheStale = true;
+    if (erase && mutableStorageFd != -1) {
+        ProvisioningCache_Clear(mutableStorageFd, ProvisioningCacheStorageOffset);
+    }
+}
+
+/// <summary>
+///     Retries SetupAzureClient() from the Azure timer, at a period starting at
+///     AzureIoTMinReconnectPeriodSeconds and with a backoff up to
+///     AzureIoTMaxReconnectPeriodSeconds.
+/// </summary>
+static void RetryAzureClientSetupLater(void)
+{
+    if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds) {
+        azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
+    } else {
+        azureIoTPollPeriodSeconds *= 2;
+        if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
+            azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
+        }
     }
+
+    struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
+    SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+
+    Log_Debug("ERROR: failure to create IoTHub Handle - will retry in %i seconds.\n",
+              azureIoTPollPeriodSeconds);
 }
 
 /// <summary>
-///     Sends telemetry to IoT Hub
+///     Returns the current monotonic time in milliseconds.
+/// </summary>
+static long long GetMonotonicTimeMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / (1000 * 1000);
+}
+
+/// <summary>
+///     Adds a telemetry reading to the current batch. The batch is sent to IoT Hub as a single
+///     message when it is full, or TelemetryBatchMaxLatency after its first reading was added.
+/// </summary>
+/// <param name="key">The telemetry item to update</param>
+/// <param name="writeValue">Writes the value of the reading</param>
+/// <param name="value">The value, as given to writeValue</param>
+static void AddTelemetryReading(const char *key, TelemetryValueWriter writeValue,
+                                const void *value)
+{
+    for (;;) {
+        if (telemetryBatch == NULL) {
+            telemetryBatch = MessageBuilder_Acquire();
+            if (telemetryBatch == NULL) {
+                Log_Debug("WARNING: No message buffer is free for telemetry reading '%s', the "
+                          "pool has been empty %lu times.\n",
+                          key, MessageBuilder_GetPoolExhaustedCount());
+                ++telemetryReadingsDropped;
+                return;
+            }
+            if (TelemetryBatchMaxReadings > 1) {
+                MessageBuilder_BeginArray(telemetryBatch);
+            }
+        }
+
+        MessageBuilder batchBefore = *telemetryBatch;
+        MessageBuilder_BeginObject(telemetryBatch);
+        MessageBuilder_AddKey(telemetryBatch, key);
+        writeValue(telemetryBatch, value);
+        MessageBuilder_EndObject(telemetryBatch);
+        if (!MessageBuilder_HasFailed(telemetryBatch)) {
+            break;
+        }
+
+        // The reading does not fit, so undo it, send the readings before it and start a new
+        // batch.
+        *telemetryBatch = batchBefore;
+        if (telemetryBatchReadings == 0) {
+            Log_Debug("WARNING: Telemetry reading '%s' is too large to send.\n", key);
+            MessageBuilder_Release(telemetryBatch);
+            telemetryBatch = NULL;
+            ++telemetryReadingsDropped;
+            return;
+        }
+        FlushTelemetryBatch();
+    }
+
+    long long nowMs = GetMonotonicTimeMs();
+    if (telemetryBatchReadings++ == 0) {
+        telemetryBatchFirstAddedMs = nowMs;
+        if (telemetryBatchTimer != NULL) {
+            SetEventLoopTimerOneShot(telemetryBatchTimer, &TelemetryBatchMaxLatency);
+        }
+    }
+    telemetryBatchAddedMs += nowMs;
+
+    if (telemetryBatchReadings >= TelemetryBatchMaxReadings) {
+        FlushTelemetryBatch();
+    }
+}
+
+/// <summary>
+///     Writes a null-terminated string telemetry value.
+/// </summary>
+static void WriteStringValue(MessageBuilder *builder, const void *value)
+{
+    MessageBuilder_AddString(builder, value);
+}
+
+/// <summary>
+///     Writes a float telemetry value, with two decimals.
+/// </summary>
+static void WriteTemperatureValue(MessageBuilder *builder, const void *value)
+{
+    MessageBuilder_AddNumber(builder, *(const float *)value, 2);
+}
+
+/// <summary>
+///     Adds a telemetry reading with a string value to the current batch.
 /// </summary>
 /// <param name="key">The telemetry item to update</param>
 /// <param name="value">new telemetry value</param>
 static void SendTelemetry(const unsigned char *key, const unsigned char *value)
 {
-    static char eventBuffer[100] = {0};
-    static const char *EventMsgTemplate = "{ \"%s\": \"%s\" }";
-    int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-    if (len < 0)
+    AddTelemetryReading((const char *)key, WriteStringValue, value);
+}
+
+/// <summary>
+///     Sends the batched telemetry readings to IoT Hub as a single message, or queues it if the
+///     device is offline, and starts a new batch.
+/// </summary>
+static void FlushTelemetryBatch(void)
+{
+    if (telemetryBatchReadings == 0) {
         return;
+    }
+
+    size_t readings = telemetryBatchReadings;
+    long long nowMs = GetMonotonicTimeMs();
+    long long latencyAddedMs = (long long)readings * nowMs - telemetryBatchAddedMs;
+    long long oldestReadingMs = nowMs - telemetryBatchFirstAddedMs;
 
-    Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+    // The batch is only ever left holding complete readings, so closing it can't fail.
+    size_t length;
+    if (TelemetryBatchMaxReadings > 1) {
+        MessageBuilder_EndArray(telemetryBatch);
+    }
+    const char *message = MessageBuilder_GetData(telemetryBatch, &length);
+
+    telemetryBatchReadings = 0;
+    telemetryBatchAddedMs = 0;
+    if (telemetryBatchTimer != NULL) {
+        DisarmEventLoopTimer(telemetryBatchTimer);
+    }
 
+    Log_Debug("Sending IoT Hub Message: %s\n", message);
+
+    bool sent = SendTelemetryMessage(message, length, 0, NULL);
+    if (!sent) {
+        QueueTelemetryMessage(message, length, readings);
+    }
+    MessageBuilder_Release(telemetryBatch);
+    telemetryBatch = NULL;
+    if (!sent) {
+        return;
+    }
+
+    telemetryReadingsSent += readings;
+    ++telemetryMessagesSent;
+    telemetryLatencyAddedTotalMs += latencyAddedMs;
+    if (oldestReadingMs > telemetryLatencyAddedMaxMs) {
+        telemetryLatencyAddedMaxMs = oldestReadingMs;
+    }
+    Log_Debug(
+        "INFO: Telemetry batching: %lu readings in %lu messages (%lu saved, %lu dropped), "
+        "latency added %lld ms on average and %lld ms at most\n",
+        telemetryReadingsSent, telemetryMessagesSent, telemetryReadingsSent - telemetryMessagesSent,
+        telemetryReadingsDropped, telemetryLatencyAddedTotalMs / (long long)telemetryReadingsSent,
+        telemetryLatencyAddedMaxMs);
+}
+
+/// <summary>
+///     Hands a telemetry message to the IoT Hub client for delivery.
+/// </summary>
+/// <param name="message">The JSON message to send</param>
+/// <param name="length">The length of the message</param>
+/// <param name="createdTime">When the message was created, if it is sent late; otherwise 0</param>
+/// <param name="replay">The replay the message is, or NULL. A replayed message is only sent if
+/// its confirmation can be tracked.</param>
+/// <returns>false if the device is offline or the client did not accept the message</returns>
+static bool SendTelemetryMessage(const char *message, size_t length, time_t createdTime,
+                                 TelemetryReplay *replay)
+{
     bool isNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&isNetworkingReady) == -1) || !isNetworkingReady) {
+    if ((Networking_IsNetworkingReady(&isNetworkingReady) == -1) || !isNetworkingReady ||
+        !iothubAuthenticated) {
         Log_Debug("WARNING: Cannot send IoTHubMessage because network is not up.\n");
-        return;
+        return false;
     }
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+    IOTHUB_MESSAGE_HANDLE messageHandle =
+        IoTHubMessage_CreateFromByteArray((const unsigned char *)message, length);
 
     if (messageHandle == 0) {
         Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
-        return;
+        return false;
+    }
+
+    // Messages sent late carry the time they were created, which IoT Hub routes and Azure Time
+    // Series Insights use in place of the time they were received.
+    char createdTimeString[sizeof("YYYY-MM-DDTHH:MM:SSZ")];
+    struct tm createdTimeUtc;
+    if (createdTime != 0 && gmtime_r(&createdTime, &createdTimeUtc) != NULL &&
+        strftime(createdTimeString, sizeof(createdTimeString), "%Y-%m-%dT%H:%M:%SZ",
+                 &createdTimeUtc) > 0 &&
+        IoTHubMessage_SetProperty(messageHandle, "iothub-creation-time-utc", createdTimeString) !=
+            IOTHUB_MESSAGE_OK) {
+        Log_Debug("WARNING: unable to set the creation time of the IoTHubMessage\n");
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
+    // Telemetry is sent even if there is too much work in flight to track it, unless the caller
+    // waits for its confirmation.
+    IoTHubWork *work =
+        BeginIoTHubWork(replay, replay != NULL ? DiscardTelemetryReplay : NULL);
+    if (work == NULL && replay != NULL) {
+        Log_Debug("WARNING: Too much work in flight to track the message\n");
+        IoTHubMessage_Destroy(messageHandle);
+        return false;
+    }
+    bool accepted = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                         SendMessageCallback,
+                                                         work) == IOTHUB_CLIENT_OK;
+    if (!accepted) {
         Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+        if (work != NULL) {
+            EndIoTHubWork(work, false);
+        }
     } else {
         Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted;
+}
+
+/// <summary>
+///     Keeps a telemetry message that could not be sent in the telemetry queue, to be replayed
+///     by ReplayQueuedTelemetry() once the device is connected.
+/// </summary>
+/// <param name="message">The JSON message</param>
+/// <param name="length">The length of the message</param>
+/// <param name="readings">The number of readings in the message</param>
+static void QueueTelemetryMessage(const char *message, size_t length, size_t readings)
+{
+    if (!telemetryQueueOpen ||
+        TelemetryQueue_Push(&telemetryQueue, message, length, time(NULL)) == -1) {
+        telemetryReadingsDropped += readings;
+        return;
+    }
+
+    Log_Debug("INFO: Telemetry queue: %zu messages queued (%lu queued, %lu dropped when full, "
+              "%lu replayed in total)\n",
+              TelemetryQueue_GetCount(&telemetryQueue), telemetryQueue.queued,
+              telemetryQueue.dropped, telemetryMessagesReplayed);
+}
+
+/// <summary>
+///     Sends the oldest message in the telemetry queue, unless a replayed message is already in
+///     flight. It stays in the queue until EndTelemetryReplay() learns that IoT Hub received it.
+/// </summary>
+static void ReplayQueuedTelemetry(void)
+{
+    static char message[TELEMETRY_QUEUE_MESSAGE_MAX_BYTES + 1];
+
+    if (!telemetryQueueOpen || telemetryReplay.inFlight) {
+        return;
+    }
+
+    for (;;) {
+        time_t createdTime;
+        ssize_t length = TelemetryQueue_Peek(&telemetryQueue, message, sizeof(message),
+                                             &createdTime);
+        if (length == 0) {
+            return;
+        }
+        if (length != -1) {
+            telemetryReplay.sequence = telemetryQueue.headSequence;
+            telemetryReplay.inFlight = SendTelemetryMessage(message, (size_t)length, createdTime,
+                                                            &telemetryReplay);
+            return;
+        }
+
+        // If the queue can't be updated in storage, the message is read again after a restart.
+        Log_Debug("WARNING: Discarding unreadable queued telemetry: %s (%d).\n", strerror(errno),
+                  errno);
+        TelemetryQueue_Pop(&telemetryQueue);
+    }
+}
+
+/// <summary>
+///     Removes the replayed message in flight from the telemetry queue if IoT Hub received it,
+///     and replays the next one while the device is connected.
+/// </summary>
+/// <param name="delivered">true if IoT Hub confirmed the message</param>
+static void EndTelemetryReplay(bool delivered)
+{
+    telemetryReplay.inFlight = false;
+    if (!delivered) {
+        Log_Debug("WARNING: Replayed telemetry was not delivered, and is kept in the queue.\n");
+        return;
+    }
+
+    // The message is no longer at the head if the queue overflowed in the meantime.
+    if (telemetryReplay.sequence == telemetryQueue.headSequence) {
+        // If the queue can't be updated in storage, the message is sent again after a restart.
+        TelemetryQueue_Pop(&telemetryQueue);
+    }
+    ++telemetryMessagesReplayed;
+    Log_Debug("INFO: Telemetry queue: %zu messages queued (%lu queued, %lu dropped when full, "
+              "%lu replayed in total)\n",
+              TelemetryQueue_GetCount(&telemetryQueue), telemetryQueue.queued,
+              telemetryQueue.dropped, telemetryMessagesReplayed);
+
+    if (iothubConnected) {
+        ReplayQueuedTelemetry();
+    }
+}
+
+/// <summary>
+///     Forgets the replayed message in flight when the client is destroyed, leaving it in the
+///     telemetry queue to be replayed by the next client.
+/// </summary>
+static void DiscardTelemetryReplay(void *context)
+{
+    ((TelemetryReplay *)context)->inFlight = false;
+}
+
+/// <summary>
+///     Telemetry batch timer event: sends the batch once its first reading has waited
+///     TelemetryBatchMaxLatency.
+/// </summary>
+static void TelemetryBatchTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_TelemetryBatchTimer_Consume;
+        return;
+    }
+
+    FlushTelemetryBatch();
 }
 
 /// <summary>
@@ -545,43 +1363,127 @@ static void SendTelemetry(const unsigned char *key, const unsigned char *value)
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK && !firstTelemetryAcknowledged) {
+        firstTelemetryAcknowledged = true;
+        Log_Debug("INFO: First telemetry acknowledged %lld ms after start-up (%s).\n",
+                  GetMonotonicTimeMs() - applicationStartMs,
+                  iothubConnectedFromCache ? "cached IoT Hub" : "provisioned through DPS");
+    }
+    if (context != NULL) {
+        bool delivered = result == IOTHUB_CLIENT_CONFIRMATION_OK;
+        if (EndIoTHubWork((IoTHubWork *)context, delivered) == &telemetryReplay) {
+            EndTelemetryReplay(delivered);
+        }
+    }
 }
 
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property. The report is not sent immediately, but it is sent on the next invocation of
-///     IoTHubDeviceClient_LL_DoWork().
+///     Sets a Device Twin reported property. The property is reported on the next DoWork()
+///     cycle, together with any other property set before then; if the client is not yet
+///     initialized, it is reported once it is.
 /// </summary>
 /// <param name="propertyName">the IoT Hub Device Twin property name</param>
 /// <param name="propertyValue">the IoT Hub Device Twin property value</param>
 static void TwinReportBoolState(const char *propertyName, bool propertyValue)
 {
-    if (iothubClientHandle == NULL) {
-        Log_Debug("ERROR: client not initialized\n");
-    } else {
-        static char reportedPropertiesString[30] = {0};
-        int len = snprintf(reportedPropertiesString, 30, "{\"%s\":%s}", propertyName,
-                           (propertyValue == true ? "true" : "false"));
-        if (len < 0)
-            return;
+    if (json_object_set_boolean(json_value_get_object(reportedProperties), propertyName,
+                                propertyValue) == JSONFailure) {
+        Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
+        return;
+    }
 
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (unsigned char *)reportedPropertiesString,
-                strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-            Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
-        } else {
-            Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
-                      (propertyValue == true ? "true" : "false"));
-        }
+    ++reportedPropertyWrites;
+    reportedPropertiesDirty = true;
+    if (iothubClientHandle != NULL) {
+        RequestDoWork();
     }
 }
 
 /// <summary>
-///     Callback invoked when the Device Twin reported properties are accepted by IoT Hub.
+///     Enqueues a single report of the reported properties that differ from those IoT Hub last
+///     acknowledged, as a JSON merge patch. Nothing is sent if no property changed.
 /// </summary>
+static void TwinReportChangedProperties(void)
+{
+    reportedPropertiesDirty = false;
+
+    JSON_Value *patch = json_value_diff(lastReportedProperties, reportedProperties);
+    if (patch == NULL) {
+        Log_Debug("ERROR: failed to compute the reported properties update.\n");
+        return;
+    }
+
+    if (json_object_get_count(json_value_get_object(patch)) == 0) {
+        Log_Debug("INFO: Reported properties are unchanged.\n");
+        json_value_free(patch);
+        return;
+    }
+
+    char *patchString = json_serialize_to_string(patch);
+    if (patchString == NULL) {
+        Log_Debug("ERROR: failed to serialize the reported properties update.\n");
+        json_value_free(patch);
+        return;
+    }
+
+    // ReportStatusCallback takes ownership of the patch, and applies it to lastReportedProperties
+    // if IoT Hub accepts it. Properties not reported now still differ, and go with the next report.
+    IoTHubWork *work = BeginIoTHubWork(patch, DiscardReportedPropertiesPatch);
+    if (work == NULL) {
+        Log_Debug("ERROR: too many reported state updates in flight for '%s'.\n", patchString);
+        json_value_free(patch);
+    } else if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle,
+                                                       (const unsigned char *)patchString,
+                                                       strlen(patchString), ReportStatusCallback,
+                                                       work) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: failed to set reported state '%s'.\n", patchString);
+        json_value_free(EndIoTHubWork(work, false));
+    } else {
+        reportedPropertiesInFlight = true;
+        ++reportedPropertyReports;
+        Log_Debug("INFO: Reported state '%s' (%lu writes in %lu reports, %lu round trips saved).\n",
+                  patchString, reportedPropertyWrites, reportedPropertyReports,
+                  reportedPropertyWrites - reportedPropertyReports);
+    }
+
+    json_free_serialized_string(patchString);
+}
+
+/// <summary>
+///     Callback invoked when the Device Twin reported properties are accepted by IoT Hub, or when
+///     the update failed or was dropped with the client.
+/// </summary>
+/// <param name="context">the IoTHubWork for the merge patch that was sent</param>
 static void ReportStatusCallback(int result, void *context)
 {
+    JSON_Value *patch = EndIoTHubWork((IoTHubWork *)context, result >= 200 && result < 300);
     Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+
+    // Properties that weren't accepted still differ from lastReportedProperties, so they are
+    // sent again with the next report.
+    if (result >= 200 && result < 300 &&
+        json_value_apply_merge_patch(lastReportedProperties, patch) == JSONFailure) {
+        Log_Debug("ERROR: failed to record the reported properties update.\n");
+    }
+    json_value_free(patch);
+
+    // Properties set while this report was in flight go in the next one.
+    reportedPropertiesInFlight = false;
+    if (reportedPropertiesDirty) {
+        RequestDoWork();
+    }
+}
+
+/// <summary>
+///     Frees the merge patch of a report dropped with the client. The properties it carried
+///     still differ from lastReportedProperties, so they are reported again once the next
+///     client runs DoWork().
+/// </summary>
+static void DiscardReportedPropertiesPatch(void *context)
+{
+    json_value_free((JSON_Value *)context);
+    reportedPropertiesInFlight = false;
+    reportedPropertiesDirty = true;
 }
 
 /// <summary>
@@ -597,10 +1499,97 @@ void SendSimulatedTemperature(void)
         temperature -= deltaTemp;
     }
 
-    char tempBuffer[20];
-    int len = snprintf(tempBuffer, 20, "%3.2f", temperature);
-    if (len > 0)
-        SendTelemetry("Temperature", tempBuffer);
+    if (temperatureAggregationEnabled) {
+        AggregationSeries_Add(&temperatureSeries, temperature);
+        return;
+    }
+
+    AddTelemetryReading("Temperature", WriteTemperatureValue, &temperature);
+}
+
+/// <summary>
+///     Applies the TemperatureAggregation desired property: sends temperature summaries over
+///     a window of windowSeconds every slideSeconds, or each temperature if windowSeconds is 0.
+/// </summary>
+static void ConfigureTemperatureAggregation(long windowSeconds, long slideSeconds)
+{
+    if (windowSeconds == 0) {
+        if (temperatureAggregationEnabled) {
+            Log_Debug("INFO: Temperature aggregation disabled.\n");
+            DisarmEventLoopTimer(aggregationTimer);
+            temperatureAggregationEnabled = false;
+        }
+        return;
+    }
+
+    if (windowSeconds < 0 || slideSeconds <= 0 || windowSeconds % slideSeconds != 0 ||
+        windowSeconds / slideSeconds > AGGREGATION_MAX_PANES) {
+        Log_Debug("WARNING: Invalid temperature aggregation window %ld s, slide %ld s; the window "
+                  "must be 1 to %d times the slide.\n",
+                  windowSeconds, slideSeconds, AGGREGATION_MAX_PANES);
+        return;
+    }
+
+    // A full twin document, with the same settings, is received again on every reconnection.
+    if (temperatureAggregationEnabled && windowSeconds == temperatureAggregationWindowSeconds &&
+        slideSeconds == temperatureAggregationSlideSeconds) {
+        return;
+    }
+
+    AggregationSeries_Init(&temperatureSeries, (unsigned int)(windowSeconds / slideSeconds));
+    struct timespec slidePeriod = {.tv_sec = slideSeconds, .tv_nsec = 0};
+    SetEventLoopTimerPeriod(aggregationTimer, &slidePeriod);
+    temperatureAggregationEnabled = true;
+    temperatureAggregationWindowSeconds = windowSeconds;
+    temperatureAggregationSlideSeconds = slideSeconds;
+    Log_Debug("INFO: Temperature aggregation over %ld s, every %ld s.\n", windowSeconds,
+              slideSeconds);
+}
+
+/// <summary>
+///     Writes the summary of an AggregationSeries' window as a telemetry value.
+/// </summary>
+static void WriteAggregationSummary(MessageBuilder *builder, const void *value)
+{
+    const AggregationSeries *series = value;
+    AggregationSummary summary;
+    AggregationSeries_GetSummary(series, &summary);
+
+    MessageBuilder_BeginObject(builder);
+    MessageBuilder_AddKey(builder, "windowSeconds");
+    MessageBuilder_AddInteger(builder, temperatureAggregationWindowSeconds);
+    MessageBuilder_AddKey(builder, "count");
+    MessageBuilder_AddInteger(builder, (long long)summary.count);
+    MessageBuilder_AddKey(builder, "min");
+    MessageBuilder_AddNumber(builder, summary.min, 2);
+    MessageBuilder_AddKey(builder, "max");
+    MessageBuilder_AddNumber(builder, summary.max, 2);
+    MessageBuilder_AddKey(builder, "mean");
+    MessageBuilder_AddNumber(builder, summary.mean, 2);
+    MessageBuilder_AddKey(builder, "variance");
+    MessageBuilder_AddNumber(builder, summary.variance, 4);
+    MessageBuilder_AddKey(builder, "p50");
+    MessageBuilder_AddNumber(builder, AggregationSeries_GetPercentile(series, 50), 2);
+    MessageBuilder_AddKey(builder, "p90");
+    MessageBuilder_AddNumber(builder, AggregationSeries_GetPercentile(series, 90), 2);
+    MessageBuilder_EndObject(builder);
+}
+
+/// <summary>
+/// Aggregation timer event:  Send the summary of the temperature window, and slide it
+/// </summary>
+static void AggregationTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_AggregationTimer_Consume;
+        return;
+    }
+
+    AggregationSummary summary;
+    if (AggregationSeries_GetSummary(&temperatureSeries, &summary)) {
+        AddTelemetryReading("TemperatureSummary", WriteAggregationSummary, &temperatureSeries);
+    }
+    AggregationSeries_Slide(&temperatureSeries);
 }
 
 /// <summary>
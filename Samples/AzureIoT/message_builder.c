@@ -0,0 +1,277 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "message_builder.h"
+
+// The builder is the first member, so a builder from the pool converts back to its entry.
+typedef struct {
+    MessageBuilder builder;
+    bool inUse;
+    char buffer[MESSAGE_BUILDER_BUFFER_BYTES];
+} MessageBuilderPoolEntry;
+
+static MessageBuilderPoolEntry pool[MESSAGE_BUILDER_POOL_SIZE];
+static unsigned long poolExhaustedCount = 0;
+
+static bool Reserve(MessageBuilder *builder, size_t length);
+static void AppendBytes(MessageBuilder *builder, const char *bytes, size_t length);
+static void BeginValue(MessageBuilder *builder);
+static void Open(MessageBuilder *builder, char bracket);
+static void Close(MessageBuilder *builder, char bracket);
+static void AppendEscapedString(MessageBuilder *builder, const char *value);
+static void AppendDigits(MessageBuilder *builder, uint64_t value, unsigned int minDigits);
+
+/// <summary>
+///     Checks that length more bytes fit in front of the reserved bytes, and fails the builder
+///     if they don't.
+/// </summary>
+static bool Reserve(MessageBuilder *builder, size_t length)
+{
+    if (builder->failed || length > builder->capacity - builder->reserved - builder->length) {
+        builder->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static void AppendBytes(MessageBuilder *builder, const char *bytes, size_t length)
+{
+    if (Reserve(builder, length)) {
+        memcpy(builder->buffer + builder->length, bytes, length);
+        builder->length += length;
+    }
+}
+
+/// <summary>
+///     Writes the comma that separates a value, or a key, from the one before it.
+/// </summary>
+static void BeginValue(MessageBuilder *builder)
+{
+    if (builder->needsSeparator) {
+        AppendBytes(builder, ",", 1);
+    }
+    builder->needsSeparator = true;
+}
+
+static void Open(MessageBuilder *builder, char bracket)
+{
+    BeginValue(builder);
+    if (Reserve(builder, 2)) {
+        builder->buffer[builder->length++] = bracket;
+        ++builder->reserved;
+    }
+    builder->needsSeparator = false;
+}
+
+static void Close(MessageBuilder *builder, char bracket)
+{
+    // Closing never fails, as its byte was reserved by Open().
+    if (!builder->failed && builder->reserved > 1) {
+        --builder->reserved;
+        builder->buffer[builder->length++] = bracket;
+    }
+    builder->needsSeparator = true;
+}
+
+static void AppendEscapedString(MessageBuilder *builder, const char *value)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+
+    AppendBytes(builder, "\"", 1);
+    const char *run = value;
+    for (const char *p = value;; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Copy the characters that need no escaping in one go.
+        AppendBytes(builder, run, (size_t)(p - run));
+        run = p + 1;
+        if (c == '\0') {
+            break;
+        }
+
+        char escape[6] = {'\\', (char)c};
+        size_t escapeLength = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = HexDigits[c >> 4];
+            escape[5] = HexDigits[c & 0xf];
+            escapeLength = 6;
+            break;
+        }
+        AppendBytes(builder, escape, escapeLength);
+    }
+    AppendBytes(builder, "\"", 1);
+}
+
+/// <summary>
+///     Writes value in decimal, padded with leading zeros to at least minDigits digits.
+/// </summary>
+static void AppendDigits(MessageBuilder *builder, uint64_t value, unsigned int minDigits)
+{
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0 || count < minDigits);
+    AppendBytes(builder, digits + sizeof(digits) - count, count);
+}
+
+MessageBuilder *MessageBuilder_Acquire(void)
+{
+    for (size_t i = 0; i < MESSAGE_BUILDER_POOL_SIZE; ++i) {
+        if (!pool[i].inUse) {
+            pool[i].inUse = true;
+            MessageBuilder_Init(&pool[i].builder, pool[i].buffer, sizeof(pool[i].buffer));
+            return &pool[i].builder;
+        }
+    }
+    ++poolExhaustedCount;
+    return NULL;
+}
+
+void MessageBuilder_Release(MessageBuilder *builder)
+{
+    if (builder != NULL) {
+        ((MessageBuilderPoolEntry *)builder)->inUse = false;
+    }
+}
+
+void MessageBuilder_Init(MessageBuilder *builder, char *buffer, size_t capacity)
+{
+    builder->buffer = buffer;
+    builder->capacity = capacity;
+    builder->length = 0;
+    builder->reserved = 1;
+    builder->needsSeparator = false;
+    builder->failed = capacity == 0;
+}
+
+void MessageBuilder_BeginObject(MessageBuilder *builder)
+{
+    Open(builder, '{');
+}
+
+void MessageBuilder_EndObject(MessageBuilder *builder)
+{
+    Close(builder, '}');
+}
+
+void MessageBuilder_BeginArray(MessageBuilder *builder)
+{
+    Open(builder, '[');
+}
+
+void MessageBuilder_EndArray(MessageBuilder *builder)
+{
+    Close(builder, ']');
+}
+
+void MessageBuilder_AddKey(MessageBuilder *builder, const char *key)
+{
+    BeginValue(builder);
+    AppendEscapedString(builder, key);
+    AppendBytes(builder, ":", 1);
+    builder->needsSeparator = false;
+}
+
+void MessageBuilder_AddString(MessageBuilder *builder, const char *value)
+{
+    BeginValue(builder);
+    AppendEscapedString(builder, value);
+}
+
+void MessageBuilder_AddInteger(MessageBuilder *builder, long long value)
+{
+    BeginValue(builder);
+    if (value < 0) {
+        AppendBytes(builder, "-", 1);
+    }
+    // Negating in unsigned arithmetic handles LLONG_MIN.
+    AppendDigits(builder, value < 0 ? 0 - (uint64_t)value : (uint64_t)value, 1);
+}
+
+void MessageBuilder_AddNumber(MessageBuilder *builder, double value, unsigned int decimals)
+{
+    static const double PowersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+    BeginValue(builder);
+    if (decimals >= sizeof(PowersOfTen) / sizeof(PowersOfTen[0])) {
+        decimals = sizeof(PowersOfTen) / sizeof(PowersOfTen[0]) - 1;
+    }
+    double scaled = round(fabs(value) * PowersOfTen[decimals]);
+    if (!isfinite(scaled) || scaled >= 1e18) {
+        builder->failed = true;
+        return;
+    }
+
+    uint64_t fixed = (uint64_t)scaled;
+    uint64_t unit = (uint64_t)PowersOfTen[decimals];
+    if (value < 0 && fixed != 0) {
+        AppendBytes(builder, "-", 1);
+    }
+    AppendDigits(builder, fixed / unit, 1);
+    if (decimals > 0) {
+        AppendBytes(builder, ".", 1);
+        AppendDigits(builder, fixed % unit, decimals);
+    }
+}
+
+void MessageBuilder_AddBool(MessageBuilder *builder, bool value)
+{
+    BeginValue(builder);
+    if (value) {
+        AppendBytes(builder, "true", 4);
+    } else {
+        AppendBytes(builder, "false", 5);
+    }
+}
+
+bool MessageBuilder_HasFailed(const MessageBuilder *builder)
+{
+    return builder->failed;
+}
+
+const char *MessageBuilder_GetData(const MessageBuilder *builder, size_t *length)
+{
+    if (builder->failed) {
+        return NULL;
+    }
+    // The terminator's byte is always reserved, so this never writes past the buffer.
+    builder->buffer[builder->length] = '\0';
+    *length = builder->length;
+    return builder->buffer;
+}
+
+unsigned long MessageBuilder_GetPoolExhaustedCount(void)
+{
+    return poolExhaustedCount;
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// <summary>
+/// Size, in bytes, of each buffer in the message builder pool, including the null terminator.
+/// </summary>
+#define MESSAGE_BUILDER_BUFFER_BYTES 512
+
+/// <summary>
+/// Number of buffers in the message builder pool, which is the number of messages that can be
+/// built at the same time.
+/// </summary>
+#define MESSAGE_BUILDER_POOL_SIZE 4
+
+/// <summary>
+/// Writes a JSON message into a fixed buffer, without allocating and without printf. Values are
+/// appended in document order, and commas are inserted as needed:
+///
+///     MessageBuilder *builder = MessageBuilder_Acquire();
+///     MessageBuilder_BeginObject(builder);
+///     MessageBuilder_AddKey(builder, "Temperature");
+///     MessageBuilder_AddNumber(builder, 30.25, 2);
+///     MessageBuilder_EndObject(builder);
+///     const char *message = MessageBuilder_GetData(builder, &length); // {"Temperature":30.25}
+///     ...
+///     MessageBuilder_Release(builder);
+///
+/// Room for the closing bracket of every open object and array is kept, so they can always be
+/// closed. An append that does not fit, or a number JSON can't represent, fails the builder,
+/// and <see cref="MessageBuilder_GetData" /> then returns NULL. The struct can be copied to
+/// save the builder, and copied back to undo the appends since, including a failed one.
+/// </summary>
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    // Bytes kept for the closing brackets of open objects and arrays, and the null terminator.
+    size_t reserved;
+    bool needsSeparator;
+    bool failed;
+} MessageBuilder;
+
+/// <summary>
+/// Takes an empty builder from the pool.
+/// </summary>
+/// <returns>The builder, or NULL if all MESSAGE_BUILDER_POOL_SIZE builders are in use.</returns>
+MessageBuilder *MessageBuilder_Acquire(void);
+
+/// <summary>
+/// Returns a builder from <see cref="MessageBuilder_Acquire" /> to the pool.
+/// </summary>
+void MessageBuilder_Release(MessageBuilder *builder);
+
+/// <summary>
+/// Initializes a builder that writes into a buffer of capacity bytes owned by the caller.
+/// </summary>
+void MessageBuilder_Init(MessageBuilder *builder, char *buffer, size_t capacity);
+
+void MessageBuilder_BeginObject(MessageBuilder *builder);
+void MessageBuilder_EndObject(MessageBuilder *builder);
+void MessageBuilder_BeginArray(MessageBuilder *builder);
+void MessageBuilder_EndArray(MessageBuilder *builder);
+
+/// <summary>
+/// Appends the name of the next member of the current object.
+/// </summary>
+void MessageBuilder_AddKey(MessageBuilder *builder, const char *key);
+
+/// <summary>
+/// Appends a null-terminated UTF-8 string, escaped as JSON requires.
+/// </summary>
+void MessageBuilder_AddString(MessageBuilder *builder, const char *value);
+
+void MessageBuilder_AddInteger(MessageBuilder *builder, long long value);
+
+/// <summary>
+/// Appends value rounded to decimals (at most 9) digits after the decimal point. Values that are
+/// not finite, or whose magnitude times 10^decimals is 1e18 or more, fail the builder.
+/// </summary>
+void MessageBuilder_AddNumber(MessageBuilder *builder, double value, unsigned int decimals);
+
+void MessageBuilder_AddBool(MessageBuilder *builder, bool value);
+
+/// <summary>
+/// Returns true if an append did not fit or was not valid.
+/// </summary>
+bool MessageBuilder_HasFailed(const MessageBuilder *builder);
+
+/// <summary>
+/// Returns the message, which is null-terminated and stays valid until the builder is changed
+/// or released, and stores its length in length.
+/// </summary>
+/// <returns>The message, or NULL if the builder failed.</returns>
+const char *MessageBuilder_GetData(const MessageBuilder *builder, size_t *length);
+
+/// <summary>
+/// Returns how many times <see cref="MessageBuilder_Acquire" /> found the pool empty.
+/// </summary>
+unsigned long MessageBuilder_GetPoolExhaustedCount(void);
@@ -1,8 +1,29 @@
 ﻿/*
-    This source code comes from Git repository
-    https://github.com/kgabis/parson at commit id 4f3eaa6
-    Patched to avoid any usage of fopen(), and removed implicit
-    cast warnings by making them explicit.
+    This source code started from Git repository
+    https://github.com/kgabis/parson at commit id 4f3eaa6, patched to avoid any
+    usage of fopen(), and with implicit cast warnings removed by making them
+    explicit. It has since been extended well beyond upstream, so don't replace
+    it with a newer upstream version; port upstream fixes by hand instead.
+    The local extensions are:
+    - a hash index for lookups in large objects (PARSON_OBJECT_INDEX_THRESHOLD)
+      and compiled paths (json_path_compile, json_object_pathget_*);
+    - arena parsing (json_parse_string_arena, json_parse_buffer_in_situ);
+    - length-delimited input (json_parse_buffer);
+    - the event parser (json_parse_events) and the resumable stream parser
+      (json_stream_parser_create);
+    - SSE2/NEON scanning (PARSON_DISABLE_SIMD to turn it off);
+    - exact fast number parsing and shortest round-trip number output
+      (PARSON_DISABLE_FAST_NUMBERS to turn them off);
+    - serialization through a growable buffer or a sink, in a single pass;
+    - JSON merge patch diff and apply (json_value_diff);
+    - interning of member names (json_set_key_interning);
+    - CBOR encoding and decoding (json_value_to_cbor, json_value_from_cbor);
+    - values allocated together with their contents, iterative parsing and
+      serialization, lazy parsing (json_parse_string_lazy) and lazy
+      copy-on-write deep copies;
+    - allocation and time counters (PARSON_STATS, json_stats_get).
+    parson_schema.c builds on the event parser, and Host/ holds the tests
+    and benchmarks covering these.
 */
 
 /*
@@ -41,31 +62,134 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <float.h>
+#include <stdint.h>
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+#define ARENA_STARTING_CAPACITY 4 /* arena containers aren't trimmed, so start small */
+#define KEY_POOL_STARTING_CAPACITY 64
 #define MAX_NESTING 2048
 
+/* Objects with at least this many members get a hash index for name lookups, built on first
+ * lookup. Define as 0 to always use linear search. */
+#ifndef PARSON_OBJECT_INDEX_THRESHOLD
+#define PARSON_OBJECT_INDEX_THRESHOLD 12
+#endif
+
+/* Scratch space json_parse_events unescapes a name or string value into, on the stack. Strings
+ * without escapes are reported straight from the input whatever their length. */
+#ifndef PARSON_EVENT_BUFFER_SIZE
+#define PARSON_EVENT_BUFFER_SIZE 256
+#endif
+
+/* Serialized strings start with this many bytes and double as needed, and json_serialize_to_sink
+ * hands output over in pieces of at most this size, buffered on the stack. */
+#ifndef PARSON_SERIALIZATION_BUFFER_SIZE
+#define PARSON_SERIALIZATION_BUFFER_SIZE 256
+#endif
+
+/* Serialization keeps its position in each open container on the stack for this many levels of
+ * nesting, and on the heap past them. */
+#ifndef PARSON_SERIALIZATION_STACK_SIZE
+#define PARSON_SERIALIZATION_STACK_SIZE 32
+#endif
+
+/* Numbers are parsed with the Eisel-Lemire algorithm and serialized with Grisu2, falling back to
+ * strtod for the few that need it. Define PARSON_DISABLE_FAST_NUMBERS to always use strtod and
+ * FLOAT_FORMAT instead. */
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
 #define NUM_BUF_SIZE 64
 
+/* Scanning for the end of strings, whitespace and ASCII is done 16 bytes at a time with SSE2 or
+ * NEON when the compiler targets them. Define PARSON_DISABLE_SIMD to use byte loops only. */
+#if !defined(PARSON_DISABLE_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PARSON_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(PARSON_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define PARSON_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#define SIMD_BLOCK_SIZE 16
+
+/* Define PARSON_STATS to count allocations and time parsing and serialization, see
+ * json_stats_get. Each allocation then carries a header recording its size. */
+#if defined(PARSON_STATS)
+#include <time.h>
+#endif
+
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
-#define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
-    }
+#define REMAINING(parser) ((size_t)((parser)->end - (parser)->ptr))
+#define PEEK(parser) ((parser)->ptr < (parser)->end ? *(parser)->ptr : '\0')
+#define SKIP_CHAR(parser) ((parser)->ptr++)
+#define SKIP_WHITESPACES(parser) ((parser)->ptr = skip_whitespaces((parser)->ptr, (parser)->end))
+/* isspace() in the "C" locale, without the function call */
+#define IS_SPACE(c) ((c) == ' ' || (unsigned char)((c) - '\t') <= '\r' - '\t')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+/* CBOR major types, and the additional information values of major type 7 and of heads */
+enum json_cbor_major {
+    CBOR_UNSIGNED,
+    CBOR_NEGATIVE,
+    CBOR_BYTES,
+    CBOR_TEXT,
+    CBOR_ARRAY,
+    CBOR_MAP,
+    CBOR_TAG,
+    CBOR_SIMPLE
+};
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+#define CBOR_UNDEFINED 23
+#define CBOR_HALF 25
+#define CBOR_FLOAT 26
+#define CBOR_DOUBLE 27
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xFF
+#define CBOR_TWO_TO_64 18446744073709551616.0
+
+#define ARENA_ALIGNMENT 8
+#define ARENA_ALIGN(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
 #undef malloc
 #undef free
 
+#if defined(PARSON_STATS)
+static void *stats_malloc(size_t size);
+static void stats_free(void *ptr);
+
+/* parson_malloc and parson_free count what they pass on to these */
+static JSON_Malloc_Function stats_malloc_fun = malloc;
+static JSON_Free_Function stats_free_fun = free;
+static JSON_Malloc_Function parson_malloc = stats_malloc;
+static JSON_Free_Function parson_free = stats_free;
+static JSON_Stats parson_stats;
+#else
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
+#endif
+
+/* Arena that parson_malloc allocates from while json_parse_string_arena runs, NULL otherwise */
+static JSON_Arena *parson_arena = NULL;
+
+/* Whether objects created from now on intern their names, and the pool of interned names */
+static int key_interning = 0;
+static struct json_key_pool_t {
+    struct json_key_t **buckets; /* chains of keys by hash, NULL while the pool is empty */
+    size_t bucket_count;         /* power of two */
+    size_t count;
+} key_pool = {NULL, 0, 0};
+
+/* Lazy copies that haven't been given their members yet, which changes to containers only have
+   to look out for while there are some */
+static size_t lazy_copy_count = 0;
 
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -81,7 +205,9 @@ typedef union json_value_value {
 
 struct json_value_t {
     JSON_Value *parent;
-    JSON_Value_Type type;
+    signed char type;        /* JSON_Value_Type */
+    unsigned char is_inline; /* string, object or array is in the value's own allocation */
+    unsigned char is_lazy;   /* a JSON_Lazy_Value whose members haven't been parsed yet */
     JSON_Value_Value value;
 };
 
@@ -91,6 +217,33 @@ struct json_object_t {
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    size_t *index;          /* open addressing table of positions + 1, 0 marks an empty slot */
+    size_t index_capacity;  /* power of two, at least twice capacity */
+    int interned;           /* names are references to pooled keys rather than own copies */
+    int in_arena;           /* allocated from an arena, so lazy copies can't refer to it */
+    JSON_Value *copies;     /* lazy copies of it not given their members yet */
+};
+
+typedef struct json_key_t {
+    struct json_key_t *next; /* next key in the same bucket */
+    size_t refs;             /* members named by this key */
+    unsigned long hash;      /* hash_string of name */
+    size_t name_len;
+    char name[1]; /* NUL terminated, allocated to fit */
+} JSON_Key;
+
+#define PATH_NO_INDEX ((size_t)-1)
+
+typedef struct json_path_segment_t {
+    const char *name;   /* NUL terminated, stored after the segments */
+    size_t name_len;
+    unsigned long hash; /* hash_string of name */
+    size_t index;       /* array index name spells in a JSON Pointer, PATH_NO_INDEX otherwise */
+} JSON_Path_Segment;
+
+struct json_path_t {
+    size_t count;
+    JSON_Path_Segment *segments;
 };
 
 struct json_array_t {
@@ -98,7 +251,358 @@ struct json_array_t {
     JSON_Value **items;
     size_t count;
     size_t capacity;
+    int in_arena;       /* allocated from an arena, so lazy copies can't refer to it */
+    JSON_Value *copies; /* lazy copies of it not given their members yet */
+};
+
+/* Containers are allocated together with the value wrapping them */
+typedef struct json_object_value_t {
+    JSON_Value value;
+    JSON_Object object;
+} JSON_Object_Value;
+
+typedef struct json_array_value_t {
+    JSON_Value value;
+    JSON_Array array;
+} JSON_Array_Value;
+
+/* Text of a lazily parsed document, shared by its containers until they're all parsed */
+typedef struct json_lazy_text_t {
+    size_t refs;  /* containers not parsed yet */
+    char text[1]; /* from the root's opening bracket to its closing one, allocated to fit */
+} JSON_Lazy_Text;
+
+/* Container of a lazily parsed document, whose members are parsed when it's first accessed, or
+   lazy copy of a container, which is given copies of its members when it's first accessed */
+typedef struct json_lazy_value_t {
+    JSON_Value value;
+    union {
+        JSON_Object object;
+        JSON_Array array;
+    } container;
+    JSON_Lazy_Text *text; /* NULL for a lazy copy */
+    const char *start;    /* its opening bracket in text */
+    const char *end;      /* one past its closing bracket */
+    JSON_Value *source;    /* what a lazy copy is a copy of */
+    JSON_Value *next_copy; /* next lazy copy of the same source */
+} JSON_Lazy_Value;
+
+#if defined(PARSON_STATS)
+/* In front of each allocation, aligned for anything parson stores */
+typedef union json_stats_header_t {
+    size_t size; /* requested */
+    double align_double;
+    void *align_pointer;
+} JSON_Stats_Header;
+#endif
+
+typedef struct json_arena_block_t {
+    struct json_arena_block_t *next; /* previously filled block */
+    size_t size;                     /* usable bytes following the (aligned) header */
+    size_t used;
+} JSON_Arena_Block;
+
+typedef struct json_parser_t {
+    const char *ptr; /* next character to parse */
+    const char *end; /* one past the last character of input, which needn't be NUL terminated */
+    int in_situ;     /* unescape strings in place and reference them instead of copying */
+} JSON_Parser;
+
+typedef struct json_cbor_parser_t {
+    const unsigned char *ptr; /* next byte to decode */
+    const unsigned char *end;
+    JSON_Event_Function callback;
+    void *context;
+    char *name_buf;   /* PARSON_EVENT_BUFFER_SIZE bytes that names sent in chunks are joined in */
+    char *string_buf; /* and the same for strings */
+} JSON_CBOR_Parser;
+
+enum json_stream_state {
+    STREAM_VALUE,       /* expecting a value */
+    STREAM_NAME,        /* expecting a member name */
+    STREAM_COLON,       /* expecting ':' after a member name */
+    STREAM_AFTER_VALUE, /* expecting ',' or the end of the innermost container */
+    STREAM_DONE,        /* root value is complete, anything after it is ignored */
+    STREAM_ERROR
+};
+
+enum json_stream_token { STREAM_TOKEN_NONE, STREAM_TOKEN_STRING, STREAM_TOKEN_BARE };
+
+struct json_stream_parser_t {
+    JSON_Event_Function callback;
+    void *context;
+    JSON_Value *root;      /* value built when there's no callback */
+    JSON_Value *current;   /* innermost open container of root */
+    int state;             /* json_stream_state */
+    int token;             /* json_stream_token the last chunk ended in */
+    int escaped;           /* unfinished string token ended with a backslash */
+    int just_opened;       /* innermost container has no members or items yet */
+    int is_object;         /* innermost container is an object */
+    int has_name;          /* name holds the member name of the next value */
+    size_t depth;          /* depth of the next value */
+    size_t bom_matched;    /* leading bytes matching the UTF-8 BOM, 3 once past it */
+    char *stash;           /* unfinished token, without its opening quote */
+    size_t stash_len;
+    size_t stash_capacity;
+    char *name;
+    size_t name_len;
+    size_t name_capacity;
+    char *string;          /* unescaped string value */
+    size_t string_capacity;
+    unsigned char in_object[MAX_NESTING / 8 + 1]; /* bit per open container, set for objects */
+};
+
+struct json_arena_t {
+    JSON_Arena_Block *blocks; /* block currently allocated from, older blocks follow */
+    size_t block_size;        /* 0 if arena lives in a caller supplied buffer and can't grow */
+    JSON_Malloc_Function malloc_fun;
+    JSON_Free_Function free_fun;
+};
+
+typedef struct json_writer_t {
+    char *buf; /* NULL when only counting */
+    size_t len;
+    size_t capacity;
+    int growable;            /* reallocate buf instead of failing when full */
+    JSON_Sink_Function sink; /* flush buf to sink instead of failing when full */
+    void *context;
+    char num_buf[NUM_BUF_SIZE]; /* for numbers that don't fit in buf as is */
+} JSON_Writer;
+
+#if !defined(PARSON_DISABLE_FAST_NUMBERS)
+typedef struct json_diy_fp_t {
+    uint64_t f; /* significand, the value is f * 2^e */
+    int e;
+} JSON_Diy_Fp;
+
+static const double exact_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                             1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                             1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* 5^q normalized to 128 bits, truncated for q >= 0 and rounded up for q < 0, generated like
+   the table of the fast_float library. Exponents outside the range are left to strtod. */
+#define POWERS_OF_FIVE_MIN -64
+#define POWERS_OF_FIVE_MAX 63
+static const uint64_t powers_of_five[][2] = {
+    {0xA87FEA27A539E9A5, 0x3F2398D747B36224}, /* 5^-64 */
+    {0xD29FE4B18E88640E, 0x8EEC7F0D19A03AAD}, /* 5^-63 */
+    {0x83A3EEEEF9153E89, 0x1953CF68300424AC}, /* 5^-62 */
+    {0xA48CEAAAB75A8E2B, 0x5FA8C3423C052DD7}, /* 5^-61 */
+    {0xCDB02555653131B6, 0x3792F412CB06794D}, /* 5^-60 */
+    {0x808E17555F3EBF11, 0xE2BBD88BBEE40BD0}, /* 5^-59 */
+    {0xA0B19D2AB70E6ED6, 0x5B6ACEAEAE9D0EC4}, /* 5^-58 */
+    {0xC8DE047564D20A8B, 0xF245825A5A445275}, /* 5^-57 */
+    {0xFB158592BE068D2E, 0xEED6E2F0F0D56712}, /* 5^-56 */
+    {0x9CED737BB6C4183D, 0x55464DD69685606B}, /* 5^-55 */
+    {0xC428D05AA4751E4C, 0xAA97E14C3C26B886}, /* 5^-54 */
+    {0xF53304714D9265DF, 0xD53DD99F4B3066A8}, /* 5^-53 */
+    {0x993FE2C6D07B7FAB, 0xE546A8038EFE4029}, /* 5^-52 */
+    {0xBF8FDB78849A5F96, 0xDE98520472BDD033}, /* 5^-51 */
+    {0xEF73D256A5C0F77C, 0x963E66858F6D4440}, /* 5^-50 */
+    {0x95A8637627989AAD, 0xDDE7001379A44AA8}, /* 5^-49 */
+    {0xBB127C53B17EC159, 0x5560C018580D5D52}, /* 5^-48 */
+    {0xE9D71B689DDE71AF, 0xAAB8F01E6E10B4A6}, /* 5^-47 */
+    {0x9226712162AB070D, 0xCAB3961304CA70E8}, /* 5^-46 */
+    {0xB6B00D69BB55C8D1, 0x3D607B97C5FD0D22}, /* 5^-45 */
+    {0xE45C10C42A2B3B05, 0x8CB89A7DB77C506A}, /* 5^-44 */
+    {0x8EB98A7A9A5B04E3, 0x77F3608E92ADB242}, /* 5^-43 */
+    {0xB267ED1940F1C61C, 0x55F038B237591ED3}, /* 5^-42 */
+    {0xDF01E85F912E37A3, 0x6B6C46DEC52F6688}, /* 5^-41 */
+    {0x8B61313BBABCE2C6, 0x2323AC4B3B3DA015}, /* 5^-40 */
+    {0xAE397D8AA96C1B77, 0xABEC975E0A0D081A}, /* 5^-39 */
+    {0xD9C7DCED53C72255, 0x96E7BD358C904A21}, /* 5^-38 */
+    {0x881CEA14545C7575, 0x7E50D64177DA2E54}, /* 5^-37 */
+    {0xAA242499697392D2, 0xDDE50BD1D5D0B9E9}, /* 5^-36 */
+    {0xD4AD2DBFC3D07787, 0x955E4EC64B44E864}, /* 5^-35 */
+    {0x84EC3C97DA624AB4, 0xBD5AF13BEF0B113E}, /* 5^-34 */
+    {0xA6274BBDD0FADD61, 0xECB1AD8AEACDD58E}, /* 5^-33 */
+    {0xCFB11EAD453994BA, 0x67DE18EDA5814AF2}, /* 5^-32 */
+    {0x81CEB32C4B43FCF4, 0x80EACF948770CED7}, /* 5^-31 */
+    {0xA2425FF75E14FC31, 0xA1258379A94D028D}, /* 5^-30 */
+    {0xCAD2F7F5359A3B3E, 0x096EE45813A04330}, /* 5^-29 */
+    {0xFD87B5F28300CA0D, 0x8BCA9D6E188853FC}, /* 5^-28 */
+    {0x9E74D1B791E07E48, 0x775EA264CF55347E}, /* 5^-27 */
+    {0xC612062576589DDA, 0x95364AFE032A819E}, /* 5^-26 */
+    {0xF79687AED3EEC551, 0x3A83DDBD83F52205}, /* 5^-25 */
+    {0x9ABE14CD44753B52, 0xC4926A9672793543}, /* 5^-24 */
+    {0xC16D9A0095928A27, 0x75B7053C0F178294}, /* 5^-23 */
+    {0xF1C90080BAF72CB1, 0x5324C68B12DD6339}, /* 5^-22 */
+    {0x971DA05074DA7BEE, 0xD3F6FC16EBCA5E04}, /* 5^-21 */
+    {0xBCE5086492111AEA, 0x88F4BB1CA6BCF585}, /* 5^-20 */
+    {0xEC1E4A7DB69561A5, 0x2B31E9E3D06C32E6}, /* 5^-19 */
+    {0x9392EE8E921D5D07, 0x3AFF322E62439FD0}, /* 5^-18 */
+    {0xB877AA3236A4B449, 0x09BEFEB9FAD487C3}, /* 5^-17 */
+    {0xE69594BEC44DE15B, 0x4C2EBE687989A9B4}, /* 5^-16 */
+    {0x901D7CF73AB0ACD9, 0x0F9D37014BF60A11}, /* 5^-15 */
+    {0xB424DC35095CD80F, 0x538484C19EF38C95}, /* 5^-14 */
+    {0xE12E13424BB40E13, 0x2865A5F206B06FBA}, /* 5^-13 */
+    {0x8CBCCC096F5088CB, 0xF93F87B7442E45D4}, /* 5^-12 */
+    {0xAFEBFF0BCB24AAFE, 0xF78F69A51539D749}, /* 5^-11 */
+    {0xDBE6FECEBDEDD5BE, 0xB573440E5A884D1C}, /* 5^-10 */
+    {0x89705F4136B4A597, 0x31680A88F8953031}, /* 5^-9 */
+    {0xABCC77118461CEFC, 0xFDC20D2B36BA7C3E}, /* 5^-8 */
+    {0xD6BF94D5E57A42BC, 0x3D32907604691B4D}, /* 5^-7 */
+    {0x8637BD05AF6C69B5, 0xA63F9A49C2C1B110}, /* 5^-6 */
+    {0xA7C5AC471B478423, 0x0FCF80DC33721D54}, /* 5^-5 */
+    {0xD1B71758E219652B, 0xD3C36113404EA4A9}, /* 5^-4 */
+    {0x83126E978D4FDF3B, 0x645A1CAC083126EA}, /* 5^-3 */
+    {0xA3D70A3D70A3D70A, 0x3D70A3D70A3D70A4}, /* 5^-2 */
+    {0xCCCCCCCCCCCCCCCC, 0xCCCCCCCCCCCCCCCD}, /* 5^-1 */
+    {0x8000000000000000, 0x0000000000000000}, /* 5^0 */
+    {0xA000000000000000, 0x0000000000000000}, /* 5^1 */
+    {0xC800000000000000, 0x0000000000000000}, /* 5^2 */
+    {0xFA00000000000000, 0x0000000000000000}, /* 5^3 */
+    {0x9C40000000000000, 0x0000000000000000}, /* 5^4 */
+    {0xC350000000000000, 0x0000000000000000}, /* 5^5 */
+    {0xF424000000000000, 0x0000000000000000}, /* 5^6 */
+    {0x9896800000000000, 0x0000000000000000}, /* 5^7 */
+    {0xBEBC200000000000, 0x0000000000000000}, /* 5^8 */
+    {0xEE6B280000000000, 0x0000000000000000}, /* 5^9 */
+    {0x9502F90000000000, 0x0000000000000000}, /* 5^10 */
+    {0xBA43B74000000000, 0x0000000000000000}, /* 5^11 */
+    {0xE8D4A51000000000, 0x0000000000000000}, /* 5^12 */
+    {0x9184E72A00000000, 0x0000000000000000}, /* 5^13 */
+    {0xB5E620F480000000, 0x0000000000000000}, /* 5^14 */
+    {0xE35FA931A0000000, 0x0000000000000000}, /* 5^15 */
+    {0x8E1BC9BF04000000, 0x0000000000000000}, /* 5^16 */
+    {0xB1A2BC2EC5000000, 0x0000000000000000}, /* 5^17 */
+    {0xDE0B6B3A76400000, 0x0000000000000000}, /* 5^18 */
+    {0x8AC7230489E80000, 0x0000000000000000}, /* 5^19 */
+    {0xAD78EBC5AC620000, 0x0000000000000000}, /* 5^20 */
+    {0xD8D726B7177A8000, 0x0000000000000000}, /* 5^21 */
+    {0x878678326EAC9000, 0x0000000000000000}, /* 5^22 */
+    {0xA968163F0A57B400, 0x0000000000000000}, /* 5^23 */
+    {0xD3C21BCECCEDA100, 0x0000000000000000}, /* 5^24 */
+    {0x84595161401484A0, 0x0000000000000000}, /* 5^25 */
+    {0xA56FA5B99019A5C8, 0x0000000000000000}, /* 5^26 */
+    {0xCECB8F27F4200F3A, 0x0000000000000000}, /* 5^27 */
+    {0x813F3978F8940984, 0x4000000000000000}, /* 5^28 */
+    {0xA18F07D736B90BE5, 0x5000000000000000}, /* 5^29 */
+    {0xC9F2C9CD04674EDE, 0xA400000000000000}, /* 5^30 */
+    {0xFC6F7C4045812296, 0x4D00000000000000}, /* 5^31 */
+    {0x9DC5ADA82B70B59D, 0xF020000000000000}, /* 5^32 */
+    {0xC5371912364CE305, 0x6C28000000000000}, /* 5^33 */
+    {0xF684DF56C3E01BC6, 0xC732000000000000}, /* 5^34 */
+    {0x9A130B963A6C115C, 0x3C7F400000000000}, /* 5^35 */
+    {0xC097CE7BC90715B3, 0x4B9F100000000000}, /* 5^36 */
+    {0xF0BDC21ABB48DB20, 0x1E86D40000000000}, /* 5^37 */
+    {0x96769950B50D88F4, 0x1314448000000000}, /* 5^38 */
+    {0xBC143FA4E250EB31, 0x17D955A000000000}, /* 5^39 */
+    {0xEB194F8E1AE525FD, 0x5DCFAB0800000000}, /* 5^40 */
+    {0x92EFD1B8D0CF37BE, 0x5AA1CAE500000000}, /* 5^41 */
+    {0xB7ABC627050305AD, 0xF14A3D9E40000000}, /* 5^42 */
+    {0xE596B7B0C643C719, 0x6D9CCD05D0000000}, /* 5^43 */
+    {0x8F7E32CE7BEA5C6F, 0xE4820023A2000000}, /* 5^44 */
+    {0xB35DBF821AE4F38B, 0xDDA2802C8A800000}, /* 5^45 */
+    {0xE0352F62A19E306E, 0xD50B2037AD200000}, /* 5^46 */
+    {0x8C213D9DA502DE45, 0x4526F422CC340000}, /* 5^47 */
+    {0xAF298D050E4395D6, 0x9670B12B7F410000}, /* 5^48 */
+    {0xDAF3F04651D47B4C, 0x3C0CDD765F114000}, /* 5^49 */
+    {0x88D8762BF324CD0F, 0xA5880A69FB6AC800}, /* 5^50 */
+    {0xAB0E93B6EFEE0053, 0x8EEA0D047A457A00}, /* 5^51 */
+    {0xD5D238A4ABE98068, 0x72A4904598D6D880}, /* 5^52 */
+    {0x85A36366EB71F041, 0x47A6DA2B7F864750}, /* 5^53 */
+    {0xA70C3C40A64E6C51, 0x999090B65F67D924}, /* 5^54 */
+    {0xD0CF4B50CFE20765, 0xFFF4B4E3F741CF6D}, /* 5^55 */
+    {0x82818F1281ED449F, 0xBFF8F10E7A8921A4}, /* 5^56 */
+    {0xA321F2D7226895C7, 0xAFF72D52192B6A0D}, /* 5^57 */
+    {0xCBEA6F8CEB02BB39, 0x9BF4F8A69F764490}, /* 5^58 */
+    {0xFEE50B7025C36A08, 0x02F236D04753D5B4}, /* 5^59 */
+    {0x9F4F2726179A2245, 0x01D762422C946590}, /* 5^60 */
+    {0xC722F0EF9D80AAD6, 0x424D3AD2B7B97EF5}, /* 5^61 */
+    {0xF8EBAD2B84E0D58B, 0xD2E0898765A7DEB2}, /* 5^62 */
+    {0x9B934C3B330C8577, 0x63CC55F49F88EB2F}, /* 5^63 */
+};
+
+/* 10^k normalized to 64 bits and rounded, for k = -300, -292, ..., 340 */
+static const struct {
+    uint64_t f;
+    int e;
+    int k;
+} cached_powers_of_ten[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},
+    {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},
+    {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},
+    {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},
+    {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},
+    {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},
+    {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},
+    {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},
+    {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},
+    {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},
+    {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},
+    {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},
+    {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},
+    {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},
+    {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},
+    {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},
+    {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},
+    {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},
+    {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},
+    {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},
+    {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},
+    {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},
+    {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},
+    {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},
+    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},
+    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},
+    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},
+    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},
+    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},
+    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},
+    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},
+    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},
+    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},
+    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},
+    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},
+    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},
+    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},
+    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324},
+    {0xEB96BF6EBADF77D9, 1039, 332},
+    {0xAF87023B9BF0EE6B, 1066, 340}
 };
+#endif /* PARSON_DISABLE_FAST_NUMBERS */
 
 /* Various */
 static void remove_comments(char *string, const char *start_token, const char *end_token);
@@ -110,49 +614,178 @@ static int num_bytes_in_utf8_sequence(unsigned char c);
 static int verify_utf8_sequence(const unsigned char *string, int *len);
 static int is_valid_utf8(const char *string, size_t string_len);
 static int is_decimal(const char *string, size_t length);
+static int is_number_char(char c);
+static unsigned long hash_string(const char *string, size_t n);
+static const char *scan_string(const char *ptr, const char *end);
+static const char *skip_whitespaces(const char *ptr, const char *end);
+static const char *skip_ascii(const char *ptr, const char *end);
+#if defined(PARSON_SIMD_SSE2) || defined(PARSON_SIMD_NEON)
+static uint64_t simd_structural_mask(const char *ptr);
+#endif
+
+/* Numbers */
+#if !defined(PARSON_DISABLE_FAST_NUMBERS)
+static void multiply_64x64(uint64_t a, uint64_t b, uint64_t *high, uint64_t *low);
+static int leading_zeros_64(uint64_t x);
+static int eisel_lemire(uint64_t w, int q, int negative, double *number);
+static int parse_number_fast(const char *string, size_t length, double *number, size_t *consumed);
+static JSON_Diy_Fp diy_fp_multiply(JSON_Diy_Fp x, JSON_Diy_Fp y);
+static JSON_Diy_Fp diy_fp_normalize(JSON_Diy_Fp x);
+static void grisu2_round(char *digits, int length, uint64_t distance, uint64_t delta,
+                         uint64_t rest, uint64_t ten_k);
+static int grisu2_digits(char *digits, int *decimal_exponent, JSON_Diy_Fp low, JSON_Diy_Fp w,
+                         JSON_Diy_Fp high);
+static int grisu2(double value, char *digits, int *decimal_exponent);
+#endif
+static int format_number(double number, char *buf);
+
+/* Key pool */
+static JSON_Key *json_key_of_name(const char *name);
+static const char *json_key_find(const char *name, size_t name_len, unsigned long hash);
+static const char *json_key_intern(const char *name, size_t name_len, unsigned long hash);
+static void json_key_release(const char *name);
+static JSON_Status json_key_pool_grow(void);
 
 /* JSON Object */
-static JSON_Object *json_object_init(JSON_Value *wrapping_value);
+static void json_object_init(JSON_Object *object, JSON_Value *wrapping_value);
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len);
+static size_t json_object_find_hashed(const JSON_Object *object, const char *name,
+                                      size_t name_len, unsigned long hash, int has_hash);
+static unsigned long json_object_name_hash(const JSON_Object *object, size_t position);
+static JSON_Status json_object_index_build(JSON_Object *object);
+static void json_object_index_insert(JSON_Object *object, size_t position);
+static void json_object_index_remove(JSON_Object *object, size_t position);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
                                                   int free_value);
-static void json_object_free(JSON_Object *object);
+static void json_object_free_name(const JSON_Object *object, char *name);
+static void json_object_free_contents(JSON_Object *object);
 
 /* JSON Array */
-static JSON_Array *json_array_init(JSON_Value *wrapping_value);
+static void json_array_init(JSON_Array *array, JSON_Value *wrapping_value);
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value);
 static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity);
-static void json_array_free(JSON_Array *array);
+static void json_array_free_contents(JSON_Array *array);
 
 /* JSON Value */
 static JSON_Value *json_value_init_string_no_copy(char *string);
+static JSON_Value *json_value_init_string_inline(size_t len);
+static JSON_Value *json_value_init_string_copy(const char *string, size_t len);
+static void json_value_free_contents(JSON_Value *value);
+static JSON_Value *json_value_init_lazy(JSON_Value_Type type, JSON_Lazy_Text *text,
+                                       const char *start, const char *end);
+static JSON_Status json_value_parse_lazy(JSON_Value *value);
+static JSON_Value *json_value_init_copy(const JSON_Value *source);
+static JSON_Value **json_value_get_copies(const JSON_Value *value);
+static const JSON_Value *json_value_get_source(const JSON_Value *value);
+static JSON_Status json_value_expand(JSON_Value *value);
+static JSON_Status json_value_make_copy(JSON_Value *copy);
+static void json_value_drop_copy(JSON_Value *copy);
+static void json_value_move_copies(JSON_Value *from, JSON_Value *to);
+static void json_value_hand_over(JSON_Value *value);
+static JSON_Status json_value_unshare(JSON_Value *value);
+
+/* Paths */
+static JSON_Path *json_path_create(const char *path, char separator, int is_pointer);
+static size_t json_path_parse_index(const char *name, size_t name_len);
+
+/* Merge patches */
+static JSON_Status json_object_diff(const JSON_Object *from, const JSON_Object *to,
+                                    JSON_Object *patch);
+static JSON_Status json_object_apply_merge_patch(JSON_Object *target, const JSON_Object *patch);
+static JSON_Status json_value_move_contents(JSON_Value *target, JSON_Value *source);
+
+/* Arena */
+static JSON_Arena_Block *json_arena_add_block(JSON_Arena *arena, size_t min_size);
+static void *json_arena_alloc(JSON_Arena *arena, size_t size);
+static void json_arena_free_blocks(JSON_Arena *arena, JSON_Arena_Block *last_kept);
+static void *arena_malloc(size_t size);
+static void arena_free(void *ptr);
+
+/* Stats */
+static double stats_now(void);
+static void stats_count_parse(double started);
+static void stats_count_serialization(double started);
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string);
-static int parse_utf16(const char **unprocessed, char **processed);
-static char *process_string(const char *input, size_t len);
-static char *get_quoted_string(const char **string);
-static JSON_Value *parse_object_value(const char **string, size_t nesting);
-static JSON_Value *parse_array_value(const char **string, size_t nesting);
-static JSON_Value *parse_string_value(const char **string);
-static JSON_Value *parse_boolean_value(const char **string);
-static JSON_Value *parse_number_value(const char **string);
-static JSON_Value *parse_null_value(const char **string);
-static JSON_Value *parse_value(const char **string, size_t nesting);
+static JSON_Status skip_quotes(JSON_Parser *parser);
+static int parse_utf16(const char **unprocessed, char **processed, const char *unprocessed_end);
+static char *unescape_string(const char *input, size_t len, char *output);
+static JSON_Status walk_escaped_string(const char *input, size_t len, JSON_Sink_Function sink,
+                                       void *context);
+static char *process_string(const char *input, size_t len, int in_situ);
+static char *get_quoted_string(JSON_Parser *parser);
+static char *get_object_name(JSON_Parser *parser, const JSON_Object *object);
+static int skip_token(JSON_Parser *parser, const char *token, size_t token_size);
+static JSON_Status parse_number(JSON_Parser *parser, double *number);
+static JSON_Value *parse_string_value(JSON_Parser *parser);
+static JSON_Value *parse_boolean_value(JSON_Parser *parser);
+static JSON_Value *parse_number_value(JSON_Parser *parser);
+static JSON_Value *parse_null_value(JSON_Parser *parser);
+static JSON_Value *parse_scalar_value(JSON_Parser *parser);
+static JSON_Value *parse_value(JSON_Parser *parser);
+static char *parse_member_name(JSON_Parser *parser, JSON_Object *object);
+static JSON_Status parse_end_container(JSON_Value *container);
+static int is_empty_container(const char *ptr, const char *end);
+static const char *skip_container(const char *ptr, const char *end);
+static JSON_Status parse_lazy_members(JSON_Parser *parser, JSON_Value *container,
+                                      JSON_Lazy_Text *text);
+static JSON_Value *parse_buffer(const char *buf, size_t buf_len, int in_situ);
+static JSON_Value *parse_buffer_arena(const char *buf, size_t buf_len, int in_situ,
+                                      JSON_Arena *arena);
+
+/* Event parser */
+static JSON_Status parse_events(const char *buf, size_t buf_len, JSON_Event_Function callback,
+                                void *context);
+static JSON_Status get_event_string(JSON_Parser *parser, char *buf, const char **string,
+                                    size_t *string_len, int *escaped);
+
+/* Stream parser */
+static JSON_Status stream_reserve(char **buffer, size_t *capacity, size_t size);
+static JSON_Status stream_stash(JSON_Stream_Parser *parser, const char *data, size_t len);
+static const char *stream_find_token_end(JSON_Stream_Parser *parser, const char *ptr,
+                                         const char *end);
+static JSON_Status stream_end_token(JSON_Stream_Parser *parser, const char *token, size_t len);
+static JSON_Status stream_structural(JSON_Stream_Parser *parser, char c);
+static JSON_Status stream_report_value(JSON_Stream_Parser *parser, JSON_Event *event);
+static JSON_Status stream_build_value(const JSON_Event *event, void *context);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+static void writer_init(JSON_Writer *writer, char *buf, size_t capacity);
+static JSON_Status writer_make_room(JSON_Writer *writer, size_t len);
+static JSON_Status writer_append(JSON_Writer *writer, const char *data, size_t len);
+static JSON_Status json_serialize_to_writer(const JSON_Value *value, JSON_Writer *writer,
+                                            int is_pretty);
+static JSON_Status json_serialize_member_start(const JSON_Value *container, size_t i,
+                                               JSON_Writer *writer, size_t level, int is_pretty);
+static const JSON_Value *json_serialize_member_value(const JSON_Value *container, size_t i);
+static JSON_Status json_serialize_scalar(const JSON_Value *value, JSON_Writer *writer);
+static JSON_Status json_serialize_string(const char *string, JSON_Writer *writer);
+static JSON_Status append_indent(JSON_Writer *writer, int level);
+static size_t serialization_size(const JSON_Value *value, int is_pretty);
+static JSON_Status serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size,
+                                       int is_pretty);
+static char *serialize_to_string(const JSON_Value *value, int is_pretty);
+static JSON_Status serialize_to_sink(const JSON_Value *value, JSON_Sink_Function sink,
+                                     void *context, int is_pretty);
+
+/* CBOR */
+static void cbor_put(JSON_CBOR_Writer *writer, const void *data, size_t len);
+static void cbor_put_head(JSON_CBOR_Writer *writer, int major, uint64_t arg);
+static void cbor_put_head_sized(JSON_CBOR_Writer *writer, int major, int info, uint64_t arg);
+static JSON_Status cbor_read_head(JSON_CBOR_Parser *parser, int *major, int *info, uint64_t *arg);
+static JSON_Status cbor_read_text(JSON_CBOR_Parser *parser, int info, uint64_t arg, char *buf,
+                                  const char **string, size_t *string_len);
+static double cbor_half_to_double(unsigned int half);
+static JSON_Status cbor_parse_item(JSON_CBOR_Parser *parser, JSON_Event *event, size_t depth);
 
 /* Various */
 static char *parson_strndup(const char *string, size_t n)
@@ -262,7 +895,14 @@ static int is_valid_utf8(const char *string, size_t string_len)
     int len = 0;
     const char *string_end = string + string_len;
     while (string < string_end) {
-        if (!verify_utf8_sequence((const unsigned char *)string, &len)) {
+        string = skip_ascii(string, string_end);
+        if (string == string_end) {
+            break;
+        }
+        /* the input isn't always NUL terminated, so a sequence mustn't run past its end */
+        len = num_bytes_in_utf8_sequence((unsigned char)*string);
+        if (len == 0 || string_end - string < len ||
+            !verify_utf8_sequence((const unsigned char *)string, &len)) {
             return 0;
         }
         string += len;
@@ -270,6 +910,183 @@ static int is_valid_utf8(const char *string, size_t string_len)
     return 1;
 }
 
+#if defined(PARSON_SIMD_SSE2)
+#define SIMD_MASK_BITS 1 /* per byte in a simd_match_mask result */
+
+/* Mask of the bytes set in a comparison result */
+static uint64_t simd_match_mask(__m128i matches)
+{
+    return (uint64_t)(unsigned int)_mm_movemask_epi8(matches);
+}
+#elif defined(PARSON_SIMD_NEON)
+#define SIMD_MASK_BITS 4
+
+static uint64_t simd_match_mask(uint8x16_t matches)
+{
+    /* NEON has no movemask, narrow each byte to a nibble of a 64 bit mask instead */
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+}
+#endif
+
+#if defined(PARSON_SIMD_SSE2) || defined(PARSON_SIMD_NEON)
+/* Index of the first byte in a mask from simd_match_mask, which mustn't be 0 */
+static int simd_mask_first(uint64_t mask)
+{
+    int index = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    index = __builtin_ctzll(mask);
+#else
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+#endif
+    return index / SIMD_MASK_BITS;
+}
+
+/* Index of the first byte set in a comparison result, 16 if there's none */
+#if defined(PARSON_SIMD_SSE2)
+static int simd_first_match(__m128i matches)
+#else
+static int simd_first_match(uint8x16_t matches)
+#endif
+{
+    uint64_t mask = simd_match_mask(matches);
+    return mask == 0 ? SIMD_BLOCK_SIZE : simd_mask_first(mask);
+}
+
+/* Mask of the quotes, backslashes and brackets among the 16 bytes at ptr. Setting bit 5 folds
+   brackets onto braces, which no other byte maps to. */
+static uint64_t simd_structural_mask(const char *ptr)
+{
+#if defined(PARSON_SIMD_SSE2)
+    const __m128i block = _mm_loadu_si128((const __m128i *)ptr);
+    const __m128i folded = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    return simd_match_mask(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\"')),
+                                  _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                  _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')))));
+#else
+    const uint8x16_t block = vld1q_u8((const uint8_t *)ptr);
+    const uint8x16_t folded = vorrq_u8(block, vdupq_n_u8(0x20));
+    return simd_match_mask(
+        vorrq_u8(vorrq_u8(vceqq_u8(block, vdupq_n_u8('\"')), vceqq_u8(block, vdupq_n_u8('\\'))),
+                 vorrq_u8(vceqq_u8(folded, vdupq_n_u8('{')), vceqq_u8(folded, vdupq_n_u8('}')))));
+#endif
+}
+#endif
+
+/* Returns the first '\"', '\\' or control character at or after ptr, or end if there's none */
+static const char *scan_string(const char *ptr, const char *end)
+{
+#if defined(PARSON_SIMD_SSE2)
+    const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+    const __m128i last_control = _mm_set1_epi8(0x1F);
+    __m128i block;
+    int index = 0;
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        index = simd_first_match(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(block, last_control), last_control)));
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#elif defined(PARSON_SIMD_NEON)
+    const uint8x16_t quote = vdupq_n_u8('\"'), backslash = vdupq_n_u8('\\');
+    const uint8x16_t first_printable = vdupq_n_u8(0x20);
+    uint8x16_t block;
+    int index = 0;
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        block = vld1q_u8((const uint8_t *)ptr);
+        index = simd_first_match(vorrq_u8(
+            vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash)),
+            vcltq_u8(block, first_printable)));
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#endif
+    while (ptr < end && *ptr != '\"' && *ptr != '\\' && (unsigned char)*ptr >= 0x20) {
+        ptr++;
+    }
+    return ptr;
+}
+
+static const char *skip_whitespaces(const char *ptr, const char *end)
+{
+#if defined(PARSON_SIMD_SSE2)
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i other_spaces = _mm_set1_epi8('\r' - '\t'); /* \t, \n, \v, \f and \r */
+    __m128i block, offset;
+    int index = 0;
+    /* Minified JSON has no whitespace to skip, so look at a single byte first */
+    if (ptr < end && !IS_SPACE(*ptr)) {
+        return ptr;
+    }
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        block = _mm_loadu_si128((const __m128i *)ptr);
+        offset = _mm_sub_epi8(block, tab);
+        index = simd_first_match(_mm_xor_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                         _mm_cmpeq_epi8(_mm_min_epu8(offset, other_spaces), offset)),
+            _mm_set1_epi8(-1)));
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#elif defined(PARSON_SIMD_NEON)
+    const uint8x16_t space = vdupq_n_u8(' '), tab = vdupq_n_u8('\t');
+    const uint8x16_t other_spaces = vdupq_n_u8('\r' - '\t'); /* \t, \n, \v, \f and \r */
+    uint8x16_t block;
+    int index = 0;
+    if (ptr < end && !IS_SPACE(*ptr)) {
+        return ptr;
+    }
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        block = vld1q_u8((const uint8_t *)ptr);
+        index = simd_first_match(vmvnq_u8(
+            vorrq_u8(vceqq_u8(block, space), vcleq_u8(vsubq_u8(block, tab), other_spaces))));
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#endif
+    while (ptr < end && IS_SPACE(*ptr)) {
+        ptr++;
+    }
+    return ptr;
+}
+
+/* Returns the first byte at or after ptr with its high bit set, or end if there's none */
+static const char *skip_ascii(const char *ptr, const char *end)
+{
+#if defined(PARSON_SIMD_SSE2)
+    int index = 0;
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        index = simd_first_match(_mm_loadu_si128((const __m128i *)ptr)); /* tests sign bits */
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#elif defined(PARSON_SIMD_NEON)
+    const uint8x16_t high_bit = vdupq_n_u8(0x80);
+    int index = 0;
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        index = simd_first_match(vtstq_u8(vld1q_u8((const uint8_t *)ptr), high_bit));
+        if (index < SIMD_BLOCK_SIZE) {
+            return ptr + index;
+        }
+    }
+#endif
+    while (ptr < end && ((unsigned char)*ptr & 0x80) == 0) {
+        ptr++;
+    }
+    return ptr;
+}
+
 static int is_decimal(const char *string, size_t length)
 {
     if (length > 1 && string[0] == '0' && string[1] != '.') {
@@ -286,6 +1103,25 @@ static int is_decimal(const char *string, size_t length)
     return 1;
 }
 
+/* FNV-1a */
+static unsigned long hash_string(const char *string, size_t n)
+{
+    unsigned long hash = 2166136261UL;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/* x and X aren't valid, but are passed on for is_decimal to reject hex numbers */
+static int is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E' ||
+           c == 'x' || c == 'X';
+}
+
 static void remove_comments(char *string, const char *start_token, const char *end_token)
 {
     int in_string = 0, escaped = 0;
@@ -322,19 +1158,459 @@ static void remove_comments(char *string, const char *start_token, const char *e
     }
 }
 
-/* JSON Object */
-static JSON_Object *json_object_init(JSON_Value *wrapping_value)
+/* Numbers */
+#if !defined(PARSON_DISABLE_FAST_NUMBERS)
+static void multiply_64x64(uint64_t a, uint64_t b, uint64_t *high, uint64_t *low)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *high = (uint64_t)(product >> 64);
+    *low = (uint64_t)product;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32, b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t middle = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    *high = hi_hi + (hi_lo >> 32) + (middle >> 32);
+    *low = (middle << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+static int leading_zeros_64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int count = 0;
+    while ((x & ((uint64_t)1 << 63)) == 0) {
+        x <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/* Eisel-Lemire: w * 10^q rounded to the nearest double, from w and a 128 bit approximation of
+   5^q (see Lemire, "Number Parsing at a Gigabyte per Second"). w must not be 0. Returns 0 if
+   the approximation can't decide the rounding or the result over- or underflows. */
+static int eisel_lemire(uint64_t w, int q, int negative, double *number)
+{
+    const uint64_t *power = NULL;
+    uint64_t high = 0, low = 0, second_high = 0, second_low = 0, mantissa = 0, bits = 0;
+    int zeros = 0, upper_bit = 0, shift = 0, power2 = 0;
+    if (q < POWERS_OF_FIVE_MIN || q > POWERS_OF_FIVE_MAX) {
+        return 0;
+    }
+    power = powers_of_five[q - POWERS_OF_FIVE_MIN];
+    zeros = leading_zeros_64(w);
+    w <<= zeros;
+    multiply_64x64(w, power[0], &high, &low);
+    if ((high & 0x1FF) == 0x1FF) { /* bits below the mantissa might carry, use more of 5^q */
+        multiply_64x64(w, power[1], &second_high, &second_low);
+        low += second_high;
+        if (second_high > low) {
+            high++;
+        }
+        if (low == UINT64_MAX && (q < -27 || q > 55)) {
+            return 0;
+        }
+    }
+    upper_bit = (int)(high >> 63);
+    shift = upper_bit + 64 - 52 - 3;
+    mantissa = high >> shift;
+    power2 = (((152170 + 65536) * q) >> 16) + 63 + upper_bit - zeros + 1023;
+    if (power2 <= 0) { /* subnormal */
+        return 0;
+    }
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high) {
+        mantissa &= ~(uint64_t)1; /* exactly halfway between two doubles, round to even */
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << 52)) {
+        mantissa = (uint64_t)1 << 52;
+        power2++;
+    }
+    mantissa &= ~((uint64_t)1 << 52);
+    if (power2 >= 0x7FF) {
+        return 0;
+    }
+    bits = mantissa | ((uint64_t)power2 << 52) | ((uint64_t)negative << 63);
+    memcpy(number, &bits, sizeof(bits));
+    return 1;
+}
+
+/* Parses the number in JSON's grammar at the start of string. Returns 0, leaving the number to
+   strtod, unless it can be converted exactly here: it has at most 19 significant digits, it
+   doesn't over- or underflow and strtod wouldn't read any further than the grammar allows. */
+static int parse_number_fast(const char *string, size_t length, double *number, size_t *consumed)
+{
+    const char *ptr = string, *end = string + length;
+    uint64_t mantissa = 0;
+    int negative = 0, digits = 0, exponent = 0, explicit_exponent = 0, exponent_negative = 0;
+    if (ptr < end && *ptr == '-') {
+        negative = 1;
+        ptr++;
+    }
+    if (ptr == end || !IS_DIGIT(*ptr)) {
+        return 0;
+    }
+    if (*ptr == '0') {
+        ptr++;
+        if (ptr < end && *ptr != '.' && is_number_char(*ptr)) {
+            return 0; /* leave "01" and "0e5" to is_decimal */
+        }
+    } else {
+        for (; ptr < end && IS_DIGIT(*ptr); ptr++) {
+            if (++digits > 19) {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+        }
+    }
+    if (ptr < end && *ptr == '.') {
+        ptr++;
+        if (ptr == end || !IS_DIGIT(*ptr)) {
+            return 0;
+        }
+        for (; ptr < end && IS_DIGIT(*ptr); ptr++) {
+            if (mantissa != 0 || *ptr != '0') { /* leading zeros aren't significant */
+                if (++digits > 19) {
+                    return 0;
+                }
+                mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            }
+            exponent--;
+        }
+    }
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+        ptr++;
+        if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+            exponent_negative = *ptr == '-';
+            ptr++;
+        }
+        if (ptr == end || !IS_DIGIT(*ptr)) {
+            return 0;
+        }
+        for (; ptr < end && IS_DIGIT(*ptr); ptr++) {
+            if (explicit_exponent > 9999) {
+                return 0;
+            }
+            explicit_exponent = explicit_exponent * 10 + (*ptr - '0');
+        }
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
+    if (ptr < end && is_number_char(*ptr)) { /* e.g. "1.2.3" or "01" */
+        return 0;
+    }
+    *consumed = (size_t)(ptr - string);
+    if (mantissa == 0) {
+        *number = negative ? -0.0 : 0.0;
+        return 1;
+    }
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    /* Clinger: both operands are exact doubles, so one rounding gives the exact result */
+    if (mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        *number = exponent < 0 ? (double)mantissa / exact_powers_of_ten[-exponent]
+                               : (double)mantissa * exact_powers_of_ten[exponent];
+        *number = negative ? -*number : *number;
+        return 1;
+    }
+#endif
+    return eisel_lemire(mantissa, exponent, negative, number);
+}
+
+/* Upper 64 bits of the product, rounded */
+static JSON_Diy_Fp diy_fp_multiply(JSON_Diy_Fp x, JSON_Diy_Fp y)
 {
-    JSON_Object *new_obj = (JSON_Object *)parson_malloc(sizeof(JSON_Object));
-    if (new_obj == NULL) {
+    JSON_Diy_Fp result;
+    uint64_t high = 0, low = 0;
+    multiply_64x64(x.f, y.f, &high, &low);
+    result.f = high + (low >> 63);
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+static JSON_Diy_Fp diy_fp_normalize(JSON_Diy_Fp x)
+{
+    int zeros = leading_zeros_64(x.f);
+    x.f <<= zeros;
+    x.e -= zeros;
+    return x;
+}
+
+/* Moves the last digit towards w while that keeps it inside the interval and gets closer */
+static void grisu2_round(char *digits, int length, uint64_t distance, uint64_t delta,
+                         uint64_t rest, uint64_t ten_k)
+{
+    while (rest < distance && delta - rest >= ten_k &&
+           (rest + ten_k < distance || distance - rest > rest + ten_k - distance)) {
+        digits[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Generates the shortest digits of a number in [low, high], as close to w as possible */
+static int grisu2_digits(char *digits, int *decimal_exponent, JSON_Diy_Fp low, JSON_Diy_Fp w,
+                         JSON_Diy_Fp high)
+{
+    uint64_t delta = high.f - low.f, distance = high.f - w.f, rest = 0;
+    uint64_t one = (uint64_t)1 << -high.e, fractional = high.f & (one - 1);
+    uint32_t integral = (uint32_t)(high.f >> -high.e), power = 1;
+    int length = 0, n = 1, m = 0;
+    while (power <= integral / 10) {
+        power *= 10;
+        n++;
+    }
+    while (n > 0) {
+        digits[length++] = (char)('0' + integral / power);
+        integral %= power;
+        n--;
+        rest = ((uint64_t)integral << -high.e) + fractional;
+        if (rest <= delta) {
+            *decimal_exponent += n;
+            grisu2_round(digits, length, distance, delta, rest, (uint64_t)power << -high.e);
+            return length;
+        }
+        power /= 10;
+    }
+    for (;;) {
+        fractional *= 10;
+        digits[length++] = (char)('0' + (fractional >> -high.e));
+        fractional &= one - 1;
+        m++;
+        delta *= 10;
+        distance *= 10;
+        if (fractional <= delta) {
+            break;
+        }
+    }
+    *decimal_exponent -= m;
+    grisu2_round(digits, length, distance, delta, fractional, one);
+    return length;
+}
+
+/* Grisu2 (see Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers"):
+   digits of a positive finite value that read back as the same double, almost always the
+   fewest possible. Returns how many, the value is digits * 10^decimal_exponent. */
+static int grisu2(double value, char *digits, int *decimal_exponent)
+{
+    JSON_Diy_Fp v, high, low, cached;
+    uint64_t bits = 0, fraction = 0;
+    int biased_exponent = 0, f = 0, k = 0, index = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    fraction = bits & (((uint64_t)1 << 52) - 1);
+    biased_exponent = (int)(bits >> 52) & 0x7FF;
+    v.f = biased_exponent == 0 ? fraction : fraction | ((uint64_t)1 << 52);
+    v.e = (biased_exponent == 0 ? 1 : biased_exponent) - 1075;
+    /* halfway to the neighbouring doubles, the one below is closer at powers of two */
+    high.f = 2 * v.f + 1;
+    high.e = v.e - 1;
+    if (fraction == 0 && biased_exponent > 1) {
+        low.f = 4 * v.f - 1;
+        low.e = v.e - 2;
+    } else {
+        low.f = 2 * v.f - 1;
+        low.e = v.e - 1;
+    }
+    high = diy_fp_normalize(high);
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+    v = diy_fp_normalize(v);
+    /* scale by a cached power of ten, bringing the binary exponent into [-60, -32] */
+    f = -60 - high.e - 1;
+    k = (f * 78913) / (1 << 18) + (f > 0);
+    index = (300 + k + 7) / 8;
+    cached.f = cached_powers_of_ten[index].f;
+    cached.e = cached_powers_of_ten[index].e;
+    v = diy_fp_multiply(v, cached);
+    high = diy_fp_multiply(high, cached);
+    low = diy_fp_multiply(low, cached);
+    low.f++; /* products are rounded, stay inside the interval */
+    high.f--;
+    *decimal_exponent = -cached_powers_of_ten[index].k;
+    return grisu2_digits(digits, decimal_exponent, low, v, high);
+}
+#endif /* PARSON_DISABLE_FAST_NUMBERS */
+
+/* Writes number like FLOAT_FORMAT, but with the fewest digits that read back as the same
+   double, e.g. 0.1 rather than 0.10000000000000001. Returns the length written. */
+static int format_number(double number, char *buf)
+{
+#if defined(PARSON_DISABLE_FAST_NUMBERS)
+    return sprintf(buf, FLOAT_FORMAT, number);
+#else
+    char digits[18];
+    char *ptr = buf;
+    uint64_t bits = 0;
+    int length = 0, decimal_exponent = 0, point = 0, exponent = 0;
+    if (number != number || number > DBL_MAX || number < -DBL_MAX) {
+        return sprintf(buf, FLOAT_FORMAT, number);
+    }
+    memcpy(&bits, &number, sizeof(bits));
+    if (bits >> 63) {
+        *ptr++ = '-';
+        number = -number;
+    }
+    if (number == 0) {
+        *ptr++ = '0';
+        *ptr = '\0';
+        return (int)(ptr - buf);
+    }
+    length = grisu2(number, digits, &decimal_exponent);
+    point = length + decimal_exponent; /* number is 0.digits * 10^point */
+    if (point - 1 < -4 || point - 1 >= 17) { /* where "%.17g" switches to an exponent */
+        *ptr++ = digits[0];
+        if (length > 1) {
+            *ptr++ = '.';
+            memcpy(ptr, digits + 1, (size_t)(length - 1));
+            ptr += length - 1;
+        }
+        exponent = point - 1;
+        *ptr++ = 'e';
+        *ptr++ = exponent < 0 ? '-' : '+';
+        exponent = exponent < 0 ? -exponent : exponent;
+        if (exponent >= 100) {
+            *ptr++ = (char)('0' + exponent / 100);
+            exponent %= 100;
+        }
+        *ptr++ = (char)('0' + exponent / 10);
+        *ptr++ = (char)('0' + exponent % 10);
+    } else if (point <= 0) {
+        *ptr++ = '0';
+        *ptr++ = '.';
+        memset(ptr, '0', (size_t)-point);
+        ptr += -point;
+        memcpy(ptr, digits, (size_t)length);
+        ptr += length;
+    } else if (point >= length) {
+        memcpy(ptr, digits, (size_t)length);
+        ptr += length;
+        memset(ptr, '0', (size_t)(point - length));
+        ptr += point - length;
+    } else {
+        memcpy(ptr, digits, (size_t)point);
+        ptr += point;
+        *ptr++ = '.';
+        memcpy(ptr, digits + point, (size_t)(length - point));
+        ptr += length - point;
+    }
+    *ptr = '\0';
+    return (int)(ptr - buf);
+#endif
+}
+
+/* Key pool */
+static JSON_Key *json_key_of_name(const char *name)
+{
+    return (JSON_Key *)(name - offsetof(JSON_Key, name));
+}
+
+/* Returns the pooled copy of name, or NULL if no member has that name */
+static const char *json_key_find(const char *name, size_t name_len, unsigned long hash)
+{
+    JSON_Key *key = NULL;
+    if (key_pool.count == 0) {
+        return NULL;
+    }
+    for (key = key_pool.buckets[hash & (key_pool.bucket_count - 1)]; key != NULL;
+         key = key->next) {
+        if (key->hash == hash && key->name_len == name_len &&
+            memcmp(key->name, name, name_len) == 0) {
+            return key->name;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the pooled copy of name, adding it if it's new, and takes a reference to it */
+static const char *json_key_intern(const char *name, size_t name_len, unsigned long hash)
+{
+    const char *found = json_key_find(name, name_len, hash);
+    JSON_Key *key = NULL;
+    size_t bucket = 0;
+    if (found != NULL) {
+        json_key_of_name(found)->refs++;
+        return found;
+    }
+    key = (JSON_Key *)parson_malloc(offsetof(JSON_Key, name) + name_len + 1);
+    if (key == NULL) {
+        return NULL;
+    }
+    if (key_pool.count >= key_pool.bucket_count && json_key_pool_grow() == JSONFailure) {
+        parson_free(key);
         return NULL;
     }
-    new_obj->wrapping_value = wrapping_value;
-    new_obj->names = (char **)NULL;
-    new_obj->values = (JSON_Value **)NULL;
-    new_obj->capacity = 0;
-    new_obj->count = 0;
-    return new_obj;
+    key->refs = 1;
+    key->hash = hash;
+    key->name_len = name_len;
+    memcpy(key->name, name, name_len);
+    key->name[name_len] = '\0';
+    bucket = hash & (key_pool.bucket_count - 1);
+    key->next = key_pool.buckets[bucket];
+    key_pool.buckets[bucket] = key;
+    key_pool.count++;
+    return key->name;
+}
+
+/* Drops a reference to a pooled name, freeing it with the last one */
+static void json_key_release(const char *name)
+{
+    JSON_Key *key = json_key_of_name(name);
+    JSON_Key **link = NULL;
+    if (--key->refs > 0) {
+        return;
+    }
+    link = &key_pool.buckets[key->hash & (key_pool.bucket_count - 1)];
+    while (*link != key) {
+        link = &(*link)->next;
+    }
+    *link = key->next;
+    parson_free(key);
+    key_pool.count--;
+    if (key_pool.count == 0) { /* don't hold on to the table once nothing is shared */
+        parson_free(key_pool.buckets);
+        key_pool.buckets = NULL;
+        key_pool.bucket_count = 0;
+    }
+}
+
+static JSON_Status json_key_pool_grow(void)
+{
+    size_t new_count = MAX(key_pool.bucket_count * 2, KEY_POOL_STARTING_CAPACITY);
+    JSON_Key **new_buckets = (JSON_Key **)parson_malloc(new_count * sizeof(JSON_Key *));
+    JSON_Key *key = NULL, *next = NULL;
+    size_t i = 0, bucket = 0;
+    if (new_buckets == NULL) {
+        return JSONFailure;
+    }
+    memset(new_buckets, 0, new_count * sizeof(JSON_Key *));
+    for (i = 0; i < key_pool.bucket_count; i++) {
+        for (key = key_pool.buckets[i]; key != NULL; key = next) {
+            next = key->next;
+            bucket = key->hash & (new_count - 1);
+            key->next = new_buckets[bucket];
+            new_buckets[bucket] = key;
+        }
+    }
+    parson_free(key_pool.buckets);
+    key_pool.buckets = new_buckets;
+    key_pool.bucket_count = new_count;
+    return JSONSuccess;
+}
+
+/* JSON Object */
+static void json_object_init(JSON_Object *object, JSON_Value *wrapping_value)
+{
+    object->wrapping_value = wrapping_value;
+    object->names = (char **)NULL;
+    object->values = (JSON_Value **)NULL;
+    object->capacity = 0;
+    object->count = 0;
+    object->index = (size_t *)NULL;
+    object->index_capacity = 0;
+    object->interned = key_interning && parson_arena == NULL;
+    object->in_arena = parson_arena != NULL;
+    object->copies = NULL;
 }
 
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value)
@@ -347,31 +1623,57 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value)
+{
+    char *name_copy = NULL;
+    if (object == NULL || name == NULL || value == NULL) {
+        return JSONFailure;
+    }
+    if (object->interned) {
+        name_copy = (char *)json_key_intern(name, name_len, hash_string(name, name_len));
+    } else {
+        name_copy = parson_strndup(name, name_len);
+    }
+    if (name_copy == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_add_no_copy(object, name_copy, value) == JSONFailure) {
+        json_object_free_name(object, name_copy);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Takes ownership of name on success: a copy of its own, or for interned objects a reference to
+   a pooled key */
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value)
 {
     size_t index = 0;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
-    if (json_object_getn_value(object, name, name_len) != NULL) {
+    if (json_object_getn_value(object, name, strlen(name)) != NULL) {
         return JSONFailure;
     }
     if (object->count >= object->capacity) {
-        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        size_t starting_capacity =
+            parson_arena == NULL ? STARTING_CAPACITY : ARENA_STARTING_CAPACITY;
+        size_t new_capacity = MAX(object->capacity * 2, starting_capacity);
         if (json_object_resize(object, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
     }
     index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
-    if (object->names[index] == NULL) {
-        return JSONFailure;
-    }
+    object->names[index] = name;
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
+    if (object->index != NULL) {
+        json_object_index_insert(object, index);
+    }
     return JSONSuccess;
 }
 
+/* names and values share one allocation, values following the names */
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 {
     char **temp_names = NULL;
@@ -381,115 +1683,245 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
         (object->names != NULL && object->values == NULL) || new_capacity == 0) {
         return JSONFailure; /* Shouldn't happen */
     }
-    temp_names = (char **)parson_malloc(new_capacity * sizeof(char *));
+    temp_names =
+        (char **)parson_malloc(new_capacity * (sizeof(char *) + sizeof(JSON_Value *)));
     if (temp_names == NULL) {
         return JSONFailure;
     }
-    temp_values = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
-    if (temp_values == NULL) {
-        parson_free(temp_names);
-        return JSONFailure;
-    }
+    temp_values = (JSON_Value **)(temp_names + new_capacity);
     if (object->names != NULL && object->values != NULL && object->count > 0) {
         memcpy(temp_names, object->names, object->count * sizeof(char *));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value *));
     }
     parson_free(object->names);
-    parson_free(object->values);
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
+    if (object->index != NULL) { /* index size depends on capacity, rebuild it */
+        parson_free(object->index);
+        object->index = NULL;
+        object->index_capacity = 0;
+        json_object_index_build(object);
+    }
     return JSONSuccess;
 }
 
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        name_length = strlen(object->names[i]);
-        if (name_length != name_len) {
-            continue;
-        }
-        if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
-        }
+    size_t position = json_object_find(object, name, name_len);
+    if (position == json_object_get_count(object)) {
+        return NULL;
     }
-    return NULL;
+    return object->values[position];
 }
 
-static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
-                                               int free_value)
+/* Returns position of name in object, or object's count if it isn't there. */
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len)
 {
-    size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
-        return JSONFailure;
+    return json_object_find_hashed(object, name, name_len, 0, 0);
+}
+
+/* Same as above, with name's hash_string already worked out if has_hash is set */
+static size_t json_object_find_hashed(const JSON_Object *object, const char *name,
+                                      size_t name_len, unsigned long hash, int has_hash)
+{
+    size_t i, mask, position;
+    size_t count = json_object_get_count(object);
+    if (count == 0) {
+        return 0;
     }
-    last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
+    if (object->index == NULL && PARSON_OBJECT_INDEX_THRESHOLD > 0 &&
+        count >= PARSON_OBJECT_INDEX_THRESHOLD) {
+        json_object_index_build((JSON_Object *)object); /* index is a cache, falls back on fail */
+    }
+    if (object->interned || object->index != NULL) {
+        if (!has_hash) {
+            hash = hash_string(name, name_len);
+        }
+    }
+    if (object->interned) { /* every member name is pooled, so compare the pooled copies */
+        name = json_key_find(name, name_len, hash);
+        if (name == NULL) {
+            return count;
+        }
+    }
+    if (object->index != NULL) {
+        mask = object->index_capacity - 1;
+        for (i = hash & mask; object->index[i] != 0; i = (i + 1) & mask) {
+            position = object->index[i] - 1;
+            if (object->interned ? object->names[position] == name
+                                 : (strncmp(object->names[position], name, name_len) == 0 &&
+                                    object->names[position][name_len] == '\0')) {
+                return position;
             }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
+        }
+        return count;
+    }
+    if (object->interned) {
+        for (i = 0; i < count; i++) {
+            if (object->names[i] == name) {
+                return i;
             }
-            object->count -= 1;
-            return JSONSuccess;
+        }
+        return count;
+    }
+    for (i = 0; i < count; i++) {
+        if (strncmp(object->names[i], name, name_len) == 0 && object->names[i][name_len] == '\0') {
+            return i;
         }
     }
-    return JSONFailure; /* No execution path should end here */
+    return count;
 }
 
-static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
-                                                  int free_value)
+/* hash_string of the name at position, which the pool keeps for interned names */
+static unsigned long json_object_name_hash(const JSON_Object *object, size_t position)
 {
-    JSON_Value *temp_value = NULL;
-    JSON_Object *temp_object = NULL;
-    const char *dot_pos = strchr(name, '.');
-    if (dot_pos == NULL) {
-        return json_object_remove_internal(object, name, free_value);
+    const char *name = object->names[position];
+    return object->interned ? json_key_of_name(name)->hash : hash_string(name, strlen(name));
+}
+
+static JSON_Status json_object_index_build(JSON_Object *object)
+{
+    size_t i, index_capacity = 1;
+    while (index_capacity < object->capacity * 2) {
+        index_capacity *= 2;
     }
-    temp_value = json_object_getn_value(object, name, (size_t)(dot_pos - name));
-    if (json_value_get_type(temp_value) != JSONObject) {
+    object->index = (size_t *)parson_malloc(index_capacity * sizeof(size_t));
+    if (object->index == NULL) {
+        object->index_capacity = 0;
         return JSONFailure;
     }
-    temp_object = json_value_get_object(temp_value);
-    return json_object_dotremove_internal(temp_object, dot_pos + 1, free_value);
+    memset(object->index, 0, index_capacity * sizeof(size_t));
+    object->index_capacity = index_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, i);
+    }
+    return JSONSuccess;
 }
 
-static void json_object_free(JSON_Object *object)
+static void json_object_index_insert(JSON_Object *object, size_t position)
 {
-    size_t i;
-    for (i = 0; i < object->count; i++) {
-        parson_free(object->names[i]);
-        json_value_free(object->values[i]);
+    size_t mask = object->index_capacity - 1;
+    size_t i = json_object_name_hash(object, position) & mask;
+    while (object->index[i] != 0) {
+        i = (i + 1) & mask;
     }
-    parson_free(object->names);
-    parson_free(object->values);
-    parson_free(object);
+    object->index[i] = position + 1;
 }
 
-/* JSON Array */
-static JSON_Array *json_array_init(JSON_Value *wrapping_value)
+/* Removes the slot pointing at position, shifting back the rest of its probe run so that
+ * lookups never stop early at the freed slot. */
+static void json_object_index_remove(JSON_Object *object, size_t position)
 {
-    JSON_Array *new_array = (JSON_Array *)parson_malloc(sizeof(JSON_Array));
-    if (new_array == NULL) {
-        return NULL;
+    size_t mask = object->index_capacity - 1;
+    size_t hole = json_object_name_hash(object, position) & mask;
+    size_t i, home;
+    while (object->index[hole] != position + 1) {
+        hole = (hole + 1) & mask;
+    }
+    object->index[hole] = 0;
+    for (i = (hole + 1) & mask; object->index[i] != 0; i = (i + 1) & mask) {
+        home = json_object_name_hash(object, object->index[i] - 1) & mask;
+        /* move entry into the hole unless its home slot lies cyclically in (hole, i] */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            object->index[hole] = object->index[i];
+            object->index[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
+                                               int free_value)
+{
+    size_t i = 0, last_item_index = 0;
+    if (object == NULL || name == NULL ||
+        json_value_unshare(json_object_get_wrapping_value(object)) == JSONFailure) {
+        return JSONFailure;
+    }
+    i = json_object_find(object, name, strlen(name));
+    if (i == json_object_get_count(object)) {
+        return JSONFailure;
+    }
+    last_item_index = json_object_get_count(object) - 1;
+    if (object->index != NULL) {
+        json_object_index_remove(object, i);
+        if (i != last_item_index) {
+            json_object_index_remove(object, last_item_index);
+        }
+    }
+    json_object_free_name(object, object->names[i]);
+    if (free_value) {
+        json_value_free(object->values[i]);
+    }
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+        if (object->index != NULL) {
+            json_object_index_insert(object, i);
+        }
+    }
+    object->count -= 1;
+    return JSONSuccess;
+}
+
+static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
+                                                  int free_value)
+{
+    JSON_Value *temp_value = NULL;
+    JSON_Object *temp_object = NULL;
+    const char *dot_pos = strchr(name, '.');
+    if (dot_pos == NULL) {
+        return json_object_remove_internal(object, name, free_value);
     }
-    new_array->wrapping_value = wrapping_value;
-    new_array->items = (JSON_Value **)NULL;
-    new_array->capacity = 0;
-    new_array->count = 0;
-    return new_array;
+    temp_value = json_object_getn_value(object, name, (size_t)(dot_pos - name));
+    if (json_value_get_type(temp_value) != JSONObject) {
+        return JSONFailure;
+    }
+    temp_object = json_value_get_object(temp_value);
+    return json_object_dotremove_internal(temp_object, dot_pos + 1, free_value);
+}
+
+/* Frees a name object owns: its own copy, or its reference to a pooled key */
+static void json_object_free_name(const JSON_Object *object, char *name)
+{
+    if (object->interned) {
+        json_key_release(name);
+    } else {
+        parson_free(name);
+    }
+}
+
+/* Frees the members of object and what it allocated for them, but not object itself */
+static void json_object_free_contents(JSON_Object *object)
+{
+    size_t i;
+    for (i = 0; i < object->count; i++) {
+        json_object_free_name(object, object->names[i]);
+        json_value_free(object->values[i]);
+    }
+    parson_free(object->names);
+    parson_free(object->index);
+}
+
+/* JSON Array */
+static void json_array_init(JSON_Array *array, JSON_Value *wrapping_value)
+{
+    array->wrapping_value = wrapping_value;
+    array->items = (JSON_Value **)NULL;
+    array->capacity = 0;
+    array->count = 0;
+    array->in_arena = parson_arena != NULL;
+    array->copies = NULL;
 }
 
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value)
 {
     if (array->count >= array->capacity) {
-        size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
+        size_t starting_capacity =
+            parson_arena == NULL ? STARTING_CAPACITY : ARENA_STARTING_CAPACITY;
+        size_t new_capacity = MAX(array->capacity * 2, starting_capacity);
         if (json_array_resize(array, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
@@ -519,14 +1951,14 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
     return JSONSuccess;
 }
 
-static void json_array_free(JSON_Array *array)
+/* Frees the items of array and what it allocated for them, but not array itself */
+static void json_array_free_contents(JSON_Array *array)
 {
     size_t i;
     for (i = 0; i < array->count; i++) {
         json_value_free(array->items[i]);
     }
     parson_free(array->items);
-    parson_free(array);
 }
 
 /* JSON Value */
@@ -538,707 +1970,2829 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
     }
     new_value->parent = NULL;
     new_value->type = JSONString;
+    new_value->is_inline = 0;
+    new_value->is_lazy = 0;
     new_value->value.string = string;
     return new_value;
 }
 
-/* Parser */
-static JSON_Status skip_quotes(const char **string)
+/* Allocates a string value with room for len bytes and a NUL terminator right after it, for
+   the caller to fill in */
+static JSON_Value *json_value_init_string_inline(size_t len)
 {
-    if (**string != '\"') {
-        return JSONFailure;
+    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value) + len + 1);
+    if (!new_value) {
+        return NULL;
     }
-    SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
-            return JSONFailure;
-        } else if (**string == '\\') {
-            SKIP_CHAR(string);
-            if (**string == '\0') {
-                return JSONFailure;
-            }
-        }
-        SKIP_CHAR(string);
+    new_value->parent = NULL;
+    new_value->type = JSONString;
+    new_value->is_inline = 1;
+    new_value->is_lazy = 0;
+    new_value->value.string = (char *)(new_value + 1);
+    return new_value;
+}
+
+static JSON_Value *json_value_init_string_copy(const char *string, size_t len)
+{
+    JSON_Value *new_value = json_value_init_string_inline(len);
+    if (!new_value) {
+        return NULL;
     }
-    SKIP_CHAR(string);
-    return JSONSuccess;
+    memcpy(new_value->value.string, string, len);
+    new_value->value.string[len] = '\0';
+    return new_value;
 }
 
-static int parse_utf16(const char **unprocessed, char **processed)
+/* Frees what value holds, leaving value itself */
+static void json_value_free_contents(JSON_Value *value)
 {
-    unsigned int cp, lead, trail;
-    int parse_succeeded = 0;
-    char *processed_ptr = *processed;
-    const char *unprocessed_ptr = *unprocessed;
-    unprocessed_ptr++; /* skips u */
-    parse_succeeded = parse_utf16_hex(unprocessed_ptr, &cp);
-    if (!parse_succeeded) {
-        return JSONFailure;
+    JSON_Lazy_Text *text = NULL;
+    JSON_Value **copies = NULL;
+    if (value != NULL && value->is_lazy) { /* nothing parsed or copied to free */
+        text = ((JSON_Lazy_Value *)value)->text;
+        if (text == NULL) {
+            json_value_drop_copy(value);
+        } else if (--text->refs == 0) {
+            parson_free(text);
+        }
+        return;
     }
-    if (cp < 0x80) {
-        processed_ptr[0] = (char)cp; /* 0xxxxxxx */
-    } else if (cp < 0x800) {
-        processed_ptr[0] = (char)(((cp >> 6) & 0x1F) | 0xC0); /* 110xxxxx */
-        processed_ptr[1] = (char)(((cp)&0x3F) | 0x80);        /* 10xxxxxx */
-        processed_ptr += 1;
-    } else if (cp < 0xD800 || cp > 0xDFFF) {
-        processed_ptr[0] = (char)(((cp >> 12) & 0x0F) | 0xE0); /* 1110xxxx */
-        processed_ptr[1] = (char)(((cp >> 6) & 0x3F) | 0x80);  /* 10xxxxxx */
-        processed_ptr[2] = (char)(((cp)&0x3F) | 0x80);         /* 10xxxxxx */
-        processed_ptr += 2;
-    } else if (cp >= 0xD800 && cp <= 0xDBFF) { /* lead surrogate (0xD800..0xDBFF) */
-        lead = cp;
-        unprocessed_ptr +=
-            4; /* should always be within the buffer, otherwise previous sscanf would fail */
-        if (*unprocessed_ptr++ != '\\' || *unprocessed_ptr++ != 'u') {
-            return JSONFailure;
+    copies = lazy_copy_count > 0 ? json_value_get_copies(value) : NULL;
+    if (copies != NULL && *copies != NULL) {
+        json_value_hand_over(value);
+    }
+    switch (json_value_get_type(value)) {
+    case JSONObject:
+        json_object_free_contents(value->value.object);
+        if (!value->is_inline) {
+            parson_free(value->value.object);
         }
-        parse_succeeded = parse_utf16_hex(unprocessed_ptr, &trail);
-        if (!parse_succeeded || trail < 0xDC00 ||
-            trail > 0xDFFF) { /* valid trail surrogate? (0xDC00..0xDFFF) */
-            return JSONFailure;
+        break;
+    case JSONString:
+        if (!value->is_inline) {
+            parson_free(value->value.string);
         }
-        cp = ((((lead - 0xD800) & 0x3FF) << 10) | ((trail - 0xDC00) & 0x3FF)) + 0x010000;
-        processed_ptr[0] = (char)((((cp >> 18) & 0x07) | 0xF0)); /* 11110xxx */
-        processed_ptr[1] = (char)((((cp >> 12) & 0x3F) | 0x80)); /* 10xxxxxx */
-        processed_ptr[2] = (char)((((cp >> 6) & 0x3F) | 0x80));  /* 10xxxxxx */
-        processed_ptr[3] = (char)((((cp)&0x3F) | 0x80));         /* 10xxxxxx */
-        processed_ptr += 3;
-    } else { /* trail surrogate before lead surrogate */
-        return JSONFailure;
+        break;
+    case JSONArray:
+        json_array_free_contents(value->value.array);
+        if (!value->is_inline) {
+            parson_free(value->value.array);
+        }
+        break;
+    default:
+        break;
     }
-    unprocessed_ptr += 3;
-    *processed = processed_ptr;
-    *unprocessed = unprocessed_ptr;
-    return JSONSuccess;
 }
 
-/* Copies and processes passed string up to supplied length.
-Example: "\u006Corem ipsum" -> lorem ipsum */
-static char *process_string(const char *input, size_t len)
+/* Counts a reference to text, given back when the container is parsed or freed. Without text
+   it's a lazy copy, for json_value_init_copy to fill in. */
+static JSON_Value *json_value_init_lazy(JSON_Value_Type type, JSON_Lazy_Text *text,
+                                       const char *start, const char *end)
 {
-    const char *input_ptr = input;
-    size_t initial_size = (len + 1) * sizeof(char);
-    size_t final_size = 0;
-    char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
-    if (output == NULL) {
-        goto error;
+    JSON_Lazy_Value *new_value = (JSON_Lazy_Value *)parson_malloc(sizeof(JSON_Lazy_Value));
+    if (!new_value) {
+        return NULL;
     }
-    output_ptr = output;
-    while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
-        if (*input_ptr == '\\') {
-            input_ptr++;
-            switch (*input_ptr) {
-            case '\"':
-                *output_ptr = '\"';
-                break;
-            case '\\':
-                *output_ptr = '\\';
-                break;
-            case '/':
-                *output_ptr = '/';
-                break;
-            case 'b':
-                *output_ptr = '\b';
-                break;
-            case 'f':
-                *output_ptr = '\f';
-                break;
-            case 'n':
-                *output_ptr = '\n';
-                break;
-            case 'r':
-                *output_ptr = '\r';
-                break;
-            case 't':
-                *output_ptr = '\t';
-                break;
-            case 'u':
-                if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure) {
-                    goto error;
-                }
-                break;
-            default:
-                goto error;
-            }
-        } else if ((unsigned char)*input_ptr < 0x20) {
-            goto error; /* 0x00-0x19 are invalid characters for json string
-                           (http://www.ietf.org/rfc/rfc4627.txt) */
+    new_value->value.parent = NULL;
+    new_value->value.type = type;
+    new_value->value.is_inline = 1;
+    new_value->value.is_lazy = 1;
+    if (type == JSONObject) {
+        new_value->value.value.object = &new_value->container.object;
+        json_object_init(&new_value->container.object, &new_value->value);
+    } else {
+        new_value->value.value.array = &new_value->container.array;
+        json_array_init(&new_value->container.array, &new_value->value);
+    }
+    new_value->text = text;
+    new_value->start = start;
+    new_value->end = end;
+    new_value->source = NULL;
+    new_value->next_copy = NULL;
+    if (text != NULL) {
+        text->refs++;
+    }
+    return &new_value->value;
+}
+
+/* Parses the members or items of a lazy container, its own containers staying lazy. A malformed
+   one fails and is left lazy, so it fails again each time it's accessed. */
+static JSON_Status json_value_parse_lazy(JSON_Value *value)
+{
+    JSON_Lazy_Value *lazy = (JSON_Lazy_Value *)value;
+    JSON_Parser parser;
+    value->is_lazy = 0;
+    parser.ptr = lazy->start + 1;
+    parser.end = lazy->end - 1; /* closing bracket */
+    parser.in_situ = 0;
+    if (*parser.end != (value->type == JSONObject ? '}' : ']') ||
+        parse_lazy_members(&parser, value, lazy->text) == JSONFailure) {
+        json_value_free_contents(value);
+        if (value->type == JSONObject) {
+            json_object_init(value->value.object, value);
         } else {
-            *output_ptr = *input_ptr;
+            json_array_init(value->value.array, value);
         }
-        output_ptr++;
-        input_ptr++;
+        value->is_lazy = 1; /* still holding its reference to the text */
+        return JSONFailure;
     }
-    *output_ptr = '\0';
-    /* resize to new length */
-    final_size = (size_t)(output_ptr - output) + 1;
-    /* todo: don't resize if final_size == initial_size */
-    resized_output = (char *)parson_malloc(final_size);
-    if (resized_output == NULL) {
-        goto error;
+    if (--lazy->text->refs == 0) {
+        parson_free(lazy->text);
     }
-    memcpy(resized_output, output, final_size);
-    parson_free(output);
-    return resized_output;
-error:
-    parson_free(output);
-    return NULL;
+    return JSONSuccess;
 }
 
-/* Return processed contents of a string between quotes and
-   skips passed argument to a matching quote. */
-static char *get_quoted_string(const char **string)
+/* Copy of a container that's only given its members, copies in turn, when it's first accessed.
+   Until then it's listed in source's copies, which json_value_unshare gives their members before
+   source or a container source is in is changed. Only containers that have their members are
+   sources, so copying a lazy copy makes another of what it's a copy of. */
+static JSON_Value *json_value_init_copy(const JSON_Value *source)
 {
-    const char *string_start = *string;
-    size_t string_len = 0;
-    JSON_Status status = skip_quotes(string);
-    if (status != JSONSuccess) {
+    const JSON_Lazy_Value *lazy = (const JSON_Lazy_Value *)source;
+    JSON_Lazy_Value *new_value = NULL;
+    JSON_Value **copies = NULL;
+    if (source->is_lazy && lazy->text != NULL) { /* parsing the same text again copies it */
+        return json_value_init_lazy((JSON_Value_Type)source->type, lazy->text, lazy->start,
+                                    lazy->end);
+    }
+    new_value = (JSON_Lazy_Value *)json_value_init_lazy((JSON_Value_Type)source->type, NULL, NULL,
+                                                        NULL);
+    if (new_value == NULL) {
         return NULL;
     }
-    string_len = (size_t)(*string - string_start - 2); /* length without quotes */
-    return process_string(string_start + 1, string_len);
+    new_value->source = (JSON_Value *)json_value_get_source(source);
+    copies = json_value_get_copies(new_value->source);
+    new_value->next_copy = *copies;
+    *copies = &new_value->value;
+    lazy_copy_count++;
+    return &new_value->value;
 }
 
-static JSON_Value *parse_value(const char **string, size_t nesting)
+/* Lazy copies of a container, NULL for other values */
+static JSON_Value **json_value_get_copies(const JSON_Value *value)
 {
-    if (nesting > MAX_NESTING) {
-        return NULL;
-    }
-    SKIP_WHITESPACES(string);
-    switch (**string) {
-    case '{':
-        return parse_object_value(string, nesting + 1);
-    case '[':
-        return parse_array_value(string, nesting + 1);
-    case '\"':
-        return parse_string_value(string);
-    case 'f':
-    case 't':
-        return parse_boolean_value(string);
-    case '-':
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-        return parse_number_value(string);
-    case 'n':
-        return parse_null_value(string);
+    switch (json_value_get_type(value)) {
+    case JSONObject:
+        return &value->value.object->copies;
+    case JSONArray:
+        return &value->value.array->copies;
     default:
         return NULL;
     }
 }
 
-static JSON_Value *parse_object_value(const char **string, size_t nesting)
+/* What value is a lazy copy of, or value itself: values with the same source are equal */
+static const JSON_Value *json_value_get_source(const JSON_Value *value)
 {
-    JSON_Value *output_value = NULL, *new_value = NULL;
-    JSON_Object *output_object = NULL;
-    char *new_key = NULL;
-    output_value = json_value_init_object();
-    if (output_value == NULL) {
-        return NULL;
-    }
-    if (**string != '{') {
-        json_value_free(output_value);
-        return NULL;
-    }
-    output_object = json_value_get_object(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
-        SKIP_CHAR(string);
-        return output_value;
-    }
-    while (**string != '\0') {
-        new_key = get_quoted_string(string);
-        if (new_key == NULL) {
-            json_value_free(output_value);
-            return NULL;
-        }
-        SKIP_WHITESPACES(string);
-        if (**string != ':') {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
-        }
-        SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
-        if (new_value == NULL) {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
-        }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure) {
-            parson_free(new_key);
-            json_value_free(new_value);
-            json_value_free(output_value);
-            return NULL;
-        }
-        parson_free(new_key);
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
-            break;
-        }
-        SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
-    }
-    SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
-        json_value_free(output_value);
-        return NULL;
+    if (value != NULL && value->is_lazy && ((const JSON_Lazy_Value *)value)->text == NULL) {
+        return ((const JSON_Lazy_Value *)value)->source;
     }
-    SKIP_CHAR(string);
-    return output_value;
+    return value;
 }
 
-static JSON_Value *parse_array_value(const char **string, size_t nesting)
+/* Gives a lazy container its members or items */
+static JSON_Status json_value_expand(JSON_Value *value)
 {
-    JSON_Value *output_value = NULL, *new_array_value = NULL;
-    JSON_Array *output_array = NULL;
-    output_value = json_value_init_array();
-    if (output_value == NULL) {
-        return NULL;
-    }
-    if (**string != '[') {
-        json_value_free(output_value);
-        return NULL;
+    if (((JSON_Lazy_Value *)value)->text != NULL) {
+        return json_value_parse_lazy(value);
     }
-    output_array = json_value_get_array(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
-        SKIP_CHAR(string);
-        return output_value;
-    }
-    while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
-        if (new_array_value == NULL) {
-            json_value_free(output_value);
-            return NULL;
+    return json_value_make_copy(value);
+}
+
+/* Gives a lazy copy copies of the members or items of its source, its own containers becoming
+   lazy copies of theirs. Left as it was if allocation fails. */
+static JSON_Status json_value_make_copy(JSON_Value *copy)
+{
+    const JSON_Value *source = ((JSON_Lazy_Value *)copy)->source;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    JSON_Value *member_copy = NULL;
+    size_t i = 0, count = 0;
+    if (source->type == JSONObject) {
+        object = source->value.object;
+        count = object->count;
+        if (count > 0 && json_object_resize(copy->value.object, count) == JSONFailure) {
+            return JSONFailure;
         }
-        if (json_array_add(output_array, new_array_value) == JSONFailure) {
-            json_value_free(new_array_value);
-            json_value_free(output_value);
-            return NULL;
+    } else {
+        array = source->value.array;
+        count = array->count;
+        if (count > 0 && json_array_resize(copy->value.array, count) == JSONFailure) {
+            return JSONFailure;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
-            break;
+    }
+    for (i = 0; i < count; i++) {
+        member_copy = json_value_deep_copy(object != NULL ? object->values[i] : array->items[i]);
+        if (member_copy == NULL ||
+            (object != NULL ? json_object_add(copy->value.object, object->names[i], member_copy)
+                            : json_array_add(copy->value.array, member_copy)) == JSONFailure) {
+            json_value_free(member_copy);
+            goto fail;
         }
-        SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
     }
-    SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
-        json_value_free(output_value);
-        return NULL;
+    json_value_drop_copy(copy);
+    copy->is_lazy = 0;
+    return JSONSuccess;
+fail:
+    if (object != NULL) {
+        json_object_free_contents(copy->value.object);
+        json_object_init(copy->value.object, copy);
+    } else {
+        json_array_free_contents(copy->value.array);
+        json_array_init(copy->value.array, copy);
     }
-    SKIP_CHAR(string);
-    return output_value;
+    return JSONFailure;
 }
 
-static JSON_Value *parse_string_value(const char **string)
+/* Takes a lazy copy off its source's list */
+static void json_value_drop_copy(JSON_Value *copy)
 {
-    JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
-    if (new_string == NULL) {
-        return NULL;
-    }
-    value = json_value_init_string_no_copy(new_string);
-    if (value == NULL) {
-        parson_free(new_string);
-        return NULL;
+    JSON_Lazy_Value *lazy = (JSON_Lazy_Value *)copy;
+    JSON_Value **link = json_value_get_copies(lazy->source);
+    while (*link != copy) {
+        link = &((JSON_Lazy_Value *)*link)->next_copy;
     }
-    return value;
+    *link = lazy->next_copy;
+    lazy_copy_count--;
 }
 
-static JSON_Value *parse_boolean_value(const char **string)
+/* Makes the lazy copies of from copies of to, which has from's contents now */
+static void json_value_move_copies(JSON_Value *from, JSON_Value *to)
 {
-    size_t true_token_size = SIZEOF_TOKEN("true");
-    size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
-        *string += true_token_size;
-        return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
-        *string += false_token_size;
+    JSON_Value **from_copies = json_value_get_copies(from);
+    JSON_Value **to_copies = json_value_get_copies(to);
+    JSON_Lazy_Value *copy = NULL;
+    while (*from_copies != NULL) {
+        copy = (JSON_Lazy_Value *)*from_copies;
+        *from_copies = copy->next_copy;
+        copy->source = to;
+        copy->next_copy = *to_copies;
+        *to_copies = &copy->value;
+    }
+}
+
+/* Called before a container that has lazy copies is freed or given other contents: rather than
+   copying its members, hands them over to one of the copies, which the others become copies of.
+   A copy is never inside what it's a copy of, as putting it there changes that first. */
+static void json_value_hand_over(JSON_Value *value)
+{
+    JSON_Value *heir = *json_value_get_copies(value);
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    size_t i = 0;
+    json_value_drop_copy(heir);
+    heir->is_lazy = 0;
+    if (value->type == JSONObject) {
+        object = heir->value.object;
+        *object = *value->value.object;
+        object->wrapping_value = heir;
+        object->copies = NULL;
+        for (i = 0; i < object->count; i++) {
+            object->values[i]->parent = heir;
+        }
+        value->value.object->count = 0;
+        value->value.object->names = NULL;
+        value->value.object->index = NULL;
+    } else {
+        array = heir->value.array;
+        *array = *value->value.array;
+        array->wrapping_value = heir;
+        array->copies = NULL;
+        for (i = 0; i < array->count; i++) {
+            array->items[i]->parent = heir;
+        }
+        value->value.array->count = 0;
+        value->value.array->items = NULL;
+    }
+    json_value_move_copies(value, heir);
+}
+
+/* Called before a value is changed: gives the lazy copies of it, and of the containers it's
+   in, their members, from the outermost one down, so that none is left referring to it. A copy
+   is never inside what it's a copy of, so the copies each round makes are all further down. */
+static JSON_Status json_value_unshare(JSON_Value *value)
+{
+    JSON_Value *container = NULL, *outermost = NULL;
+    JSON_Value **copies = NULL;
+    while (lazy_copy_count > 0) {
+        outermost = NULL;
+        for (container = value; container != NULL; container = container->parent) {
+            copies = json_value_get_copies(container);
+            if (copies != NULL && *copies != NULL) {
+                outermost = container;
+            }
+        }
+        if (outermost == NULL) {
+            break;
+        }
+        copies = json_value_get_copies(outermost);
+        while (*copies != NULL) {
+            if (json_value_make_copy(*copies) == JSONFailure) {
+                return JSONFailure;
+            }
+        }
+    }
+    return JSONSuccess;
+}
+
+/* Paths */
+static JSON_Path *json_path_create(const char *path, char separator, int is_pointer)
+{
+    JSON_Path *compiled = NULL;
+    JSON_Path_Segment *segment = NULL;
+    const char *ptr = NULL;
+    char *name = NULL;
+    size_t i = 0, count = 0;
+    if (path == NULL) {
+        return NULL;
+    }
+    if (is_pointer && *path != '\0' && *path != '/') {
+        return NULL;
+    }
+    if (!is_pointer || *path == '/') { /* the empty pointer has no names at all */
+        path += is_pointer;
+        for (count = 1, ptr = path; *ptr != '\0'; ptr++) {
+            count += *ptr == separator;
+        }
+    }
+    /* separators become terminators and escapes only shrink, so the path's length will do */
+    compiled = (JSON_Path *)parson_malloc(sizeof(JSON_Path) + count * sizeof(JSON_Path_Segment) +
+                                          strlen(path) + 1);
+    if (compiled == NULL) {
+        return NULL;
+    }
+    compiled->count = count;
+    compiled->segments = (JSON_Path_Segment *)(compiled + 1);
+    name = (char *)(compiled->segments + count);
+    for (i = 0; i < count; i++) {
+        segment = &compiled->segments[i];
+        segment->name = name;
+        for (; *path != '\0' && *path != separator; path++) {
+            if (is_pointer && *path == '~') { /* "~0" is '~' and "~1" is '/' */
+                if (path[1] != '0' && path[1] != '1') {
+                    parson_free(compiled);
+                    return NULL;
+                }
+                *name++ = path[1] == '0' ? '~' : '/';
+                path++;
+            } else {
+                *name++ = *path;
+            }
+        }
+        segment->name_len = (size_t)(name - segment->name);
+        *name++ = '\0';
+        segment->hash = hash_string(segment->name, segment->name_len);
+        segment->index = is_pointer ? json_path_parse_index(segment->name, segment->name_len)
+                                    : PATH_NO_INDEX;
+        if (*path != '\0') {
+            path++;
+        }
+    }
+    return compiled;
+}
+
+/* Array index spelled by a JSON Pointer name: digits without leading zeros */
+static size_t json_path_parse_index(const char *name, size_t name_len)
+{
+    size_t i = 0, index = 0;
+    if (name_len == 0 || (name[0] == '0' && name_len > 1)) {
+        return PATH_NO_INDEX;
+    }
+    for (i = 0; i < name_len; i++) {
+        if (!IS_DIGIT(name[i]) || index > (PATH_NO_INDEX - 10) / 10) {
+            return PATH_NO_INDEX;
+        }
+        index = index * 10 + (size_t)(name[i] - '0');
+    }
+    return index;
+}
+
+/* Merge patches */
+static JSON_Status json_object_diff(const JSON_Object *from, const JSON_Object *to,
+                                    JSON_Object *patch)
+{
+    size_t i = 0;
+    const char *name = NULL;
+    JSON_Value *from_value = NULL, *to_value = NULL, *member_patch = NULL;
+    for (i = 0; i < json_object_get_count(from); i++) {
+        name = json_object_get_name(from, i);
+        if (json_object_get_value(to, name) == NULL) { /* removed */
+            member_patch = json_value_init_null();
+            if (json_object_add(patch, name, member_patch) == JSONFailure) {
+                json_value_free(member_patch);
+                return JSONFailure;
+            }
+        }
+    }
+    for (i = 0; i < json_object_get_count(to); i++) {
+        name = json_object_get_name(to, i);
+        to_value = json_object_get_value_at(to, i);
+        from_value = json_object_get_value(from, name);
+        if (json_value_get_source(from_value) == json_value_get_source(to_value)) {
+            continue; /* a lazy copy of the other, or both of the same */
+        }
+        if (json_value_get_type(from_value) == JSONObject &&
+            json_value_get_type(to_value) == JSONObject) {
+            member_patch = json_value_init_object();
+            if (member_patch == NULL ||
+                json_object_diff(json_value_get_object(from_value), json_value_get_object(to_value),
+                                 json_value_get_object(member_patch)) == JSONFailure) {
+                json_value_free(member_patch);
+                return JSONFailure;
+            }
+            if (json_object_get_count(json_value_get_object(member_patch)) == 0) {
+                json_value_free(member_patch);
+                continue;
+            }
+        } else if (from_value == NULL || !json_value_equals(from_value, to_value)) {
+            member_patch = json_value_deep_copy(to_value);
+        } else {
+            continue;
+        }
+        if (json_object_add(patch, name, member_patch) == JSONFailure) {
+            json_value_free(member_patch);
+            return JSONFailure;
+        }
+    }
+    return JSONSuccess;
+}
+
+static JSON_Status json_object_apply_merge_patch(JSON_Object *target, const JSON_Object *patch)
+{
+    size_t i = 0;
+    const char *name = NULL;
+    JSON_Value *patch_value = NULL, *target_value = NULL;
+    for (i = 0; i < json_object_get_count(patch); i++) {
+        name = json_object_get_name(patch, i);
+        patch_value = json_object_get_value_at(patch, i);
+        switch (json_value_get_type(patch_value)) {
+        case JSONNull:
+            json_object_remove(target, name); /* fails harmlessly if there's no such member */
+            break;
+        case JSONObject:
+            target_value = json_object_get_value(target, name);
+            if (json_value_get_type(target_value) != JSONObject) {
+                target_value = json_value_init_object();
+                if (json_object_set_value(target, name, target_value) == JSONFailure) {
+                    json_value_free(target_value);
+                    return JSONFailure;
+                }
+            }
+            if (json_object_apply_merge_patch(json_value_get_object(target_value),
+                                              json_value_get_object(patch_value)) ==
+                JSONFailure) {
+                return JSONFailure;
+            }
+            break;
+        default:
+            target_value = json_value_deep_copy(patch_value);
+            if (json_object_set_value(target, name, target_value) == JSONFailure) {
+                json_value_free(target_value);
+                return JSONFailure;
+            }
+            break;
+        }
+    }
+    return JSONSuccess;
+}
+
+/* Gives target the contents of source and frees source; target keeps its place in its parent.
+   Contents in source's own allocation are moved to one of their own first. */
+static JSON_Status json_value_move_contents(JSON_Value *target, JSON_Value *source)
+{
+    JSON_Value_Value contents = source->value;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    JSON_Value **copies = NULL, *copy = NULL;
+    size_t i = 0;
+    if (json_value_unshare(target) == JSONFailure ||
+        (source->is_lazy && json_value_expand(source) == JSONFailure)) {
+        return JSONFailure;
+    }
+    if (source->is_inline) {
+        switch (source->type) {
+        case JSONObject:
+            contents.object = (JSON_Object *)parson_malloc(sizeof(JSON_Object));
+            if (contents.object == NULL) {
+                return JSONFailure;
+            }
+            *contents.object = *source->value.object;
+            break;
+        case JSONArray:
+            contents.array = (JSON_Array *)parson_malloc(sizeof(JSON_Array));
+            if (contents.array == NULL) {
+                return JSONFailure;
+            }
+            *contents.array = *source->value.array;
+            break;
+        case JSONString:
+            contents.string = parson_strdup(source->value.string);
+            if (contents.string == NULL) {
+                return JSONFailure;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    json_value_free_contents(target);
+    target->type = source->type;
+    target->is_inline = 0;
+    target->is_lazy = 0;
+    target->value = contents;
+    if (target->type == JSONObject) {
+        object = target->value.object;
+        object->wrapping_value = target;
+        for (i = 0; i < object->count; i++) {
+            object->values[i]->parent = target;
+        }
+    } else if (target->type == JSONArray) {
+        array = target->value.array;
+        array->wrapping_value = target;
+        for (i = 0; i < array->count; i++) {
+            array->items[i]->parent = target;
+        }
+    }
+    copies = json_value_get_copies(target);
+    for (copy = copies != NULL ? *copies : NULL; copy != NULL;
+         copy = ((JSON_Lazy_Value *)copy)->next_copy) {
+        ((JSON_Lazy_Value *)copy)->source = target;
+    }
+    source->type = JSONNull; /* target owns what source held */
+    json_value_free(source);
+    return JSONSuccess;
+}
+
+/* Arena */
+static JSON_Arena_Block *json_arena_add_block(JSON_Arena *arena, size_t min_size)
+{
+    JSON_Arena_Block *block = NULL;
+    size_t size = MAX(arena->block_size, min_size);
+    if (arena->block_size == 0) {
+        return NULL;
+    }
+    block = (JSON_Arena_Block *)arena->malloc_fun(ARENA_ALIGN(sizeof(JSON_Arena_Block)) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    arena->blocks = block;
+    return block;
+}
+
+static void *json_arena_alloc(JSON_Arena *arena, size_t size)
+{
+    JSON_Arena_Block *block = arena->blocks;
+    char *ptr = NULL;
+    size = ARENA_ALIGN(size);
+    if (block == NULL || block->size - block->used < size) {
+        block = json_arena_add_block(arena, size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    ptr = (char *)block + ARENA_ALIGN(sizeof(JSON_Arena_Block)) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/* Frees blocks added after last_kept (all blocks if it's NULL) */
+static void json_arena_free_blocks(JSON_Arena *arena, JSON_Arena_Block *last_kept)
+{
+    JSON_Arena_Block *block = NULL;
+    while (arena->blocks != NULL && arena->blocks != last_kept) {
+        block = arena->blocks;
+        arena->blocks = block->next;
+        arena->free_fun(block);
+    }
+}
+
+static void *arena_malloc(size_t size)
+{
+    return json_arena_alloc(parson_arena, size);
+}
+
+static void arena_free(void *ptr)
+{
+    (void)ptr; /* arena memory is only released as a whole */
+}
+
+/* Stats */
+#if defined(PARSON_STATS)
+static void *stats_malloc(size_t size)
+{
+    JSON_Stats_Header *header =
+        (JSON_Stats_Header *)stats_malloc_fun(sizeof(JSON_Stats_Header) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    parson_stats.allocations++;
+    parson_stats.bytes_live += size;
+    if (parson_stats.bytes_live > parson_stats.bytes_peak) {
+        parson_stats.bytes_peak = parson_stats.bytes_live;
+    }
+    return header + 1;
+}
+
+static void stats_free(void *ptr)
+{
+    JSON_Stats_Header *header = NULL;
+    if (ptr == NULL) {
+        return;
+    }
+    header = (JSON_Stats_Header *)ptr - 1;
+    parson_stats.frees++;
+    parson_stats.bytes_live -= header->size;
+    stats_free_fun(header);
+}
+#endif
+
+/* Seconds from some fixed point, 0 without PARSON_STATS */
+static double stats_now(void)
+{
+#if defined(PARSON_STATS) && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#elif defined(PARSON_STATS)
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    return 0.0;
+#endif
+}
+
+static void stats_count_parse(double started)
+{
+#if defined(PARSON_STATS)
+    parson_stats.parses++;
+    parson_stats.parse_seconds += stats_now() - started;
+#else
+    (void)started;
+#endif
+}
+
+static void stats_count_serialization(double started)
+{
+#if defined(PARSON_STATS)
+    parson_stats.serializations++;
+    parson_stats.serialize_seconds += stats_now() - started;
+#else
+    (void)started;
+#endif
+}
+
+/* Parser */
+static JSON_Status skip_quotes(JSON_Parser *parser)
+{
+    if (PEEK(parser) != '\"') {
+        return JSONFailure;
+    }
+    SKIP_CHAR(parser);
+    for (;;) {
+        parser->ptr = scan_string(parser->ptr, parser->end);
+        switch (PEEK(parser)) {
+        case '\"':
+            SKIP_CHAR(parser);
+            return JSONSuccess;
+        case '\0':
+            return JSONFailure;
+        case '\\':
+            SKIP_CHAR(parser);
+            if (PEEK(parser) == '\0') {
+                return JSONFailure;
+            }
+            break;
+        default: /* control character, rejected when the string is processed */
+            break;
+        }
+        SKIP_CHAR(parser);
+    }
+}
+
+static int parse_utf16(const char **unprocessed, char **processed, const char *unprocessed_end)
+{
+    unsigned int cp, lead, trail;
+    int parse_succeeded = 0;
+    char *processed_ptr = *processed;
+    const char *unprocessed_ptr = *unprocessed;
+    unprocessed_ptr++; /* skips u */
+    if (unprocessed_end - unprocessed_ptr < 4) {
+        return JSONFailure;
+    }
+    parse_succeeded = parse_utf16_hex(unprocessed_ptr, &cp);
+    if (!parse_succeeded) {
+        return JSONFailure;
+    }
+    if (cp < 0x80) {
+        processed_ptr[0] = (char)cp; /* 0xxxxxxx */
+    } else if (cp < 0x800) {
+        processed_ptr[0] = (char)(((cp >> 6) & 0x1F) | 0xC0); /* 110xxxxx */
+        processed_ptr[1] = (char)(((cp)&0x3F) | 0x80);        /* 10xxxxxx */
+        processed_ptr += 1;
+    } else if (cp < 0xD800 || cp > 0xDFFF) {
+        processed_ptr[0] = (char)(((cp >> 12) & 0x0F) | 0xE0); /* 1110xxxx */
+        processed_ptr[1] = (char)(((cp >> 6) & 0x3F) | 0x80);  /* 10xxxxxx */
+        processed_ptr[2] = (char)(((cp)&0x3F) | 0x80);         /* 10xxxxxx */
+        processed_ptr += 2;
+    } else if (cp >= 0xD800 && cp <= 0xDBFF) { /* lead surrogate (0xD800..0xDBFF) */
+        lead = cp;
+        unprocessed_ptr += 4; /* within the buffer, checked above */
+        if (unprocessed_end - unprocessed_ptr < 6 || *unprocessed_ptr++ != '\\' ||
+            *unprocessed_ptr++ != 'u') {
+            return JSONFailure;
+        }
+        parse_succeeded = parse_utf16_hex(unprocessed_ptr, &trail);
+        if (!parse_succeeded || trail < 0xDC00 ||
+            trail > 0xDFFF) { /* valid trail surrogate? (0xDC00..0xDFFF) */
+            return JSONFailure;
+        }
+        cp = ((((lead - 0xD800) & 0x3FF) << 10) | ((trail - 0xDC00) & 0x3FF)) + 0x010000;
+        processed_ptr[0] = (char)((((cp >> 18) & 0x07) | 0xF0)); /* 11110xxx */
+        processed_ptr[1] = (char)((((cp >> 12) & 0x3F) | 0x80)); /* 10xxxxxx */
+        processed_ptr[2] = (char)((((cp >> 6) & 0x3F) | 0x80));  /* 10xxxxxx */
+        processed_ptr[3] = (char)((((cp)&0x3F) | 0x80));         /* 10xxxxxx */
+        processed_ptr += 3;
+    } else { /* trail surrogate before lead surrogate */
+        return JSONFailure;
+    }
+    unprocessed_ptr += 3;
+    *processed = processed_ptr;
+    *unprocessed = unprocessed_ptr;
+    return JSONSuccess;
+}
+
+/* Unescapes len bytes of input into output, which must have room for len + 1 bytes, and
+   NUL terminates it. Returns the terminator's position, or NULL if input isn't a valid string. */
+static char *unescape_string(const char *input, size_t len, char *output)
+{
+    const char *input_ptr = input, *run_end = NULL;
+    const char *input_end = input + len;
+    char *output_ptr = output;
+    while (input_ptr < input_end) {
+        run_end = scan_string(input_ptr, input_end); /* copy characters needing no processing */
+        if (output_ptr != input_ptr) {
+            memmove(output_ptr, input_ptr, (size_t)(run_end - input_ptr));
+        }
+        output_ptr += run_end - input_ptr;
+        input_ptr = run_end;
+        if (input_ptr == input_end || *input_ptr == '\0') {
+            break;
+        }
+        if (*input_ptr == '\\') {
+            input_ptr++;
+            switch (*input_ptr) {
+            case '\"':
+                *output_ptr = '\"';
+                break;
+            case '\\':
+                *output_ptr = '\\';
+                break;
+            case '/':
+                *output_ptr = '/';
+                break;
+            case 'b':
+                *output_ptr = '\b';
+                break;
+            case 'f':
+                *output_ptr = '\f';
+                break;
+            case 'n':
+                *output_ptr = '\n';
+                break;
+            case 'r':
+                *output_ptr = '\r';
+                break;
+            case 't':
+                *output_ptr = '\t';
+                break;
+            case 'u':
+                if (parse_utf16(&input_ptr, &output_ptr, input_end) == JSONFailure) {
+                    return NULL;
+                }
+                break;
+            default:
+                return NULL;
+            }
+        } else if ((unsigned char)*input_ptr < 0x20) {
+            return NULL; /* 0x00-0x19 are invalid characters for json string
+                            (http://www.ietf.org/rfc/rfc4627.txt) */
+        } else {
+            *output_ptr = *input_ptr;
+        }
+        output_ptr++;
+        input_ptr++;
+    }
+    *output_ptr = '\0';
+    return output_ptr;
+}
+
+/* Checks len bytes of input as unescape_string does, passing the unescaped string to sink in
+   pieces instead of writing it out; sink may be NULL to only check it. */
+static JSON_Status walk_escaped_string(const char *input, size_t len, JSON_Sink_Function sink,
+                                       void *context)
+{
+    const char *input_ptr = input, *run_end = NULL;
+    const char *input_end = input + len;
+    char unescaped[4]; /* one escape's worth */
+    char *unescaped_end = NULL;
+    while (input_ptr < input_end) {
+        run_end = scan_string(input_ptr, input_end);
+        if (sink != NULL && run_end != input_ptr &&
+            sink(input_ptr, (size_t)(run_end - input_ptr), context) == JSONFailure) {
+            return JSONFailure;
+        }
+        input_ptr = run_end;
+        if (input_ptr == input_end || *input_ptr == '\0') {
+            break;
+        }
+        if (*input_ptr != '\\') {
+            return JSONFailure; /* control character */
+        }
+        input_ptr++;
+        unescaped_end = unescaped;
+        switch (*input_ptr) {
+        case '\"':
+        case '\\':
+        case '/':
+            *unescaped_end = *input_ptr;
+            break;
+        case 'b':
+            *unescaped_end = '\b';
+            break;
+        case 'f':
+            *unescaped_end = '\f';
+            break;
+        case 'n':
+            *unescaped_end = '\n';
+            break;
+        case 'r':
+            *unescaped_end = '\r';
+            break;
+        case 't':
+            *unescaped_end = '\t';
+            break;
+        case 'u':
+            if (parse_utf16(&input_ptr, &unescaped_end, input_end) == JSONFailure) {
+                return JSONFailure;
+            }
+            break;
+        default:
+            return JSONFailure;
+        }
+        if (sink != NULL &&
+            sink(unescaped, (size_t)(unescaped_end - unescaped) + 1, context) == JSONFailure) {
+            return JSONFailure;
+        }
+        input_ptr++;
+    }
+    return JSONSuccess;
+}
+
+/* Copies and processes passed string up to supplied length.
+Example: "lorem ipsum" -> lorem ipsum
+In situ, the string is processed in place (unescaping never makes it longer) and returned. */
+static char *process_string(const char *input, size_t len, int in_situ)
+{
+    size_t initial_size = (len + 1) * sizeof(char);
+    size_t final_size = 0;
+    char *output = NULL, *output_end = NULL, *resized_output = NULL;
+    if (in_situ) {
+        return unescape_string(input, len, (char *)input) != NULL ? (char *)input : NULL;
+    }
+    output = (char *)parson_malloc(initial_size);
+    if (output == NULL) {
+        return NULL;
+    }
+    output_end = unescape_string(input, len, output);
+    if (output_end == NULL) {
+        parson_free(output);
+        return NULL;
+    }
+    /* resize to new length */
+    final_size = (size_t)(output_end - output) + 1;
+    if (final_size == initial_size) {
+        return output;
+    }
+    resized_output = (char *)parson_malloc(final_size);
+    if (resized_output == NULL) {
+        parson_free(output);
+        return NULL;
+    }
+    memcpy(resized_output, output, final_size);
+    parson_free(output);
+    return resized_output;
+}
+
+/* Return processed contents of a string between quotes and
+   skips passed argument to a matching quote. */
+static char *get_quoted_string(JSON_Parser *parser)
+{
+    const char *string_start = parser->ptr;
+    size_t string_len = 0;
+    JSON_Status status = skip_quotes(parser);
+    if (status != JSONSuccess) {
+        return NULL;
+    }
+    string_len = (size_t)(parser->ptr - string_start - 2); /* length without quotes */
+    return process_string(string_start + 1, string_len, parser->in_situ);
+}
+
+/* Like get_quoted_string, for a member name of object. Interned objects get a reference to the
+   pooled name, which is only copied first if it has escapes. */
+static char *get_object_name(JSON_Parser *parser, const JSON_Object *object)
+{
+    const char *string_start = parser->ptr + 1;
+    const char *name = NULL;
+    char *unescaped = NULL;
+    size_t len = 0;
+    if (!object->interned) {
+        return get_quoted_string(parser);
+    }
+    if (skip_quotes(parser) != JSONSuccess) {
+        return NULL;
+    }
+    len = (size_t)(parser->ptr - string_start - 1); /* length without quotes */
+    if (scan_string(string_start, string_start + len) == string_start + len) { /* no escapes */
+        return (char *)json_key_intern(string_start, len, hash_string(string_start, len));
+    }
+    unescaped = process_string(string_start, len, 0);
+    if (unescaped == NULL) {
+        return NULL;
+    }
+    len = strlen(unescaped);
+    name = json_key_intern(unescaped, len, hash_string(unescaped, len));
+    parson_free(unescaped);
+    return (char *)name;
+}
+
+static JSON_Value *parse_scalar_value(JSON_Parser *parser)
+{
+    switch (PEEK(parser)) {
+    case '\"':
+        return parse_string_value(parser);
+    case 'f':
+    case 't':
+        return parse_boolean_value(parser);
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        return parse_number_value(parser);
+    case 'n':
+        return parse_null_value(parser);
+    default:
+        return NULL;
+    }
+}
+
+/* Iterative, so that stack use doesn't grow with nesting: the containers being parsed are linked
+   through their parent pointers, and each value is added to its container as soon as it's parsed.
+   Like the nesting check before, a value more than MAX_NESTING containers deep fails. */
+static JSON_Value *parse_value(JSON_Parser *parser)
+{
+    JSON_Value *root = NULL, *container = NULL, *value = NULL;
+    char *name = NULL; /* of the member being parsed, until it's added */
+    size_t depth = 0;  /* of the value being parsed */
+    char c = '\0';
+    for (;;) {
+        if (depth > MAX_NESTING) {
+            goto fail;
+        }
+        SKIP_WHITESPACES(parser);
+        c = PEEK(parser);
+        switch (c) {
+        case '{':
+            value = json_value_init_object();
+            break;
+        case '[':
+            value = json_value_init_array();
+            break;
+        default:
+            value = parse_scalar_value(parser);
+            break;
+        }
+        if (value == NULL) {
+            goto fail;
+        }
+        if (container == NULL) {
+            root = value;
+        } else if ((name != NULL ? json_object_add_no_copy(json_value_get_object(container),
+                                                           name, value)
+                                 : json_array_add(json_value_get_array(container), value)) ==
+                   JSONFailure) {
+            json_value_free(value);
+            goto fail;
+        }
+        name = NULL;
+        if (c == '{' || c == '[') {
+            SKIP_CHAR(parser);
+            SKIP_WHITESPACES(parser);
+            if (PEEK(parser) != (c == '{' ? '}' : ']')) { /* descend to the first member or item */
+                container = value;
+                depth++;
+                if (c == '{') {
+                    name = parse_member_name(parser, json_value_get_object(container));
+                    if (name == NULL) {
+                        goto fail;
+                    }
+                }
+                continue;
+            }
+            SKIP_CHAR(parser); /* empty */
+        }
+        /* value is complete: go on to the next member or item, closing containers that end */
+        for (;;) {
+            if (container == NULL) {
+                return root;
+            }
+            SKIP_WHITESPACES(parser);
+            c = PEEK(parser);
+            if (c == ',') {
+                SKIP_CHAR(parser);
+                if (json_value_get_type(container) == JSONObject) {
+                    SKIP_WHITESPACES(parser);
+                    name = parse_member_name(parser, json_value_get_object(container));
+                    if (name == NULL) {
+                        goto fail;
+                    }
+                }
+                break;
+            }
+            if (c != (json_value_get_type(container) == JSONObject ? '}' : ']') ||
+                parse_end_container(container) == JSONFailure) {
+                goto fail;
+            }
+            SKIP_CHAR(parser);
+            container = container->parent;
+            depth--;
+        }
+    }
+fail:
+    if (name != NULL) {
+        json_object_free_name(json_value_get_object(container), name);
+    }
+    json_value_free(root);
+    return NULL;
+}
+
+/* Parses a member name and the colon after it */
+static char *parse_member_name(JSON_Parser *parser, JSON_Object *object)
+{
+    char *name = get_object_name(parser, object);
+    if (name == NULL) {
+        return NULL;
+    }
+    SKIP_WHITESPACES(parser);
+    if (PEEK(parser) != ':') {
+        json_object_free_name(object, name);
+        return NULL;
+    }
+    SKIP_CHAR(parser);
+    return name;
+}
+
+/* Called once the last member or item of a non-empty container is parsed */
+static JSON_Status parse_end_container(JSON_Value *container)
+{
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    if (json_value_get_type(container) == JSONArray) {
+        array = json_value_get_array(container);
+        if (parson_arena == NULL) { /* Trim array after parsing is over */
+            return json_array_resize(array, json_array_get_count(array));
+        }
+        return JSONSuccess;
+    }
+    object = json_value_get_object(container);
+    if (parson_arena == NULL) { /* Trim object after parsing is over */
+        return json_object_resize(object, json_object_get_count(object));
+    }
+    if (object->index == NULL && PARSON_OBJECT_INDEX_THRESHOLD > 0 &&
+        object->count >= PARSON_OBJECT_INDEX_THRESHOLD) {
+        /* arena documents are read only, so build the index now rather than on the heap later */
+        return json_object_index_build(object);
+    }
+    return JSONSuccess;
+}
+
+/* Whether the container that opened before ptr closes straight away */
+static int is_empty_container(const char *ptr, const char *end)
+{
+    ptr = skip_whitespaces(ptr, end);
+    return ptr < end && (*ptr | 0x20) == '}';
+}
+
+/* Returns one past the bracket closing the container opening at ptr, or NULL if it isn't closed
+   or has values nested more than MAX_NESTING deep, counting as parse_value does: the container at
+   ptr is at depth 0, so one MAX_NESTING deep has to be empty. Only strings and brackets are
+   looked at, and brackets aren't checked to pair up, that's left to parsing. */
+static const char *skip_container(const char *ptr, const char *end)
+{
+    size_t depth = 0;
+    int in_string = 0, escaped = 0;
+    char c = '\0';
+#if defined(PARSON_SIMD_SSE2) || defined(PARSON_SIMD_NEON)
+    const uint64_t byte_bits = ((uint64_t)1 << SIMD_MASK_BITS) - 1;
+    uint64_t mask = 0, first = 0;
+    int index = 0;
+    /* Visit only the bytes that matter in each block, in order */
+    for (; end - ptr >= SIMD_BLOCK_SIZE; ptr += SIMD_BLOCK_SIZE) {
+        mask = simd_structural_mask(ptr);
+        if (escaped) {
+            mask &= ~byte_bits;
+            escaped = 0;
+        }
+        while (mask != 0) {
+            index = simd_mask_first(mask);
+            first = byte_bits << (index * SIMD_MASK_BITS);
+            mask &= ~first;
+            c = ptr[index];
+            if (in_string) {
+                if (c == '\"') {
+                    in_string = 0;
+                } else if (c == '\\') { /* skip what's escaped */
+                    if (index == SIMD_BLOCK_SIZE - 1) {
+                        escaped = 1;
+                    } else {
+                        mask &= ~(first << SIMD_MASK_BITS);
+                    }
+                }
+            } else if (c == '\"') {
+                in_string = 1;
+            } else if ((c | 0x20) == '{') {
+                if (++depth > MAX_NESTING && !is_empty_container(ptr + index + 1, end)) {
+                    return NULL;
+                }
+            } else if ((c | 0x20) == '}' && --depth == 0) {
+                return ptr + index + 1;
+            }
+        }
+    }
+#endif
+    for (; ptr < end; ptr++) {
+        c = *ptr;
+        if (escaped) {
+            escaped = 0;
+        } else if (in_string) {
+            if (c == '\"') {
+                in_string = 0;
+            } else if (c == '\\') {
+                escaped = 1;
+            }
+        } else if (c == '\"') {
+            in_string = 1;
+        } else if ((c | 0x20) == '{') {
+            if (++depth > MAX_NESTING && !is_empty_container(ptr + 1, end)) {
+                return NULL;
+            }
+        } else if ((c | 0x20) == '}' && --depth == 0) {
+            return ptr + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Parses the members or items of container up to parser->end, adding its own containers as lazy
+   values found by skip_container. */
+static JSON_Status parse_lazy_members(JSON_Parser *parser, JSON_Value *container,
+                                      JSON_Lazy_Text *text)
+{
+    JSON_Object *object = json_value_get_object(container);
+    JSON_Value *value = NULL;
+    const char *end = NULL;
+    char *name = NULL;
+    char c = '\0';
+    SKIP_WHITESPACES(parser);
+    if (parser->ptr == parser->end) { /* empty */
+        return JSONSuccess;
+    }
+    for (;;) {
+        if (object != NULL) {
+            name = parse_member_name(parser, object);
+            if (name == NULL) {
+                return JSONFailure;
+            }
+            SKIP_WHITESPACES(parser);
+        }
+        c = PEEK(parser);
+        if (c == '{' || c == '[') {
+            end = skip_container(parser->ptr, parser->end);
+            value = end == NULL ? NULL
+                                : json_value_init_lazy(c == '{' ? JSONObject : JSONArray, text,
+                                                       parser->ptr, end);
+            parser->ptr = end;
+        } else {
+            value = parse_scalar_value(parser);
+        }
+        if (value == NULL ||
+            (object != NULL ? json_object_add_no_copy(object, name, value)
+                            : json_array_add(json_value_get_array(container), value)) ==
+                JSONFailure) {
+            if (name != NULL) {
+                json_object_free_name(object, name);
+            }
+            json_value_free(value);
+            return JSONFailure;
+        }
+        SKIP_WHITESPACES(parser);
+        if (parser->ptr == parser->end) {
+            return parse_end_container(container);
+        }
+        if (PEEK(parser) != ',') {
+            return JSONFailure;
+        }
+        SKIP_CHAR(parser);
+        SKIP_WHITESPACES(parser);
+    }
+}
+
+static JSON_Value *parse_string_value(JSON_Parser *parser)
+{
+    JSON_Value *value = NULL;
+    const char *string_start = parser->ptr + 1;
+    char *new_string = NULL;
+    size_t string_len = 0;
+    if (parser->in_situ) {
+        new_string = get_quoted_string(parser);
+        if (new_string == NULL) {
+            return NULL;
+        }
+        return json_value_init_string_no_copy(new_string); /* arena values are never freed */
+    }
+    if (skip_quotes(parser) != JSONSuccess) {
+        return NULL;
+    }
+    /* unescaping never makes a string longer, so unescape straight into the value */
+    string_len = (size_t)(parser->ptr - string_start - 1);
+    value = json_value_init_string_inline(string_len);
+    if (value == NULL) {
+        return NULL;
+    }
+    if (unescape_string(string_start, string_len, value->value.string) == NULL) {
+        json_value_free(value);
+        return NULL;
+    }
+    return value;
+}
+
+static JSON_Value *parse_boolean_value(JSON_Parser *parser)
+{
+    if (skip_token(parser, "true", SIZEOF_TOKEN("true"))) {
+        return json_value_init_boolean(1);
+    } else if (skip_token(parser, "false", SIZEOF_TOKEN("false"))) {
         return json_value_init_boolean(0);
     }
-    return NULL;
+    return NULL;
+}
+
+static JSON_Value *parse_number_value(JSON_Parser *parser)
+{
+    double number = 0;
+    if (parse_number(parser, &number) == JSONFailure) {
+        return NULL;
+    }
+    return json_value_init_number(number);
+}
+
+static JSON_Value *parse_null_value(JSON_Parser *parser)
+{
+    if (skip_token(parser, "null", SIZEOF_TOKEN("null"))) {
+        return json_value_init_null();
+    }
+    return NULL;
+}
+
+/* Skips token and returns 1 if input continues with it, returns 0 otherwise */
+static int skip_token(JSON_Parser *parser, const char *token, size_t token_size)
+{
+    if (REMAINING(parser) >= token_size && strncmp(token, parser->ptr, token_size) == 0) {
+        parser->ptr += token_size;
+        return 1;
+    }
+    return 0;
+}
+
+static JSON_Status parse_number(JSON_Parser *parser, double *number)
+{
+    char num_buf[NUM_BUF_SIZE];
+    char *number_string = num_buf, *end = NULL;
+    size_t length = 0;
+#if !defined(PARSON_DISABLE_FAST_NUMBERS)
+    if (parse_number_fast(parser->ptr, REMAINING(parser), number, &length)) {
+        parser->ptr += length;
+        return JSONSuccess;
+    }
+#endif
+    /* input may not be NUL terminated, so give strtod a terminated copy of the token */
+    while (length < REMAINING(parser) && is_number_char(parser->ptr[length])) {
+        length++;
+    }
+    if (length >= NUM_BUF_SIZE) {
+        number_string = (char *)parson_malloc(length + 1);
+        if (number_string == NULL) {
+            return JSONFailure;
+        }
+    }
+    memcpy(number_string, parser->ptr, length);
+    number_string[length] = '\0';
+    errno = 0;
+    *number = strtod(number_string, &end);
+    length = (size_t)(end - number_string);
+    if (number_string != num_buf) {
+        parson_free(number_string);
+    }
+    if (errno || length == 0 || !is_decimal(parser->ptr, length)) {
+        return JSONFailure;
+    }
+    parser->ptr += length;
+    return JSONSuccess;
+}
+
+static JSON_Value *parse_buffer(const char *buf, size_t buf_len, int in_situ)
+{
+    double started = stats_now();
+    JSON_Parser parser;
+    JSON_Value *value = NULL;
+    if (buf_len >= 3 && buf[0] == '\xEF' && buf[1] == '\xBB' && buf[2] == '\xBF') {
+        buf += 3; /* Support for UTF-8 BOM */
+        buf_len -= 3;
+    }
+    parser.ptr = buf;
+    parser.end = buf + buf_len;
+    parser.in_situ = in_situ;
+    value = parse_value(&parser);
+    stats_count_parse(started);
+    return value;
+}
+
+static JSON_Value *parse_buffer_arena(const char *buf, size_t buf_len, int in_situ,
+                                      JSON_Arena *arena)
+{
+    JSON_Malloc_Function saved_malloc = parson_malloc;
+    JSON_Free_Function saved_free = parson_free;
+    JSON_Arena_Block *saved_block = NULL;
+    size_t saved_used = 0;
+    JSON_Value *result = NULL;
+    if (arena == NULL || parson_arena != NULL) {
+        return NULL;
+    }
+    saved_block = arena->blocks;
+    saved_used = saved_block != NULL ? saved_block->used : 0;
+    parson_arena = arena;
+    parson_malloc = arena_malloc;
+    parson_free = arena_free;
+    result = parse_buffer(buf, buf_len, in_situ);
+    parson_malloc = saved_malloc;
+    parson_free = saved_free;
+    parson_arena = NULL;
+    if (result == NULL) { /* give back what the failed parse used */
+        json_arena_free_blocks(arena, saved_block);
+        if (saved_block != NULL) {
+            saved_block->used = saved_used;
+        }
+    }
+    return result;
+}
+
+/* Event parser */
+/* Skips the quoted string at parser and points *string at its contents: into the input if it
+   has no escapes, otherwise into buf, which holds PARSON_EVENT_BUFFER_SIZE bytes. Contents with
+   escapes that don't fit buf are checked and left escaped in the input, setting *escaped. */
+static JSON_Status get_event_string(JSON_Parser *parser, char *buf, const char **string,
+                                    size_t *string_len, int *escaped)
+{
+    const char *string_start = parser->ptr + 1;
+    char *output_end = NULL;
+    size_t len = 0;
+    if (skip_quotes(parser) == JSONFailure) {
+        return JSONFailure;
+    }
+    len = (size_t)(parser->ptr - string_start - 1); /* length without quotes */
+    *escaped = 0;
+    if (scan_string(string_start, string_start + len) == string_start + len) { /* no escapes */
+        *string = string_start;
+        *string_len = len;
+        return JSONSuccess;
+    }
+    if (len >= PARSON_EVENT_BUFFER_SIZE) {
+        if (walk_escaped_string(string_start, len, NULL, NULL) == JSONFailure) {
+            return JSONFailure;
+        }
+        *string = string_start;
+        *string_len = len;
+        *escaped = 1;
+        return JSONSuccess;
+    }
+    output_end = unescape_string(string_start, len, buf);
+    if (output_end == NULL) {
+        return JSONFailure;
+    }
+    *string = buf;
+    *string_len = (size_t)(output_end - buf);
+    return JSONSuccess;
+}
+
+/* Stream parser */
+/* Makes *buffer hold at least size bytes, keeping its contents */
+static JSON_Status stream_reserve(char **buffer, size_t *capacity, size_t size)
+{
+    size_t new_capacity = MAX(*capacity, STARTING_CAPACITY);
+    char *new_buffer = NULL;
+    if (size <= *capacity && *buffer != NULL) {
+        return JSONSuccess;
+    }
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+    new_buffer = (char *)parson_malloc(new_capacity);
+    if (new_buffer == NULL) {
+        return JSONFailure;
+    }
+    if (*buffer != NULL) {
+        memcpy(new_buffer, *buffer, *capacity);
+        parson_free(*buffer);
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return JSONSuccess;
+}
+
+static JSON_Status stream_stash(JSON_Stream_Parser *parser, const char *data, size_t len)
+{
+    if (stream_reserve(&parser->stash, &parser->stash_capacity, parser->stash_len + len) ==
+        JSONFailure) {
+        return JSONFailure;
+    }
+    memcpy(parser->stash + parser->stash_len, data, len);
+    parser->stash_len += len;
+    return JSONSuccess;
+}
+
+/* Returns the closing quote of a string token or the character after a bare (number or
+   literal) token, or NULL if the token continues past end */
+static const char *stream_find_token_end(JSON_Stream_Parser *parser, const char *ptr,
+                                         const char *end)
+{
+    for (; ptr < end; ptr++) {
+        if (parser->token == STREAM_TOKEN_BARE) {
+            if (IS_SPACE(*ptr) || (*ptr != '\0' && strchr("{}[],:\"", *ptr))) {
+                return ptr;
+            }
+            continue;
+        }
+        if (parser->escaped) {
+            parser->escaped = 0;
+            continue;
+        }
+        ptr = scan_string(ptr, end);
+        if (ptr == end) {
+            break;
+        } else if (*ptr == '\\') {
+            parser->escaped = 1;
+        } else if (*ptr == '\"') {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+static JSON_Status stream_end_token(JSON_Stream_Parser *parser, const char *token, size_t len)
+{
+    JSON_Parser token_parser;
+    JSON_Event event;
+    char *output_end = NULL;
+    memset(&event, 0, sizeof(event));
+    if (parser->token == STREAM_TOKEN_STRING) {
+        if (memchr(token, '\0', len) != NULL) {
+            return JSONFailure;
+        }
+        if (parser->state == STREAM_NAME) { /* kept until its value is complete */
+            if (stream_reserve(&parser->name, &parser->name_capacity, len + 1) == JSONFailure) {
+                return JSONFailure;
+            }
+            output_end = unescape_string(token, len, parser->name);
+            if (output_end == NULL) {
+                return JSONFailure;
+            }
+            parser->name_len = (size_t)(output_end - parser->name);
+            parser->has_name = 1;
+            parser->state = STREAM_COLON;
+            return JSONSuccess;
+        }
+        event.type = JSONEventString;
+        if (scan_string(token, token + len) == token + len) { /* no escapes */
+            event.string = token;
+            event.string_len = len;
+        } else {
+            if (stream_reserve(&parser->string, &parser->string_capacity, len + 1) ==
+                JSONFailure) {
+                return JSONFailure;
+            }
+            output_end = unescape_string(token, len, parser->string);
+            if (output_end == NULL) {
+                return JSONFailure;
+            }
+            event.string = parser->string;
+            event.string_len = (size_t)(output_end - parser->string);
+        }
+        return stream_report_value(parser, &event);
+    }
+    token_parser.ptr = token;
+    token_parser.end = token + len;
+    token_parser.in_situ = 0;
+    switch (PEEK(&token_parser)) {
+    case 't':
+    case 'f':
+        event.type = JSONEventBoolean;
+        event.boolean = skip_token(&token_parser, "true", SIZEOF_TOKEN("true"));
+        if (!event.boolean && !skip_token(&token_parser, "false", SIZEOF_TOKEN("false"))) {
+            return JSONFailure;
+        }
+        break;
+    case 'n':
+        event.type = JSONEventNull;
+        if (!skip_token(&token_parser, "null", SIZEOF_TOKEN("null"))) {
+            return JSONFailure;
+        }
+        break;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        event.type = JSONEventNumber;
+        if (parse_number(&token_parser, &event.number) == JSONFailure) {
+            return JSONFailure;
+        }
+        break;
+    default:
+        return JSONFailure;
+    }
+    /* e.g. "truex" or "1.2.3", though like parse_value, ignore what follows a root value */
+    if (REMAINING(&token_parser) != 0 && parser->depth > 0) {
+        return JSONFailure;
+    }
+    return stream_report_value(parser, &event);
+}
+
+/* Handles a character outside of tokens that isn't whitespace */
+static JSON_Status stream_structural(JSON_Stream_Parser *parser, char c)
+{
+    JSON_Event event;
+    int closes = parser->depth > 0 && c == (parser->is_object ? '}' : ']');
+    memset(&event, 0, sizeof(event));
+    if (closes && (parser->state == STREAM_AFTER_VALUE || parser->just_opened)) {
+        parser->depth--;
+        parser->just_opened = 0;
+        event.type = parser->is_object ? JSONEventObjectEnd : JSONEventArrayEnd;
+        event.depth = parser->depth;
+        if (parser->callback(&event, parser->context) == JSONFailure) {
+            return JSONFailure;
+        }
+        if (parser->depth > 0) {
+            parser->is_object =
+                (parser->in_object[(parser->depth - 1) / 8] >> ((parser->depth - 1) % 8)) & 1;
+        }
+        parser->state = parser->depth > 0 ? STREAM_AFTER_VALUE : STREAM_DONE;
+        return JSONSuccess;
+    }
+    parser->just_opened = 0;
+    switch (parser->state) {
+    case STREAM_VALUE:
+        if ((c != '{' && c != '[') || parser->depth > MAX_NESTING) {
+            return JSONFailure;
+        }
+        event.type = c == '{' ? JSONEventObjectStart : JSONEventArrayStart;
+        if (stream_report_value(parser, &event) == JSONFailure) {
+            return JSONFailure;
+        }
+        parser->is_object = c == '{';
+        if (parser->is_object) {
+            parser->in_object[parser->depth / 8] |= (unsigned char)(1 << (parser->depth % 8));
+        } else {
+            parser->in_object[parser->depth / 8] &= (unsigned char)~(1 << (parser->depth % 8));
+        }
+        parser->depth++;
+        parser->just_opened = 1;
+        parser->state = parser->is_object ? STREAM_NAME : STREAM_VALUE;
+        return JSONSuccess;
+    case STREAM_COLON:
+        if (c != ':') {
+            return JSONFailure;
+        }
+        parser->state = STREAM_VALUE;
+        return JSONSuccess;
+    case STREAM_AFTER_VALUE:
+        if (c != ',') {
+            return JSONFailure;
+        }
+        parser->state = parser->is_object ? STREAM_NAME : STREAM_VALUE;
+        return JSONSuccess;
+    default:
+        return JSONFailure;
+    }
+}
+
+/* Reports a scalar or container start at the current depth, under the pending member name */
+static JSON_Status stream_report_value(JSON_Stream_Parser *parser, JSON_Event *event)
+{
+    event->depth = parser->depth;
+    if (parser->has_name) {
+        event->name = parser->name;
+        event->name_len = parser->name_len;
+        parser->has_name = 0;
+    }
+    if (parser->callback(event, parser->context) == JSONFailure) {
+        return JSONFailure;
+    }
+    parser->state = parser->depth > 0 ? STREAM_AFTER_VALUE : STREAM_DONE;
+    return JSONSuccess;
+}
+
+/* Event function building parser->root, linking containers through their parent pointers */
+static JSON_Status stream_build_value(const JSON_Event *event, void *context)
+{
+    JSON_Stream_Parser *parser = (JSON_Stream_Parser *)context;
+    JSON_Value *value = NULL;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    switch (event->type) {
+    case JSONEventObjectEnd: /* Trim container after parsing is over */
+        object = json_value_get_object(parser->current);
+        if (object->count > 0 && json_object_resize(object, object->count) == JSONFailure) {
+            return JSONFailure;
+        }
+        parser->current = parser->current->parent;
+        return JSONSuccess;
+    case JSONEventArrayEnd:
+        array = json_value_get_array(parser->current);
+        if (array->count > 0 && json_array_resize(array, array->count) == JSONFailure) {
+            return JSONFailure;
+        }
+        parser->current = parser->current->parent;
+        return JSONSuccess;
+    case JSONEventObjectStart:
+        value = json_value_init_object();
+        break;
+    case JSONEventArrayStart:
+        value = json_value_init_array();
+        break;
+    case JSONEventString:
+        value = json_value_init_string_copy(event->string, event->string_len);
+        break;
+    case JSONEventNumber:
+        value = json_value_init_number(event->number);
+        break;
+    case JSONEventBoolean:
+        value = json_value_init_boolean(event->boolean);
+        break;
+    case JSONEventNull:
+        value = json_value_init_null();
+        break;
+    default:
+        return JSONFailure;
+    }
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (parser->current == NULL) {
+        parser->root = value;
+    } else if ((json_value_get_type(parser->current) == JSONObject
+                    ? json_object_addn(json_value_get_object(parser->current), event->name,
+                                       event->name_len, value)
+                    : json_array_add(json_value_get_array(parser->current), value)) ==
+               JSONFailure) {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    if (event->type == JSONEventObjectStart || event->type == JSONEventArrayStart) {
+        parser->current = value;
+    }
+    return JSONSuccess;
+}
+
+/* Serialization */
+#define APPEND_STRING(str)                                                   \
+    do {                                                                     \
+        if (writer_append(writer, (str), sizeof(str) - 1) == JSONFailure) { \
+            return JSONFailure;                                              \
+        }                                                                    \
+    } while (0)
+
+static void writer_init(JSON_Writer *writer, char *buf, size_t capacity)
+{
+    writer->buf = buf;
+    writer->len = 0;
+    writer->capacity = capacity;
+    writer->growable = 0;
+    writer->sink = NULL;
+    writer->context = NULL;
+}
+
+/* Makes room for len more bytes: a growable buffer doubles, a sink gets what is buffered */
+static JSON_Status writer_make_room(JSON_Writer *writer, size_t len)
+{
+    char *new_buf = NULL;
+    size_t new_capacity = writer->capacity;
+    if (writer->sink != NULL) {
+        if (writer->len > 0 &&
+            writer->sink(writer->buf, writer->len, writer->context) == JSONFailure) {
+            return JSONFailure;
+        }
+        writer->len = 0;
+        return JSONSuccess;
+    }
+    if (!writer->growable) {
+        return JSONFailure;
+    }
+    while (new_capacity - writer->len < len) {
+        if (new_capacity > (size_t)-1 / 2) {
+            return JSONFailure;
+        }
+        new_capacity *= 2;
+    }
+    new_buf = (char *)parson_malloc(new_capacity);
+    if (new_buf == NULL) {
+        return JSONFailure;
+    }
+    memcpy(new_buf, writer->buf, writer->len);
+    parson_free(writer->buf);
+    writer->buf = new_buf;
+    writer->capacity = new_capacity;
+    return JSONSuccess;
+}
+
+static JSON_Status writer_append(JSON_Writer *writer, const char *data, size_t len)
+{
+    if (len > writer->capacity - writer->len) {
+        if (writer_make_room(writer, len) == JSONFailure) {
+            return JSONFailure;
+        }
+        if (len > writer->capacity - writer->len) { /* only a sink gets here */
+            return writer->sink(data, len, writer->context);
+        }
+    }
+    if (writer->buf != NULL) { /* NULL when only counting */
+        memcpy(writer->buf + writer->len, data, len);
+    }
+    writer->len += len;
+    return JSONSuccess;
+}
+
+/* Iterative, so that stack use doesn't grow with nesting: all that's kept per open container is
+   the position of the member or item being written, on the stack for the first
+   PARSON_SERIALIZATION_STACK_SIZE levels and on the heap past them. */
+static JSON_Status json_serialize_to_writer(const JSON_Value *value, JSON_Writer *writer,
+                                            int is_pretty)
+{
+    size_t stack[PARSON_SERIALIZATION_STACK_SIZE];
+    size_t *positions = stack, *new_positions = NULL;
+    size_t capacity = PARSON_SERIALIZATION_STACK_SIZE;
+    size_t level = 0; /* containers open */
+    const JSON_Value *container = NULL; /* innermost one */
+    const JSON_Object *object = NULL;
+    const JSON_Array *array = NULL;
+    JSON_Status status = JSONFailure;
+    JSON_Value_Type type = JSONError;
+    size_t count = 0;
+    double started = stats_now();
+    for (;;) {
+        type = json_value_get_type(value);
+        if (type != JSONObject && type != JSONArray) {
+            if (json_serialize_scalar(value, writer) == JSONFailure) {
+                goto out;
+            }
+        } else {
+            object = json_value_get_object(value);
+            array = json_value_get_array(value);
+            if (object == NULL && array == NULL) { /* malformed lazy text or a failed copy */
+                goto out;
+            }
+            count = object != NULL ? json_object_get_count(object) : json_array_get_count(array);
+            if (writer_append(writer, type == JSONObject ? "{" : "[", 1) == JSONFailure) {
+                goto out;
+            }
+            if (count > 0) { /* descend to the first member or item */
+                if (level == capacity) {
+                    new_positions = (size_t *)parson_malloc(capacity * 2 * sizeof(size_t));
+                    if (new_positions == NULL) {
+                        goto out;
+                    }
+                    memcpy(new_positions, positions, capacity * sizeof(size_t));
+                    if (positions != stack) {
+                        parson_free(positions);
+                    }
+                    positions = new_positions;
+                    capacity *= 2;
+                }
+                positions[level++] = 0;
+                container = value;
+                if ((is_pretty && writer_append(writer, "\n", 1) == JSONFailure) ||
+                    json_serialize_member_start(container, 0, writer, level, is_pretty) ==
+                        JSONFailure) {
+                    goto out;
+                }
+                value = json_serialize_member_value(container, 0);
+                continue;
+            }
+            if (writer_append(writer, type == JSONObject ? "}" : "]", 1) == JSONFailure) {
+                goto out;
+            }
+        }
+        /* value is written: go on to the next member or item, closing containers that end */
+        for (;;) {
+            if (level == 0) {
+                status = JSONSuccess;
+                goto out;
+            }
+            type = json_value_get_type(container);
+            count = type == JSONObject ? json_object_get_count(json_value_get_object(container))
+                                       : json_array_get_count(json_value_get_array(container));
+            if (++positions[level - 1] < count) {
+                if (writer_append(writer, ",", 1) == JSONFailure ||
+                    (is_pretty && writer_append(writer, "\n", 1) == JSONFailure) ||
+                    json_serialize_member_start(container, positions[level - 1], writer, level,
+                                                is_pretty) == JSONFailure) {
+                    goto out;
+                }
+                value = json_serialize_member_value(container, positions[level - 1]);
+                break;
+            }
+            level--;
+            if ((is_pretty && (writer_append(writer, "\n", 1) == JSONFailure ||
+                               append_indent(writer, (int)level) == JSONFailure)) ||
+                writer_append(writer, type == JSONObject ? "}" : "]", 1) == JSONFailure) {
+                goto out;
+            }
+            container = container->parent;
+        }
+    }
+out:
+    if (positions != stack) {
+        parson_free(positions);
+    }
+    stats_count_serialization(started);
+    return status;
+}
+
+/* Writes what comes before member or item i of container: the indent and any name */
+static JSON_Status json_serialize_member_start(const JSON_Value *container, size_t i,
+                                               JSON_Writer *writer, size_t level, int is_pretty)
+{
+    const char *key = NULL;
+    if (is_pretty && append_indent(writer, (int)level) == JSONFailure) {
+        return JSONFailure;
+    }
+    if (json_value_get_type(container) != JSONObject) {
+        return JSONSuccess;
+    }
+    key = json_object_get_name(json_value_get_object(container), i);
+    if (key == NULL || json_serialize_string(key, writer) == JSONFailure) {
+        return JSONFailure;
+    }
+    APPEND_STRING(":");
+    if (is_pretty) {
+        APPEND_STRING(" ");
+    }
+    return JSONSuccess;
+}
+
+static const JSON_Value *json_serialize_member_value(const JSON_Value *container, size_t i)
+{
+    if (json_value_get_type(container) == JSONObject) {
+        return json_object_get_value_at(json_value_get_object(container), i);
+    }
+    return json_array_get_value(json_value_get_array(container), i);
+}
+
+static JSON_Status json_serialize_scalar(const JSON_Value *value, JSON_Writer *writer)
+{
+    const char *string = NULL;
+    double num = 0.0;
+    int written = -1;
+
+    switch (json_value_get_type(value)) {
+    case JSONString:
+        string = json_value_get_string(value);
+        if (string == NULL) {
+            return JSONFailure;
+        }
+        return json_serialize_string(string, writer);
+    case JSONBoolean:
+        if (json_value_get_boolean(value)) {
+            APPEND_STRING("true");
+        } else {
+            APPEND_STRING("false");
+        }
+        return JSONSuccess;
+    case JSONNumber:
+        num = json_value_get_number(value);
+        if (writer->buf != NULL && writer->capacity - writer->len >= NUM_BUF_SIZE) {
+            written = format_number(num, writer->buf + writer->len); /* straight into the output */
+            if (written < 0) {
+                return JSONFailure;
+            }
+            writer->len += (size_t)written;
+            return JSONSuccess;
+        }
+        written = format_number(num, writer->num_buf);
+        if (written < 0) {
+            return JSONFailure;
+        }
+        return writer_append(writer, writer->num_buf, (size_t)written);
+    case JSONNull:
+        APPEND_STRING("null");
+        return JSONSuccess;
+    case JSONError:
+        return JSONFailure;
+    default:
+        return JSONFailure;
+    }
+}
+
+static JSON_Status json_serialize_string(const char *string, JSON_Writer *writer)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    const char *run = string, *ptr = string;
+    char escaped[6] = {'\\', 'u', '0', '0', '0', '0'};
+    unsigned char c = 0;
+    APPEND_STRING("\"");
+    for (ptr = string; *ptr != '\0'; ptr++) {
+        c = (unsigned char)*ptr;
+        if (c >= 0x20 && c != '\"' && c != '\\' && c != '/') {
+            continue;
+        }
+        /* characters that need no escaping are copied a run at a time */
+        if (ptr > run && writer_append(writer, run, (size_t)(ptr - run)) == JSONFailure) {
+            return JSONFailure;
+        }
+        run = ptr + 1;
+        switch (c) {
+        case '\"':
+            APPEND_STRING("\\\"");
+            break;
+        case '\\':
+            APPEND_STRING("\\\\");
+            break;
+        case '/':
+            APPEND_STRING("\\/");
+            break; /* to make json embeddable in xml\/html */
+        case '\b':
+            APPEND_STRING("\\b");
+            break;
+        case '\f':
+            APPEND_STRING("\\f");
+            break;
+        case '\n':
+            APPEND_STRING("\\n");
+            break;
+        case '\r':
+            APPEND_STRING("\\r");
+            break;
+        case '\t':
+            APPEND_STRING("\\t");
+            break;
+        default:
+            escaped[4] = hex_digits[c >> 4];
+            escaped[5] = hex_digits[c & 0xF];
+            if (writer_append(writer, escaped, sizeof(escaped)) == JSONFailure) {
+                return JSONFailure;
+            }
+            break;
+        }
+    }
+    if (ptr > run && writer_append(writer, run, (size_t)(ptr - run)) == JSONFailure) {
+        return JSONFailure;
+    }
+    APPEND_STRING("\"");
+    return JSONSuccess;
+}
+
+static JSON_Status append_indent(JSON_Writer *writer, int level)
+{
+    int i;
+    for (i = 0; i < level; i++) {
+        APPEND_STRING("    ");
+    }
+    return JSONSuccess;
+}
+
+static size_t serialization_size(const JSON_Value *value, int is_pretty)
+{
+    JSON_Writer writer;
+    writer_init(&writer, NULL, (size_t)-1);
+    if (json_serialize_to_writer(value, &writer, is_pretty) == JSONFailure) {
+        return 0;
+    }
+    return writer.len + 1;
+}
+
+static JSON_Status serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size,
+                                       int is_pretty)
+{
+    JSON_Writer writer;
+    if (buf == NULL) {
+        return JSONFailure;
+    }
+    writer_init(&writer, buf, buf_size);
+    if (json_serialize_to_writer(value, &writer, is_pretty) == JSONFailure) {
+        return JSONFailure;
+    }
+    return writer_append(&writer, "", 1);
+}
+
+static char *serialize_to_string(const JSON_Value *value, int is_pretty)
+{
+    JSON_Writer writer;
+    writer_init(&writer, (char *)parson_malloc(PARSON_SERIALIZATION_BUFFER_SIZE),
+                PARSON_SERIALIZATION_BUFFER_SIZE);
+    if (writer.buf == NULL) {
+        return NULL;
+    }
+    writer.growable = 1;
+    if (json_serialize_to_writer(value, &writer, is_pretty) == JSONFailure ||
+        writer_append(&writer, "", 1) == JSONFailure) {
+        parson_free(writer.buf);
+        return NULL;
+    }
+    return writer.buf;
+}
+
+static JSON_Status serialize_to_sink(const JSON_Value *value, JSON_Sink_Function sink,
+                                     void *context, int is_pretty)
+{
+    char buf[PARSON_SERIALIZATION_BUFFER_SIZE];
+    JSON_Writer writer;
+    if (sink == NULL) {
+        return JSONFailure;
+    }
+    writer_init(&writer, buf, sizeof(buf));
+    writer.sink = sink;
+    writer.context = context;
+    if (json_serialize_to_writer(value, &writer, is_pretty) == JSONFailure ||
+        writer_make_room(&writer, 0) == JSONFailure) { /* hands over the rest */
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+#undef APPEND_STRING
+
+/* CBOR */
+/* Appends to writer's buffer, or only counts the bytes if it has none */
+static void cbor_put(JSON_CBOR_Writer *writer, const void *data, size_t len)
+{
+    if (writer->failed) {
+        return;
+    }
+    if (writer->buf != NULL) {
+        if (len > writer->buf_size - writer->len) {
+            writer->failed = 1;
+            return;
+        }
+        memcpy(writer->buf + writer->len, data, len);
+    }
+    writer->len += len;
+}
+
+/* Writes the initial byte of an item and its argument, in the fewest bytes that hold it */
+static void cbor_put_head(JSON_CBOR_Writer *writer, int major, uint64_t arg)
+{
+    int info = arg < 24              ? (int)arg
+               : arg <= 0xFF         ? 24
+               : arg <= 0xFFFF       ? 25
+               : arg <= 0xFFFFFFFFUL ? 26
+                                     : 27;
+    cbor_put_head_sized(writer, major, info, arg);
+}
+
+/* Same, with the size of the argument given by info, as floats need */
+static void cbor_put_head_sized(JSON_CBOR_Writer *writer, int major, int info, uint64_t arg)
+{
+    unsigned char head[9];
+    size_t arg_size = info < 24 || info == CBOR_INDEFINITE ? 0 : (size_t)1 << (info - 24);
+    size_t i = 0;
+    head[0] = (unsigned char)((major << 5) | info);
+    for (i = 0; i < arg_size; i++) {
+        head[1 + i] = (unsigned char)(arg >> (8 * (arg_size - 1 - i)));
+    }
+    cbor_put(writer, head, 1 + arg_size);
+}
+
+/* Reads the initial byte of an item and its argument. An indefinite length or a break leaves
+   info at CBOR_INDEFINITE for the caller to deal with. */
+static JSON_Status cbor_read_head(JSON_CBOR_Parser *parser, int *major, int *info, uint64_t *arg)
+{
+    size_t arg_size = 0, i = 0;
+    if (parser->ptr >= parser->end) {
+        return JSONFailure;
+    }
+    *major = *parser->ptr >> 5;
+    *info = *parser->ptr & 0x1F;
+    parser->ptr++;
+    *arg = (uint64_t)*info;
+    if (*info < 24) {
+        return JSONSuccess;
+    }
+    if (*info == CBOR_INDEFINITE) {
+        return *major == CBOR_UNSIGNED || *major == CBOR_NEGATIVE || *major == CBOR_TAG
+                   ? JSONFailure
+                   : JSONSuccess;
+    }
+    if (*info > 27) { /* reserved */
+        return JSONFailure;
+    }
+    arg_size = (size_t)1 << (*info - 24);
+    if ((size_t)(parser->end - parser->ptr) < arg_size) {
+        return JSONFailure;
+    }
+    *arg = 0;
+    for (i = 0; i < arg_size; i++) {
+        *arg = (*arg << 8) | *parser->ptr++;
+    }
+    return JSONSuccess;
+}
+
+/* Reads a text string whose head has been read, pointing *string into the input if it's in one
+   piece, otherwise joining its chunks in buf, which holds PARSON_EVENT_BUFFER_SIZE bytes. */
+static JSON_Status cbor_read_text(JSON_CBOR_Parser *parser, int info, uint64_t arg, char *buf,
+                                  const char **string, size_t *string_len)
+{
+    int chunk_major = 0, chunk_info = 0;
+    size_t len = 0;
+    if (info != CBOR_INDEFINITE) {
+        if (arg > (uint64_t)(parser->end - parser->ptr)) {
+            return JSONFailure;
+        }
+        *string = (const char *)parser->ptr;
+        *string_len = (size_t)arg;
+        parser->ptr += *string_len;
+    } else {
+        for (;;) {
+            if (parser->ptr < parser->end && *parser->ptr == CBOR_BREAK) {
+                parser->ptr++;
+                break;
+            }
+            if (cbor_read_head(parser, &chunk_major, &chunk_info, &arg) == JSONFailure ||
+                chunk_major != CBOR_TEXT || chunk_info == CBOR_INDEFINITE ||
+                arg > (uint64_t)(parser->end - parser->ptr) ||
+                arg >= (uint64_t)(PARSON_EVENT_BUFFER_SIZE - len)) {
+                return JSONFailure;
+            }
+            memcpy(buf + len, parser->ptr, (size_t)arg);
+            len += (size_t)arg;
+            parser->ptr += (size_t)arg;
+        }
+        *string = buf;
+        *string_len = len;
+    }
+    return is_valid_utf8(*string, *string_len) ? JSONSuccess : JSONFailure;
+}
+
+static double cbor_half_to_double(unsigned int half)
+{
+    int exponent = (int)((half >> 10) & 0x1F);
+    double value = (double)(half & 0x3FF);
+    if (exponent == 0) { /* subnormal */
+        value = ldexp(value, -24);
+    } else if (exponent != 31) {
+        value = ldexp(value + 1024.0, exponent - 25);
+    } else {
+        value = HUGE_VAL; /* infinity or nan, neither of which JSON has */
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+/* Reports the item at parser and everything in it to the callback. event has the item's member
+   name set if it's in a map. */
+static JSON_Status cbor_parse_item(JSON_CBOR_Parser *parser, JSON_Event *event, size_t depth)
+{
+    JSON_Event member;
+    int major = 0, info = 0, is_object = 0, name_major = 0, name_info = 0;
+    uint64_t arg = 0, name_arg = 0, i = 0;
+    float single = 0;
+    if (depth > MAX_NESTING) {
+        return JSONFailure;
+    }
+    do { /* tags only annotate the item that follows, which is decoded as is */
+        if (cbor_read_head(parser, &major, &info, &arg) == JSONFailure) {
+            return JSONFailure;
+        }
+    } while (major == CBOR_TAG);
+    event->depth = depth;
+    switch (major) {
+    case CBOR_UNSIGNED:
+        event->type = JSONEventNumber;
+        event->number = (double)arg;
+        break;
+    case CBOR_NEGATIVE:
+        event->type = JSONEventNumber;
+        /* -1 - arg, rounded once: arg + 1 is exact unless arg is UINT64_MAX */
+        event->number = arg < UINT64_MAX ? -(double)(arg + 1) : -CBOR_TWO_TO_64;
+        break;
+    case CBOR_TEXT:
+        event->type = JSONEventString;
+        if (cbor_read_text(parser, info, arg, parser->string_buf, &event->string,
+                           &event->string_len) == JSONFailure) {
+            return JSONFailure;
+        }
+        break;
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+        is_object = major == CBOR_MAP;
+        event->type = is_object ? JSONEventObjectStart : JSONEventArrayStart;
+        if (parser->callback(event, parser->context) == JSONFailure) {
+            return JSONFailure;
+        }
+        for (i = 0; info == CBOR_INDEFINITE || i < arg; i++) {
+            if (info == CBOR_INDEFINITE && parser->ptr < parser->end &&
+                *parser->ptr == CBOR_BREAK) {
+                parser->ptr++;
+                break;
+            }
+            memset(&member, 0, sizeof(member));
+            if (is_object &&
+                (cbor_read_head(parser, &name_major, &name_info, &name_arg) == JSONFailure ||
+                 name_major != CBOR_TEXT ||
+                 cbor_read_text(parser, name_info, name_arg, parser->name_buf, &member.name,
+                                &member.name_len) == JSONFailure)) {
+                return JSONFailure; /* JSON names are strings */
+            }
+            if (cbor_parse_item(parser, &member, depth + 1) == JSONFailure) {
+                return JSONFailure;
+            }
+        }
+        event->type = is_object ? JSONEventObjectEnd : JSONEventArrayEnd;
+        event->name = NULL;
+        event->name_len = 0;
+        break;
+    case CBOR_SIMPLE:
+        event->type = JSONEventNumber;
+        if (info == CBOR_FALSE || info == CBOR_TRUE) {
+            event->type = JSONEventBoolean;
+            event->boolean = info == CBOR_TRUE;
+        } else if (info == CBOR_NULL || info == CBOR_UNDEFINED) {
+            event->type = JSONEventNull;
+        } else if (info == CBOR_HALF) {
+            event->number = cbor_half_to_double((unsigned int)arg);
+        } else if (info == CBOR_FLOAT) {
+            uint32_t bits = (uint32_t)arg;
+            memcpy(&single, &bits, sizeof(single));
+            event->number = single;
+        } else if (info == CBOR_DOUBLE) {
+            memcpy(&event->number, &arg, sizeof(event->number));
+        } else {
+            return JSONFailure; /* other simple values and misplaced breaks */
+        }
+        if (event->type == JSONEventNumber && (event->number * 0.0) != 0.0) {
+            return JSONFailure; /* nan and inf test */
+        }
+        break;
+    default: /* byte strings have no JSON equivalent */
+        return JSONFailure;
+    }
+    return parser->callback(event, parser->context);
+}
+
+/* Parser API */
+JSON_Value *json_parse_string(const char *string)
+{
+    if (string == NULL) {
+        return NULL;
+    }
+    return parse_buffer(string, strlen(string), 0);
 }
 
-static JSON_Value *parse_number_value(const char **string)
+JSON_Value *json_parse_string_with_comments(const char *string)
 {
-    char *end;
-    double number = 0;
-    errno = 0;
-    number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
+    JSON_Value *result = NULL;
+    char *string_mutable_copy = NULL;
+    string_mutable_copy = parson_strdup(string);
+    if (string_mutable_copy == NULL) {
         return NULL;
     }
-    *string = end;
-    return json_value_init_number(number);
+    remove_comments(string_mutable_copy, "/*", "*/");
+    remove_comments(string_mutable_copy, "//", "\n");
+    result = parse_buffer(string_mutable_copy, strlen(string_mutable_copy), 0);
+    parson_free(string_mutable_copy);
+    return result;
 }
 
-static JSON_Value *parse_null_value(const char **string)
+JSON_Value *json_parse_string_arena(const char *string, JSON_Arena *arena)
 {
-    size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
-        *string += token_size;
-        return json_value_init_null();
+    if (string == NULL) {
+        return NULL;
     }
-    return NULL;
+    return parse_buffer_arena(string, strlen(string), 0, arena);
 }
 
-/* Serialization */
-#define APPEND_STRING(str)                   \
-    do {                                     \
-        written = append_string(buf, (str)); \
-        if (written < 0) {                   \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL) {                   \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
-    } while (0)
+JSON_Value *json_parse_buffer(const char *buf, size_t buf_len)
+{
+    if (buf == NULL) {
+        return NULL;
+    }
+    return parse_buffer(buf, buf_len, 0);
+}
 
-#define APPEND_INDENT(level)                   \
-    do {                                       \
-        written = append_indent(buf, (level)); \
-        if (written < 0) {                     \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL) {                     \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
-    } while (0)
+JSON_Value *json_parse_buffer_arena(const char *buf, size_t buf_len, JSON_Arena *arena)
+{
+    if (buf == NULL) {
+        return NULL;
+    }
+    return parse_buffer_arena(buf, buf_len, 0, arena);
+}
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
+JSON_Value *json_parse_buffer_in_situ(char *buf, size_t buf_len, JSON_Arena *arena)
 {
-    const char *key = NULL, *string = NULL;
-    JSON_Value *temp_value = NULL;
-    JSON_Array *array = NULL;
-    JSON_Object *object = NULL;
-    size_t i = 0, count = 0;
-    double num = 0.0;
-    int written = -1, written_total = 0;
+    if (buf == NULL) {
+        return NULL;
+    }
+    return parse_buffer_arena(buf, buf_len, 1, arena);
+}
 
-    switch (json_value_get_type(value)) {
-    case JSONArray:
-        array = json_value_get_array(value);
-        count = json_array_get_count(array);
-        APPEND_STRING("[");
-        if (count > 0 && is_pretty) {
-            APPEND_STRING("\n");
+JSON_Value *json_parse_string_lazy(const char *string)
+{
+    if (string == NULL) {
+        return NULL;
+    }
+    return json_parse_buffer_lazy(string, strlen(string));
+}
+
+JSON_Value *json_parse_buffer_lazy(const char *buf, size_t buf_len)
+{
+    JSON_Lazy_Text *text = NULL;
+    JSON_Value *value = NULL;
+    const char *start = NULL, *end = NULL;
+    size_t len = 0;
+    double started = 0.0;
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (buf_len >= 3 && buf[0] == '\xEF' && buf[1] == '\xBB' && buf[2] == '\xBF') {
+        buf += 3; /* Support for UTF-8 BOM */
+        buf_len -= 3;
+    }
+    start = skip_whitespaces(buf, buf + buf_len);
+    if (start == buf + buf_len || (*start != '{' && *start != '[')) {
+        return parse_buffer(buf, buf_len, 0); /* nothing to put off */
+    }
+    started = stats_now();
+    end = skip_container(start, buf + buf_len);
+    len = end != NULL ? (size_t)(end - start) : 0;
+    text = end != NULL ? (JSON_Lazy_Text *)parson_malloc(offsetof(JSON_Lazy_Text, text) + len)
+                       : NULL;
+    if (text != NULL) {
+        text->refs = 0;
+        memcpy(text->text, start, len);
+        value = json_value_init_lazy(*start == '{' ? JSONObject : JSONArray, text, text->text,
+                                     text->text + len);
+        if (value == NULL) {
+            parson_free(text);
         }
-        for (i = 0; i < count; i++) {
-            if (is_pretty) {
-                APPEND_INDENT(level + 1);
+    }
+    stats_count_parse(started);
+    return value;
+}
+
+/* Same grammar as parse_value, but iterative: the only state kept per open container is
+   a bit telling whether it's an object (set) or an array. */
+static JSON_Status parse_events(const char *buf, size_t buf_len, JSON_Event_Function callback,
+                                void *context)
+{
+    enum { EXPECT_VALUE, EXPECT_NAME, AFTER_VALUE } state = EXPECT_VALUE;
+    unsigned char in_object[MAX_NESTING / 8 + 1];
+    char name_buf[PARSON_EVENT_BUFFER_SIZE], string_buf[PARSON_EVENT_BUFFER_SIZE];
+    JSON_Parser parser;
+    JSON_Event event;
+    size_t depth = 0;     /* depth of the next value */
+    int is_object = 0;    /* innermost open container is an object */
+    if (buf == NULL || callback == NULL) {
+        return JSONFailure;
+    }
+    if (buf_len >= 3 && buf[0] == '\xEF' && buf[1] == '\xBB' && buf[2] == '\xBF') {
+        buf += 3; /* Support for UTF-8 BOM */
+        buf_len -= 3;
+    }
+    parser.ptr = buf;
+    parser.end = buf + buf_len;
+    parser.in_situ = 0;
+    memset(&event, 0, sizeof(event));
+    for (;;) {
+        SKIP_WHITESPACES(&parser);
+        if (state == EXPECT_NAME) {
+            if (get_event_string(&parser, name_buf, &event.name, &event.name_len,
+                                 &event.name_escaped) == JSONFailure) {
+                return JSONFailure;
             }
-            temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
+            SKIP_WHITESPACES(&parser);
+            if (PEEK(&parser) != ':') {
+                return JSONFailure;
             }
-            if (buf != NULL) {
-                buf += written;
+            SKIP_CHAR(&parser);
+            state = EXPECT_VALUE;
+            continue;
+        }
+        if (state == AFTER_VALUE) {
+            if (depth == 0) {
+                return JSONSuccess;
             }
-            written_total += written;
-            if (i < (count - 1)) {
-                APPEND_STRING(",");
+            if (PEEK(&parser) == ',') {
+                SKIP_CHAR(&parser);
+                event.name = NULL;
+                event.name_len = 0;
+                event.name_escaped = 0;
+                state = is_object ? EXPECT_NAME : EXPECT_VALUE;
+                continue;
             }
-            if (is_pretty) {
-                APPEND_STRING("\n");
+            if (PEEK(&parser) != (is_object ? '}' : ']')) {
+                return JSONFailure;
             }
-        }
-        if (count > 0 && is_pretty) {
-            APPEND_INDENT(level);
-        }
-        APPEND_STRING("]");
-        return written_total;
-    case JSONObject:
-        object = json_value_get_object(value);
-        count = json_object_get_count(object);
-        APPEND_STRING("{");
-        if (count > 0 && is_pretty) {
-            APPEND_STRING("\n");
-        }
-        for (i = 0; i < count; i++) {
-            key = json_object_get_name(object, i);
-            if (key == NULL) {
-                return -1;
+            SKIP_CHAR(&parser);
+            event.type = is_object ? JSONEventObjectEnd : JSONEventArrayEnd;
+            event.name = NULL;
+            event.name_len = 0;
+            event.name_escaped = 0;
+            depth--;
+            event.depth = depth;
+            if (callback(&event, context) == JSONFailure) {
+                return JSONFailure;
             }
-            if (is_pretty) {
-                APPEND_INDENT(level + 1);
+            if (depth > 0) {
+                is_object = (in_object[(depth - 1) / 8] >> ((depth - 1) % 8)) & 1;
             }
-            written = json_serialize_string(key, buf);
-            if (written < 0) {
-                return -1;
+            continue;
+        }
+        event.depth = depth;
+        switch (PEEK(&parser)) {
+        case '{':
+        case '[':
+            if (depth > MAX_NESTING) {
+                return JSONFailure;
             }
-            if (buf != NULL) {
-                buf += written;
+            is_object = PEEK(&parser) == '{';
+            SKIP_CHAR(&parser);
+            event.type = is_object ? JSONEventObjectStart : JSONEventArrayStart;
+            if (callback(&event, context) == JSONFailure) {
+                return JSONFailure;
             }
-            written_total += written;
-            APPEND_STRING(":");
-            if (is_pretty) {
-                APPEND_STRING(" ");
+            if (is_object) {
+                in_object[depth / 8] |= (unsigned char)(1 << (depth % 8));
+            } else {
+                in_object[depth / 8] &= (unsigned char)~(1 << (depth % 8));
             }
-            temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
-                return -1;
+            depth++;
+            event.name = NULL;
+            event.name_len = 0;
+            event.name_escaped = 0;
+            SKIP_WHITESPACES(&parser);
+            if (PEEK(&parser) == (is_object ? '}' : ']')) { /* empty container */
+                state = AFTER_VALUE;
+            } else {
+                state = is_object ? EXPECT_NAME : EXPECT_VALUE;
+            }
+            continue;
+        case '\"':
+            event.type = JSONEventString;
+            if (get_event_string(&parser, string_buf, &event.string, &event.string_len,
+                                 &event.string_escaped) == JSONFailure) {
+                return JSONFailure;
             }
-            if (buf != NULL) {
-                buf += written;
+            break;
+        case 'f':
+        case 't':
+            event.type = JSONEventBoolean;
+            if (skip_token(&parser, "true", SIZEOF_TOKEN("true"))) {
+                event.boolean = 1;
+            } else if (skip_token(&parser, "false", SIZEOF_TOKEN("false"))) {
+                event.boolean = 0;
+            } else {
+                return JSONFailure;
             }
-            written_total += written;
-            if (i < (count - 1)) {
-                APPEND_STRING(",");
+            break;
+        case '-':
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            event.type = JSONEventNumber;
+            if (parse_number(&parser, &event.number) == JSONFailure) {
+                return JSONFailure;
             }
-            if (is_pretty) {
-                APPEND_STRING("\n");
+            break;
+        case 'n':
+            event.type = JSONEventNull;
+            if (!skip_token(&parser, "null", SIZEOF_TOKEN("null"))) {
+                return JSONFailure;
             }
+            break;
+        default:
+            return JSONFailure;
         }
-        if (count > 0 && is_pretty) {
-            APPEND_INDENT(level);
+        if (callback(&event, context) == JSONFailure) {
+            return JSONFailure;
         }
-        APPEND_STRING("}");
-        return written_total;
-    case JSONString:
-        string = json_value_get_string(value);
-        if (string == NULL) {
-            return -1;
+        event.string = NULL;
+        event.string_len = 0;
+        event.string_escaped = 0;
+        state = AFTER_VALUE;
+    }
+}
+
+JSON_Status json_parse_events(const char *buf, size_t buf_len, JSON_Event_Function callback,
+                              void *context)
+{
+    double started = stats_now();
+    JSON_Status status = parse_events(buf, buf_len, callback, context);
+    stats_count_parse(started);
+    return status;
+}
+
+/* Sink for walk_escaped_string that appends to the JSON_Writer at context */
+static JSON_Status event_unescape_sink(const char *data, size_t len, void *context)
+{
+    return writer_append((JSON_Writer *)context, data, len);
+}
+
+/* Sink for walk_escaped_string that compares with the rest of the string *context points to */
+static JSON_Status event_compare_sink(const char *data, size_t len, void *context)
+{
+    const char **expected = (const char **)context;
+    if (memchr(*expected, '\0', len) != NULL || memcmp(*expected, data, len) != 0) {
+        return JSONFailure;
+    }
+    *expected += len;
+    return JSONSuccess;
+}
+
+int json_event_name_equals(const JSON_Event *event, const char *name)
+{
+    if (event == NULL || event->name == NULL || name == NULL) {
+        return 0;
+    }
+    if (event->name_escaped) {
+        return walk_escaped_string(event->name, event->name_len, event_compare_sink, &name) ==
+                   JSONSuccess &&
+               *name == '\0';
+    }
+    return strlen(name) == event->name_len && memcmp(event->name, name, event->name_len) == 0;
+}
+
+JSON_Status json_event_unescape(const char *string, size_t len, char *buf, size_t buf_size,
+                                size_t *unescaped_len)
+{
+    JSON_Writer writer;
+    if (string == NULL || buf == NULL || buf_size == 0) {
+        return JSONFailure;
+    }
+    writer_init(&writer, buf, buf_size - 1); /* keeps room for the terminator */
+    if (walk_escaped_string(string, len, event_unescape_sink, &writer) == JSONFailure) {
+        return JSONFailure;
+    }
+    buf[writer.len] = '\0';
+    if (unescaped_len != NULL) {
+        *unescaped_len = writer.len;
+    }
+    return JSONSuccess;
+}
+
+JSON_Stream_Parser *json_stream_parser_create(JSON_Event_Function callback, void *context)
+{
+    JSON_Stream_Parser *parser = (JSON_Stream_Parser *)parson_malloc(sizeof(JSON_Stream_Parser));
+    if (parser == NULL) {
+        return NULL;
+    }
+    memset(parser, 0, sizeof(JSON_Stream_Parser));
+    parser->callback = callback != NULL ? callback : stream_build_value;
+    parser->context = callback != NULL ? context : parser;
+    parser->state = STREAM_VALUE;
+    parser->token = STREAM_TOKEN_NONE;
+    return parser;
+}
+
+JSON_Status json_stream_parser_feed(JSON_Stream_Parser *parser, const char *buf, size_t buf_len)
+{
+    static const char bom[] = "\xEF\xBB\xBF";
+    const char *ptr = buf, *end = NULL, *token_start = NULL, *token_end = NULL;
+    if (parser == NULL || (buf == NULL && buf_len > 0) || parser->state == STREAM_ERROR) {
+        return JSONFailure;
+    } else if (buf_len == 0) {
+        return JSONSuccess;
+    }
+    end = buf + buf_len;
+    if (parser->token != STREAM_TOKEN_NONE) { /* complete the token the last chunk ended in */
+        token_end = stream_find_token_end(parser, ptr, end);
+        if (stream_stash(parser, ptr, (size_t)((token_end != NULL ? token_end : end) - ptr)) ==
+            JSONFailure) {
+            goto error;
         }
-        written = json_serialize_string(string, buf);
-        if (written < 0) {
-            return -1;
+        if (token_end == NULL) {
+            return JSONSuccess;
         }
-        if (buf != NULL) {
-            buf += written;
+        ptr = parser->token == STREAM_TOKEN_STRING ? token_end + 1 : token_end;
+        if (stream_end_token(parser, parser->stash, parser->stash_len) == JSONFailure) {
+            goto error;
         }
-        written_total += written;
-        return written_total;
-    case JSONBoolean:
-        if (json_value_get_boolean(value)) {
-            APPEND_STRING("true");
-        } else {
-            APPEND_STRING("false");
+        parser->token = STREAM_TOKEN_NONE;
+        parser->stash_len = 0;
+    }
+    while (ptr < end) {
+        if (parser->bom_matched < 3) { /* Support for UTF-8 BOM */
+            if (*ptr == bom[parser->bom_matched]) {
+                parser->bom_matched++;
+                ptr++;
+                continue;
+            } else if (parser->bom_matched > 0) {
+                goto error;
+            }
+            parser->bom_matched = 3;
         }
-        return written_total;
-    case JSONNumber:
-        num = json_value_get_number(value);
-        if (buf != NULL) {
-            num_buf = buf;
+        if (IS_SPACE(*ptr)) {
+            ptr = skip_whitespaces(ptr, end);
+            continue;
         }
-        written = sprintf(num_buf, FLOAT_FORMAT, num);
-        if (written < 0) {
-            return -1;
+        if (parser->state == STREAM_DONE) {
+            return JSONSuccess;
         }
-        if (buf != NULL) {
-            buf += written;
+        if ((*ptr == '\"' && (parser->state == STREAM_VALUE || parser->state == STREAM_NAME)) ||
+            (parser->state == STREAM_VALUE && *ptr != '{' && *ptr != '[' && *ptr != ']')) {
+            parser->token = *ptr == '\"' ? STREAM_TOKEN_STRING : STREAM_TOKEN_BARE;
+            parser->escaped = 0;
+            parser->just_opened = 0;
+            token_start = parser->token == STREAM_TOKEN_STRING ? ptr + 1 : ptr;
+            token_end = stream_find_token_end(parser, token_start, end);
+            if (token_end == NULL) { /* keep it until the next chunk */
+                if (stream_stash(parser, token_start, (size_t)(end - token_start)) ==
+                    JSONFailure) {
+                    goto error;
+                }
+                return JSONSuccess;
+            }
+            if (stream_end_token(parser, token_start, (size_t)(token_end - token_start)) ==
+                JSONFailure) {
+                goto error;
+            }
+            ptr = parser->token == STREAM_TOKEN_STRING ? token_end + 1 : token_end;
+            parser->token = STREAM_TOKEN_NONE;
+            continue;
         }
-        written_total += written;
-        return written_total;
-    case JSONNull:
-        APPEND_STRING("null");
-        return written_total;
-    case JSONError:
-        return -1;
-    default:
-        return -1;
+        if (stream_structural(parser, *ptr) == JSONFailure) {
+            goto error;
+        }
+        ptr++;
     }
+    return JSONSuccess;
+error:
+    parser->state = STREAM_ERROR;
+    return JSONFailure;
 }
 
-static int json_serialize_string(const char *string, char *buf)
+JSON_Status json_stream_parser_finish(JSON_Stream_Parser *parser)
 {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
-    APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
-        switch (c) {
-        case '\"':
-            APPEND_STRING("\\\"");
-            break;
-        case '\\':
-            APPEND_STRING("\\\\");
-            break;
-        case '/':
-            APPEND_STRING("\\/");
-            break; /* to make json embeddable in xml\/html */
-        case '\b':
-            APPEND_STRING("\\b");
-            break;
-        case '\f':
-            APPEND_STRING("\\f");
-            break;
-        case '\n':
-            APPEND_STRING("\\n");
-            break;
-        case '\r':
-            APPEND_STRING("\\r");
-            break;
-        case '\t':
-            APPEND_STRING("\\t");
-            break;
-        case '\x00':
-            APPEND_STRING("\\u0000");
-            break;
-        case '\x01':
-            APPEND_STRING("\\u0001");
-            break;
-        case '\x02':
-            APPEND_STRING("\\u0002");
-            break;
-        case '\x03':
-            APPEND_STRING("\\u0003");
-            break;
-        case '\x04':
-            APPEND_STRING("\\u0004");
-            break;
-        case '\x05':
-            APPEND_STRING("\\u0005");
-            break;
-        case '\x06':
-            APPEND_STRING("\\u0006");
-            break;
-        case '\x07':
-            APPEND_STRING("\\u0007");
-            break;
-        /* '\x08' duplicate: '\b' */
-        /* '\x09' duplicate: '\t' */
-        /* '\x0a' duplicate: '\n' */
-        case '\x0b':
-            APPEND_STRING("\\u000b");
-            break;
-        /* '\x0c' duplicate: '\f' */
-        /* '\x0d' duplicate: '\r' */
-        case '\x0e':
-            APPEND_STRING("\\u000e");
-            break;
-        case '\x0f':
-            APPEND_STRING("\\u000f");
-            break;
-        case '\x10':
-            APPEND_STRING("\\u0010");
-            break;
-        case '\x11':
-            APPEND_STRING("\\u0011");
-            break;
-        case '\x12':
-            APPEND_STRING("\\u0012");
-            break;
-        case '\x13':
-            APPEND_STRING("\\u0013");
-            break;
-        case '\x14':
-            APPEND_STRING("\\u0014");
-            break;
-        case '\x15':
-            APPEND_STRING("\\u0015");
-            break;
-        case '\x16':
-            APPEND_STRING("\\u0016");
-            break;
-        case '\x17':
-            APPEND_STRING("\\u0017");
-            break;
-        case '\x18':
-            APPEND_STRING("\\u0018");
-            break;
-        case '\x19':
-            APPEND_STRING("\\u0019");
-            break;
-        case '\x1a':
-            APPEND_STRING("\\u001a");
-            break;
-        case '\x1b':
-            APPEND_STRING("\\u001b");
-            break;
-        case '\x1c':
-            APPEND_STRING("\\u001c");
-            break;
-        case '\x1d':
-            APPEND_STRING("\\u001d");
-            break;
-        case '\x1e':
-            APPEND_STRING("\\u001e");
-            break;
-        case '\x1f':
-            APPEND_STRING("\\u001f");
-            break;
-        default:
-            if (buf != NULL) {
-                buf[0] = c;
-                buf += 1;
-            }
-            written_total += 1;
-            break;
+    if (parser == NULL || parser->state == STREAM_ERROR) {
+        return JSONFailure;
+    }
+    if (parser->token == STREAM_TOKEN_BARE) { /* input ended a number or literal */
+        if (stream_end_token(parser, parser->stash, parser->stash_len) == JSONFailure) {
+            parser->state = STREAM_ERROR;
+            return JSONFailure;
         }
+        parser->token = STREAM_TOKEN_NONE;
+        parser->stash_len = 0;
     }
-    APPEND_STRING("\"");
-    return written_total;
+    if (parser->state != STREAM_DONE) {
+        parser->state = STREAM_ERROR;
+        return JSONFailure;
+    }
+    return JSONSuccess;
 }
 
-static int append_indent(char *buf, int level)
+JSON_Value *json_stream_parser_detach_value(JSON_Stream_Parser *parser)
 {
-    int i;
-    int written = -1, written_total = 0;
-    for (i = 0; i < level; i++) {
-        APPEND_STRING("    ");
+    JSON_Value *value = NULL;
+    if (parser == NULL || parser->state != STREAM_DONE || parser->token != STREAM_TOKEN_NONE) {
+        return NULL;
     }
-    return written_total;
+    value = parser->root;
+    parser->root = NULL;
+    return value;
 }
 
-static int append_string(char *buf, const char *string)
+void json_stream_parser_free(JSON_Stream_Parser *parser)
 {
-    if (buf == NULL) {
-        return (int)strlen(string);
+    if (parser == NULL) {
+        return;
+    }
+    json_value_free(parser->root);
+    parson_free(parser->stash);
+    parson_free(parser->name);
+    parson_free(parser->string);
+    parson_free(parser);
+}
+
+/* Arena API */
+JSON_Arena *json_arena_create(size_t block_size)
+{
+    JSON_Arena *arena = NULL;
+    if (block_size == 0) {
+        return NULL;
+    }
+    arena = (JSON_Arena *)parson_malloc(sizeof(JSON_Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->malloc_fun = parson_malloc;
+    arena->free_fun = parson_free;
+    return arena;
+}
+
+JSON_Arena *json_arena_create_in_buffer(void *buffer, size_t buffer_size)
+{
+    char *start = (char *)buffer;
+    size_t header_size = 0, padding = 0;
+    JSON_Arena *arena = NULL;
+    JSON_Arena_Block *block = NULL;
+    if (buffer == NULL) {
+        return NULL;
+    }
+    padding = (ARENA_ALIGNMENT - ((size_t)start % ARENA_ALIGNMENT)) % ARENA_ALIGNMENT;
+    header_size = padding + ARENA_ALIGN(sizeof(JSON_Arena)) + ARENA_ALIGN(sizeof(JSON_Arena_Block));
+    if (buffer_size <= header_size) {
+        return NULL;
+    }
+    arena = (JSON_Arena *)(start + padding);
+    block = (JSON_Arena_Block *)((char *)arena + ARENA_ALIGN(sizeof(JSON_Arena)));
+    block->next = NULL;
+    block->size = buffer_size - header_size;
+    block->used = 0;
+    arena->blocks = block;
+    arena->block_size = 0;
+    arena->malloc_fun = NULL;
+    arena->free_fun = NULL;
+    return arena;
+}
+
+void json_arena_reset(JSON_Arena *arena)
+{
+    JSON_Arena_Block *oldest = NULL;
+    if (arena == NULL || arena->blocks == NULL) {
+        return;
+    }
+    oldest = arena->blocks;
+    while (oldest->next != NULL) {
+        oldest = oldest->next;
     }
-    return sprintf(buf, "%s", string);
+    json_arena_free_blocks(arena, oldest);
+    oldest->used = 0;
 }
 
-#undef APPEND_STRING
-#undef APPEND_INDENT
-
-/* Parser API */
-JSON_Value *json_parse_string(const char *string)
+void json_arena_release(JSON_Arena *arena)
 {
-    if (string == NULL) {
-        return NULL;
+    if (arena == NULL) {
+        return;
     }
-    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
-        string = string + 3; /* Support for UTF-8 BOM */
+    if (arena->block_size == 0) { /* lives in caller's buffer */
+        arena->blocks->used = 0;
+        return;
     }
-    return parse_value((const char **)&string, 0);
+    json_arena_free_blocks(arena, NULL);
+    arena->free_fun(arena);
 }
 
-JSON_Value *json_parse_string_with_comments(const char *string)
+size_t json_arena_get_used(const JSON_Arena *arena)
 {
-    JSON_Value *result = NULL;
-    char *string_mutable_copy = NULL, *string_mutable_copy_ptr = NULL;
-    string_mutable_copy = parson_strdup(string);
-    if (string_mutable_copy == NULL) {
-        return NULL;
+    size_t used = 0;
+    const JSON_Arena_Block *block = NULL;
+    if (arena == NULL) {
+        return 0;
     }
-    remove_comments(string_mutable_copy, "/*", "*/");
-    remove_comments(string_mutable_copy, "//", "\n");
-    string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
-    parson_free(string_mutable_copy);
-    return result;
+    for (block = arena->blocks; block != NULL; block = block->next) {
+        used += block->used;
+    }
+    return used;
 }
 
 /* JSON Object API */
@@ -1312,6 +4866,77 @@ int json_object_dotget_boolean(const JSON_Object *object, const char *name)
     return json_value_get_boolean(json_object_dotget_value(object, name));
 }
 
+JSON_Path *json_path_compile(const char *dotted_path)
+{
+    return json_path_create(dotted_path, '.', 0);
+}
+
+JSON_Path *json_path_compile_pointer(const char *pointer)
+{
+    return json_path_create(pointer, '/', 1);
+}
+
+void json_path_free(JSON_Path *path)
+{
+    parson_free(path);
+}
+
+JSON_Value *json_object_pathget_value(const JSON_Object *object, const JSON_Path *path)
+{
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Value *value = NULL;
+    size_t i = 0, position = 0;
+    if (object == NULL || path == NULL) {
+        return NULL;
+    }
+    value = json_object_get_wrapping_value(object);
+    for (i = 0; i < path->count; i++) {
+        segment = &path->segments[i];
+        switch (json_value_get_type(value)) {
+        case JSONObject:
+            object = json_value_get_object(value);
+            position = json_object_find_hashed(object, segment->name, segment->name_len,
+                                               segment->hash, 1);
+            if (position == json_object_get_count(object)) {
+                return NULL;
+            }
+            value = object->values[position];
+            break;
+        case JSONArray: /* PATH_NO_INDEX is out of range */
+            value = json_array_get_value(json_value_get_array(value), segment->index);
+            break;
+        default:
+            return NULL;
+        }
+    }
+    return value;
+}
+
+const char *json_object_pathget_string(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_string(json_object_pathget_value(object, path));
+}
+
+double json_object_pathget_number(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_number(json_object_pathget_value(object, path));
+}
+
+JSON_Object *json_object_pathget_object(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_object(json_object_pathget_value(object, path));
+}
+
+JSON_Array *json_object_pathget_array(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_array(json_object_pathget_value(object, path));
+}
+
+int json_object_pathget_boolean(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_boolean(json_object_pathget_value(object, path));
+}
+
 size_t json_object_get_count(const JSON_Object *object)
 {
     return object ? object->count : 0;
@@ -1413,12 +5038,24 @@ JSON_Value_Type json_value_get_type(const JSON_Value *value)
 
 JSON_Object *json_value_get_object(const JSON_Value *value)
 {
-    return json_value_get_type(value) == JSONObject ? value->value.object : NULL;
+    if (json_value_get_type(value) != JSONObject) {
+        return NULL;
+    }
+    if (value->is_lazy && json_value_expand((JSON_Value *)value) == JSONFailure) {
+        return NULL;
+    }
+    return value->value.object;
 }
 
 JSON_Array *json_value_get_array(const JSON_Value *value)
 {
-    return json_value_get_type(value) == JSONArray ? value->value.array : NULL;
+    if (json_value_get_type(value) != JSONArray) {
+        return NULL;
+    }
+    if (value->is_lazy && json_value_expand((JSON_Value *)value) == JSONFailure) {
+        return NULL;
+    }
+    return value->value.array;
 }
 
 const char *json_value_get_string(const JSON_Value *value)
@@ -1443,58 +5080,42 @@ JSON_Value *json_value_get_parent(const JSON_Value *value)
 
 void json_value_free(JSON_Value *value)
 {
-    switch (json_value_get_type(value)) {
-    case JSONObject:
-        json_object_free(value->value.object);
-        break;
-    case JSONString:
-        parson_free(value->value.string);
-        break;
-    case JSONArray:
-        json_array_free(value->value.array);
-        break;
-    default:
-        break;
-    }
+    json_value_free_contents(value);
     parson_free(value);
 }
 
 JSON_Value *json_value_init_object(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Object_Value *new_value = (JSON_Object_Value *)parson_malloc(sizeof(JSON_Object_Value));
     if (!new_value) {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONObject;
-    new_value->value.object = json_object_init(new_value);
-    if (!new_value->value.object) {
-        parson_free(new_value);
-        return NULL;
-    }
-    return new_value;
+    new_value->value.parent = NULL;
+    new_value->value.type = JSONObject;
+    new_value->value.is_inline = 1;
+    new_value->value.is_lazy = 0;
+    new_value->value.value.object = &new_value->object;
+    json_object_init(&new_value->object, &new_value->value);
+    return &new_value->value;
 }
 
 JSON_Value *json_value_init_array(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Array_Value *new_value = (JSON_Array_Value *)parson_malloc(sizeof(JSON_Array_Value));
     if (!new_value) {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONArray;
-    new_value->value.array = json_array_init(new_value);
-    if (!new_value->value.array) {
-        parson_free(new_value);
-        return NULL;
-    }
-    return new_value;
+    new_value->value.parent = NULL;
+    new_value->value.type = JSONArray;
+    new_value->value.is_inline = 1;
+    new_value->value.is_lazy = 0;
+    new_value->value.value.array = &new_value->array;
+    json_array_init(&new_value->array, &new_value->value);
+    return &new_value->value;
 }
 
 JSON_Value *json_value_init_string(const char *string)
 {
-    char *copy = NULL;
-    JSON_Value *value;
     size_t string_len = 0;
     if (string == NULL) {
         return NULL;
@@ -1503,15 +5124,7 @@ JSON_Value *json_value_init_string(const char *string)
     if (!is_valid_utf8(string, string_len)) {
         return NULL;
     }
-    copy = parson_strndup(string, string_len);
-    if (copy == NULL) {
-        return NULL;
-    }
-    value = json_value_init_string_no_copy(copy);
-    if (value == NULL) {
-        parson_free(copy);
-    }
-    return value;
+    return json_value_init_string_copy(string, string_len);
 }
 
 JSON_Value *json_value_init_number(double number)
@@ -1526,6 +5139,8 @@ JSON_Value *json_value_init_number(double number)
     }
     new_value->parent = NULL;
     new_value->type = JSONNumber;
+    new_value->is_inline = 0;
+    new_value->is_lazy = 0;
     new_value->value.number = number;
     return new_value;
 }
@@ -1538,6 +5153,8 @@ JSON_Value *json_value_init_boolean(int boolean)
     }
     new_value->parent = NULL;
     new_value->type = JSONBoolean;
+    new_value->is_inline = 0;
+    new_value->is_lazy = 0;
     new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
 }
@@ -1550,6 +5167,8 @@ JSON_Value *json_value_init_null(void)
     }
     new_value->parent = NULL;
     new_value->type = JSONNull;
+    new_value->is_inline = 0;
+    new_value->is_lazy = 0;
     return new_value;
 }
 
@@ -1558,12 +5177,14 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
     size_t i = 0;
     JSON_Value *return_value = NULL, *temp_value_copy = NULL, *temp_value = NULL;
     const char *temp_string = NULL, *temp_key = NULL;
-    char *temp_string_copy = NULL;
     JSON_Array *temp_array = NULL, *temp_array_copy = NULL;
     JSON_Object *temp_object = NULL, *temp_object_copy = NULL;
 
     switch (json_value_get_type(value)) {
     case JSONArray:
+        if (!value->value.array->in_arena) {
+            return json_value_init_copy(value);
+        }
         temp_array = json_value_get_array(value);
         return_value = json_value_init_array();
         if (return_value == NULL) {
@@ -1585,6 +5206,9 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
         }
         return return_value;
     case JSONObject:
+        if (!value->value.object->in_arena) {
+            return json_value_init_copy(value);
+        }
         temp_object = json_value_get_object(value);
         return_value = json_value_init_object();
         if (return_value == NULL) {
@@ -1615,15 +5239,7 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
         if (temp_string == NULL) {
             return NULL;
         }
-        temp_string_copy = parson_strdup(temp_string);
-        if (temp_string_copy == NULL) {
-            return NULL;
-        }
-        return_value = json_value_init_string_no_copy(temp_string_copy);
-        if (return_value == NULL) {
-            parson_free(temp_string_copy);
-        }
-        return return_value;
+        return json_value_init_string_copy(temp_string, strlen(temp_string));
     case JSONNull:
         return json_value_init_null();
     case JSONError:
@@ -1635,87 +5251,262 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
 
 size_t json_serialization_size(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return serialization_size(value, 0);
 }
 
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0) {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    return serialize_to_buffer(value, buf, buf_size_in_bytes, 0);
 }
 
 char *json_serialize_to_string(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
+    return serialize_to_string(value, 0);
+}
+
+JSON_Status json_serialize_to_sink(const JSON_Value *value, JSON_Sink_Function sink, void *context)
+{
+    return serialize_to_sink(value, sink, context, 0);
+}
+
+size_t json_serialize_number_to_buffer(double number, char *buf, size_t buf_size_in_bytes)
+{
+    char num_buf[NUM_BUF_SIZE];
+    int written = format_number(number, num_buf);
+    if (buf == NULL || written < 0 || (size_t)written >= buf_size_in_bytes) {
+        return 0;
     }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
+    memcpy(buf, num_buf, (size_t)written + 1);
+    return (size_t)written;
+}
+
+size_t json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes)
+{
+    JSON_Writer writer;
+    if (string == NULL || buf == NULL) {
+        return 0;
     }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
+    writer_init(&writer, buf, buf_size_in_bytes);
+    if (json_serialize_string(string, &writer) == JSONFailure ||
+        writer_append(&writer, "", 1) == JSONFailure) {
+        return 0;
     }
-    return buf;
+    return writer.len - 1;
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return serialization_size(value, 1);
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+    return serialize_to_buffer(value, buf, buf_size_in_bytes, 1);
+}
+
+char *json_serialize_to_string_pretty(const JSON_Value *value)
+{
+    return serialize_to_string(value, 1);
+}
+
+JSON_Status json_serialize_to_sink_pretty(const JSON_Value *value, JSON_Sink_Function sink,
+                                          void *context)
+{
+    return serialize_to_sink(value, sink, context, 1);
+}
+
+/* CBOR API */
+size_t json_value_to_cbor(const JSON_Value *value, unsigned char *buf, size_t buf_size)
+{
+    double started = stats_now();
+    JSON_CBOR_Writer writer;
+    size_t len = 0;
+    json_cbor_writer_init(&writer, buf, buf_size);
+    if (json_cbor_write_value(&writer, value) == JSONSuccess) {
+        len = json_cbor_writer_get_length(&writer);
+    }
+    stats_count_serialization(started);
+    return len;
+}
+
+JSON_Value *json_value_from_cbor(const unsigned char *buf, size_t buf_len)
+{
+    JSON_Stream_Parser builder; /* only root and current are used, by stream_build_value */
+    memset(&builder, 0, sizeof(builder));
+    if (json_parse_cbor_events(buf, buf_len, stream_build_value, &builder) == JSONFailure) {
+        if (builder.root != NULL) {
+            json_value_free(builder.root);
+        }
+        return NULL;
+    }
+    return builder.root;
+}
+
+JSON_Status json_parse_cbor_events(const unsigned char *buf, size_t buf_len,
+                                   JSON_Event_Function callback, void *context)
+{
+    char name_buf[PARSON_EVENT_BUFFER_SIZE], string_buf[PARSON_EVENT_BUFFER_SIZE];
+    JSON_CBOR_Parser parser;
+    JSON_Event event;
+    JSON_Status status = JSONFailure;
+    double started = 0.0;
+    if (buf == NULL || callback == NULL) {
+        return JSONFailure;
+    }
+    started = stats_now();
+    parser.ptr = buf;
+    parser.end = buf + buf_len;
+    parser.callback = callback;
+    parser.context = context;
+    parser.name_buf = name_buf;
+    parser.string_buf = string_buf;
+    memset(&event, 0, sizeof(event));
+    status = cbor_parse_item(&parser, &event, 0);
+    stats_count_parse(started);
+    return status;
+}
+
+void json_cbor_writer_init(JSON_CBOR_Writer *writer, unsigned char *buf, size_t buf_size)
+{
+    writer->buf = buf;
+    writer->buf_size = buf != NULL ? buf_size : 0;
+    writer->len = 0;
+    writer->failed = 0;
+}
+
+size_t json_cbor_writer_get_length(const JSON_CBOR_Writer *writer)
+{
+    return writer->failed ? 0 : writer->len;
+}
+
+JSON_Status json_cbor_write_object(JSON_CBOR_Writer *writer, size_t count)
+{
+    if (count == JSON_CBOR_INDEFINITE) {
+        cbor_put_head_sized(writer, CBOR_MAP, CBOR_INDEFINITE, 0);
+    } else {
+        cbor_put_head(writer, CBOR_MAP, count);
+    }
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_array(JSON_CBOR_Writer *writer, size_t count)
+{
+    if (count == JSON_CBOR_INDEFINITE) {
+        cbor_put_head_sized(writer, CBOR_ARRAY, CBOR_INDEFINITE, 0);
+    } else {
+        cbor_put_head(writer, CBOR_ARRAY, count);
+    }
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_end(JSON_CBOR_Writer *writer)
+{
+    cbor_put_head_sized(writer, CBOR_SIMPLE, CBOR_INDEFINITE, 0); /* break */
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_string(JSON_CBOR_Writer *writer, const char *string)
+{
+    size_t len = 0;
+    if (string == NULL) {
+        writer->failed = 1;
         return JSONFailure;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0) {
+    len = strlen(string);
+    if (!is_valid_utf8(string, len)) { /* CBOR text must be, json_value_from_cbor checks it */
+        writer->failed = 1;
         return JSONFailure;
     }
-    return JSONSuccess;
+    cbor_put_head(writer, CBOR_TEXT, len);
+    cbor_put(writer, string, len);
+    return writer->failed ? JSONFailure : JSONSuccess;
 }
 
-char *json_serialize_to_string_pretty(const JSON_Value *value)
+JSON_Status json_cbor_write_number(JSON_CBOR_Writer *writer, double number)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
+    uint64_t bits = 0;
+    uint32_t single_bits = 0;
+    float single = 0;
+    if ((number * 0.0) != 0.0) { /* nan and inf test */
+        writer->failed = 1;
+        return JSONFailure;
     }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
+    memcpy(&bits, &number, sizeof(bits));
+    if (number == floor(number) && number > -CBOR_TWO_TO_64 && number < CBOR_TWO_TO_64 &&
+        bits != (uint64_t)1 << 63) { /* whole, and not -0 */
+        if (number >= 0) {
+            cbor_put_head(writer, CBOR_UNSIGNED, (uint64_t)number);
+        } else {
+            cbor_put_head(writer, CBOR_NEGATIVE, (uint64_t)-number - 1);
+        }
+    } else if (fabs(number) <= FLT_MAX && (double)(single = (float)number) == number) {
+        memcpy(&single_bits, &single, sizeof(single_bits));
+        cbor_put_head_sized(writer, CBOR_SIMPLE, CBOR_FLOAT, single_bits);
+    } else {
+        cbor_put_head_sized(writer, CBOR_SIMPLE, CBOR_DOUBLE, bits);
     }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_boolean(JSON_CBOR_Writer *writer, int boolean)
+{
+    cbor_put_head(writer, CBOR_SIMPLE, boolean ? CBOR_TRUE : CBOR_FALSE);
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_null(JSON_CBOR_Writer *writer)
+{
+    cbor_put_head(writer, CBOR_SIMPLE, CBOR_NULL);
+    return writer->failed ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_cbor_write_value(JSON_CBOR_Writer *writer, const JSON_Value *value)
+{
+    const JSON_Object *object = NULL;
+    const JSON_Array *array = NULL;
+    size_t i = 0;
+    switch (json_value_get_type(value)) {
+    case JSONObject:
+        object = json_value_get_object(value);
+        if (object == NULL) { /* a lazy copy that couldn't be made */
+            writer->failed = 1;
+            break;
+        }
+        cbor_put_head(writer, CBOR_MAP, object->count);
+        for (i = 0; i < object->count; i++) {
+            if (json_cbor_write_string(writer, object->names[i]) == JSONFailure ||
+                json_cbor_write_value(writer, object->values[i]) == JSONFailure) {
+                return JSONFailure;
+            }
+        }
+        break;
+    case JSONArray:
+        array = json_value_get_array(value);
+        if (array == NULL) {
+            writer->failed = 1;
+            break;
+        }
+        cbor_put_head(writer, CBOR_ARRAY, array->count);
+        for (i = 0; i < array->count; i++) {
+            if (json_cbor_write_value(writer, array->items[i]) == JSONFailure) {
+                return JSONFailure;
+            }
+        }
+        break;
+    case JSONString:
+        return json_cbor_write_string(writer, value->value.string);
+    case JSONNumber:
+        return json_cbor_write_number(writer, value->value.number);
+    case JSONBoolean:
+        return json_cbor_write_boolean(writer, value->value.boolean);
+    case JSONNull:
+        return json_cbor_write_null(writer);
+    default:
+        writer->failed = 1;
+        break;
     }
-    return buf;
+    return writer->failed ? JSONFailure : JSONSuccess;
 }
 
 void json_free_serialized_string(char *string)
@@ -1726,7 +5517,8 @@ void json_free_serialized_string(char *string)
 JSON_Status json_array_remove(JSON_Array *array, size_t ix)
 {
     size_t to_move_bytes = 0;
-    if (array == NULL || ix >= json_array_get_count(array)) {
+    if (array == NULL || ix >= json_array_get_count(array) ||
+        json_value_unshare(json_array_get_wrapping_value(array)) == JSONFailure) {
         return JSONFailure;
     }
     json_value_free(json_array_get_value(array, ix));
@@ -1739,7 +5531,8 @@ JSON_Status json_array_remove(JSON_Array *array, size_t ix)
 JSON_Status json_array_replace_value(JSON_Array *array, size_t ix, JSON_Value *value)
 {
     if (array == NULL || value == NULL || value->parent != NULL ||
-        ix >= json_array_get_count(array)) {
+        ix >= json_array_get_count(array) ||
+        json_value_unshare(json_array_get_wrapping_value(array)) == JSONFailure) {
         return JSONFailure;
     }
     json_value_free(json_array_get_value(array, ix));
@@ -1803,7 +5596,7 @@ JSON_Status json_array_replace_null(JSON_Array *array, size_t i)
 JSON_Status json_array_clear(JSON_Array *array)
 {
     size_t i = 0;
-    if (array == NULL) {
+    if (array == NULL || json_value_unshare(json_array_get_wrapping_value(array)) == JSONFailure) {
         return JSONFailure;
     }
     for (i = 0; i < json_array_get_count(array); i++) {
@@ -1815,7 +5608,8 @@ JSON_Status json_array_clear(JSON_Array *array)
 
 JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value)
 {
-    if (array == NULL || value == NULL || value->parent != NULL) {
+    if (array == NULL || value == NULL || value->parent != NULL ||
+        json_value_unshare(json_array_get_wrapping_value(array)) == JSONFailure) {
         return JSONFailure;
     }
     return json_array_add(array, value);
@@ -1877,19 +5671,17 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
 {
     size_t i = 0;
     JSON_Value *old_value;
-    if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
+    if (object == NULL || name == NULL || value == NULL || value->parent != NULL ||
+        json_value_unshare(json_object_get_wrapping_value(object)) == JSONFailure) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_find(object, name, strlen(name));
+    if (i < json_object_get_count(object)) { /* free and overwrite old value */
+        old_value = object->values[i];
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -1950,7 +5742,10 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
         json_value_free(new_value);
         return JSONFailure;
     }
-    status = json_object_addn(object, name, name_len, new_value);
+    status = json_value_unshare(json_object_get_wrapping_value(object));
+    if (status == JSONSuccess) {
+        status = json_object_addn(object, name, name_len, new_value);
+    }
     if (status != JSONSuccess) {
         json_object_dotremove_internal(new_object, dot_pos + 1, 0);
         json_value_free(new_value);
@@ -2024,14 +5819,18 @@ JSON_Status json_object_dotremove(JSON_Object *object, const char *name)
 JSON_Status json_object_clear(JSON_Object *object)
 {
     size_t i = 0;
-    if (object == NULL) {
+    if (object == NULL ||
+        json_value_unshare(json_object_get_wrapping_value(object)) == JSONFailure) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        json_object_free_name(object, object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    if (object->index != NULL) {
+        memset(object->index, 0, object->index_capacity * sizeof(size_t));
+    }
     return JSONSuccess;
 }
 
@@ -2108,6 +5907,9 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     const char *key = NULL;
     size_t a_count = 0, b_count = 0, i = 0;
     JSON_Value_Type a_type, b_type;
+    if (json_value_get_source(a) == json_value_get_source(b)) {
+        return 1; /* the same value, a lazy copy of the other, or both of the same */
+    }
     a_type = json_value_get_type(a);
     b_type = json_value_get_type(b);
     if (a_type != b_type) {
@@ -2117,6 +5919,9 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     case JSONArray:
         a_array = json_value_get_array(a);
         b_array = json_value_get_array(b);
+        if (a_array == NULL || b_array == NULL) {
+            return 0; /* a lazy copy that couldn't be made */
+        }
         a_count = json_array_get_count(a_array);
         b_count = json_array_get_count(b_array);
         if (a_count != b_count) {
@@ -2132,6 +5937,9 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     case JSONObject:
         a_object = json_value_get_object(a);
         b_object = json_value_get_object(b);
+        if (a_object == NULL || b_object == NULL) {
+            return 0; /* a lazy copy that couldn't be made */
+        }
         a_count = json_object_get_count(a_object);
         b_count = json_object_get_count(b_object);
         if (a_count != b_count) {
@@ -2165,6 +5973,50 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     }
 }
 
+JSON_Value *json_value_diff(const JSON_Value *from, const JSON_Value *to)
+{
+    JSON_Value *patch = NULL;
+    if (json_value_get_type(from) != JSONObject || json_value_get_type(to) != JSONObject) {
+        return json_value_deep_copy(to); /* only replacing it can turn from into to */
+    }
+    patch = json_value_init_object();
+    if (patch == NULL) {
+        return NULL;
+    }
+    if (json_object_diff(json_value_get_object(from), json_value_get_object(to),
+                         json_value_get_object(patch)) == JSONFailure) {
+        json_value_free(patch);
+        return NULL;
+    }
+    return patch;
+}
+
+JSON_Status json_value_apply_merge_patch(JSON_Value *target, const JSON_Value *patch)
+{
+    JSON_Value *replacement = NULL;
+    if (target == NULL || patch == NULL) {
+        return JSONFailure;
+    }
+    if (json_value_get_type(patch) != JSONObject) {
+        replacement = json_value_deep_copy(patch);
+    } else if (json_value_get_type(target) != JSONObject) {
+        replacement = json_value_init_object();
+    }
+    if (replacement != NULL) {
+        if (json_value_move_contents(target, replacement) == JSONFailure) {
+            json_value_free(replacement);
+            return JSONFailure;
+        }
+    } else if (json_value_get_type(target) != JSONObject) {
+        return JSONFailure;
+    }
+    if (json_value_get_type(patch) != JSONObject) {
+        return JSONSuccess;
+    }
+    return json_object_apply_merge_patch(json_value_get_object(target),
+                                         json_value_get_object(patch));
+}
+
 JSON_Value_Type json_type(const JSON_Value *value)
 {
     return json_value_get_type(value);
@@ -2197,6 +6049,43 @@ int json_boolean(const JSON_Value *value)
 
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun)
 {
+#if defined(PARSON_STATS)
+    stats_malloc_fun = malloc_fun;
+    stats_free_fun = free_fun;
+#else
     parson_malloc = malloc_fun;
     parson_free = free_fun;
+#endif
+}
+
+void json_set_key_interning(int enabled)
+{
+    key_interning = enabled != 0;
+}
+
+size_t json_key_pool_get_count(void)
+{
+    return key_pool.count;
+}
+
+void json_stats_get(JSON_Stats *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+#if defined(PARSON_STATS)
+    *stats = parson_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void json_stats_reset(void)
+{
+#if defined(PARSON_STATS)
+    size_t bytes_live = parson_stats.bytes_live;
+    memset(&parson_stats, 0, sizeof(parson_stats));
+    parson_stats.bytes_live = bytes_live;
+    parson_stats.bytes_peak = bytes_live;
+#endif
 }
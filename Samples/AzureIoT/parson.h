@@ -1,8 +1,29 @@
 ﻿/*
-    This source code comes from Git repository
-    https://github.com/kgabis/parson at commit id 4f3eaa6
-    Patched to avoid any usage of fopen(), and removed implicit
-    cast warnings by making them explicit.
+    This source code started from Git repository
+    https://github.com/kgabis/parson at commit id 4f3eaa6, patched to avoid any
+    usage of fopen(), and with implicit cast warnings removed by making them
+    explicit. It has since been extended well beyond upstream, so don't replace
+    it with a newer upstream version; port upstream fixes by hand instead.
+    The local extensions are:
+    - a hash index for lookups in large objects (PARSON_OBJECT_INDEX_THRESHOLD)
+      and compiled paths (json_path_compile, json_object_pathget_*);
+    - arena parsing (json_parse_string_arena, json_parse_buffer_in_situ);
+    - length-delimited input (json_parse_buffer);
+    - the event parser (json_parse_events) and the resumable stream parser
+      (json_stream_parser_create);
+    - SSE2/NEON scanning (PARSON_DISABLE_SIMD to turn it off);
+    - exact fast number parsing and shortest round-trip number output
+      (PARSON_DISABLE_FAST_NUMBERS to turn them off);
+    - serialization through a growable buffer or a sink, in a single pass;
+    - JSON merge patch diff and apply (json_value_diff);
+    - interning of member names (json_set_key_interning);
+    - CBOR encoding and decoding (json_value_to_cbor, json_value_from_cbor);
+    - values allocated together with their contents, iterative parsing and
+      serialization, lazy parsing (json_parse_string_lazy) and lazy
+      copy-on-write deep copies;
+    - allocation and time counters (PARSON_STATS, json_stats_get).
+    parson_schema.c builds on the event parser, and Host/ holds the tests
+    and benchmarks covering these.
 */
 
 /*
@@ -41,6 +62,9 @@ extern "C" {
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t JSON_Array;
 typedef struct json_value_t JSON_Value;
+typedef struct json_arena_t JSON_Arena;
+typedef struct json_stream_parser_t JSON_Stream_Parser;
+typedef struct json_path_t JSON_Path;
 
 enum json_value_type {
     JSONError = -1,
@@ -59,10 +83,82 @@ typedef int JSON_Status;
 typedef void *(*JSON_Malloc_Function)(size_t);
 typedef void (*JSON_Free_Function)(void *);
 
+enum json_event_type {
+    JSONEventObjectStart = 1,
+    JSONEventObjectEnd = 2,
+    JSONEventArrayStart = 3,
+    JSONEventArrayEnd = 4,
+    JSONEventString = 5,
+    JSONEventNumber = 6,
+    JSONEventBoolean = 7,
+    JSONEventNull = 8
+};
+typedef int JSON_Event_Type;
+
+/* Reported to a JSON_Event_Function for every value and container end found while parsing.
+   Strings aren't NUL terminated and are only valid during the callback: they point either into
+   the parsed buffer or, if they had to be unescaped, into the parser's scratch space. Those too
+   long for the scratch space are reported as they are in the buffer, escapes included, with
+   name_escaped or string_escaped set; json_event_unescape gets them unescaped. */
+typedef struct json_event_t {
+    JSON_Event_Type type;
+    size_t depth;       /* 0 for the root value, 1 for its members or items and so on */
+    const char *name;   /* member name for values and container starts in an object, else NULL */
+    size_t name_len;
+    int name_escaped;   /* name is still escaped */
+    const char *string; /* JSONEventString */
+    size_t string_len;
+    int string_escaped; /* string is still escaped */
+    double number;      /* JSONEventNumber */
+    int boolean;        /* JSONEventBoolean */
+} JSON_Event;
+
+/* Return JSONFailure to stop parsing */
+typedef JSON_Status (*JSON_Event_Function)(const JSON_Event *event, void *context);
+
+/* Receives serialized output in pieces. Return JSONFailure to stop serializing */
+typedef JSON_Status (*JSON_Sink_Function)(const char *data, size_t len, void *context);
+
+/* Count of an object or array whose members or items are ended by json_cbor_write_end */
+#define JSON_CBOR_INDEFINITE ((size_t)-1)
+
+/* State of a CBOR encoder, see json_cbor_writer_init. Don't change the fields directly. */
+typedef struct json_cbor_writer_t {
+    unsigned char *buf;
+    size_t buf_size;
+    size_t len; /* bytes written so far */
+    int failed; /* a write didn't fit or was invalid */
+} JSON_CBOR_Writer;
+
 /* Call only once, before calling any other function from parson API. If not called, malloc and free
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/*  While enabled, objects created from then on (outside arenas) don't keep a copy of each member
+    name but share one per distinct name through a global key pool, and look names up by
+    comparing pointers. A pooled name is freed with the last member using it. Objects keep the
+    mode they were created in. Disabled by default. */
+void json_set_key_interning(int enabled);
+size_t json_key_pool_get_count(void); /* distinct names currently pooled */
+
+/*  Counters kept when parson.c is built with PARSON_STATS defined, which makes each allocation
+    carry a small header recording its size. Without it, json_stats_get gives all zeros. Parses
+    are calls to json_parse_* (apart from the stream parser) and json_value_from_cbor, and
+    serializations calls to json_serialize_* and json_value_to_cbor; times are in seconds. */
+typedef struct json_stats_t {
+    size_t allocations;
+    size_t frees;
+    size_t bytes_live; /* allocated and not freed yet, as requested from parson's allocator */
+    size_t bytes_peak; /* highest bytes_live */
+    size_t parses;
+    double parse_seconds;
+    size_t serializations;
+    double serialize_seconds;
+} JSON_Stats;
+
+void json_stats_get(JSON_Stats *stats);
+void json_stats_reset(void); /* zeroes all counters but bytes_live, which bytes_peak restarts at */
+
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value *json_parse_string(const char *string);
 
@@ -70,23 +166,142 @@ JSON_Value *json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
 
+/*  Parses first JSON value in a string, allocating every node and string from arena.
+    The result is read only: don't modify it or pass it to json_value_free, it's released
+    together with the arena. Memory used by a failed parse is given back to the arena.
+    Not reentrant. Returns NULL in case of error or if the arena is out of memory. */
+JSON_Value *json_parse_string_arena(const char *string, JSON_Arena *arena);
+
+/*  Same as above, but parse first JSON value in buf_len bytes of buf, which doesn't have to be
+    NUL terminated */
+JSON_Value *json_parse_buffer(const char *buf, size_t buf_len);
+JSON_Value *json_parse_buffer_arena(const char *buf, size_t buf_len, JSON_Arena *arena);
+
+/*  Like json_parse_buffer_arena, but strings and names are unescaped in place in buf and
+    referenced instead of copied. buf is modified and must outlive the arena's values. */
+JSON_Value *json_parse_buffer_in_situ(char *buf, size_t buf_len, JSON_Arena *arena);
+
+/*  Parses first JSON value in a string lazily: objects and arrays are only matched up by their
+    brackets, and the members of each are parsed the first time it's accessed through
+    json_value_get_object or json_value_get_array, which json_object_get_* and the like call.
+    Subtrees that are never accessed are only scanned over. The document is copied, the copy
+    being freed once all its objects and arrays are parsed or freed. As the document is only
+    checked as a whole when all of it is accessed, an object or array can turn out malformed
+    when it's accessed: json_value_get_object and json_value_get_array then return NULL for it,
+    and so does every accessor going through it, each time it's accessed. It keeps its type,
+    and serializing anything it's in fails, as does comparing it. Returns NULL in case of
+    error. */
+JSON_Value *json_parse_string_lazy(const char *string);
+JSON_Value *json_parse_buffer_lazy(const char *buf, size_t buf_len);
+
+/*  Parses first JSON value in buf_len bytes of buf without building it, calling callback for
+    each event in document order. Memory use doesn't depend on the document: strings are
+    reported in place or unescaped into PARSON_EVENT_BUFFER_SIZE bytes of scratch space, and
+    names and strings that contain escapes and are longer than that are checked but reported
+    still escaped (see JSON_Event). Unlike the json_parse_* functions, which fail on an object
+    with the same member name twice, it reports every member, so callers that need that
+    strictness have to check for duplicate names themselves.
+    Returns JSONFailure if the JSON is invalid or callback returned JSONFailure. */
+JSON_Status json_parse_events(const char *buf, size_t buf_len, JSON_Event_Function callback,
+                              void *context);
+/*  Compares the event's name, unescaped if need be, with name. 0 if event has no name. */
+int json_event_name_equals(const JSON_Event *event, const char *name);
+/*  Unescapes len bytes of a name or string reported still escaped into buf and NUL terminates
+    it. Returns JSONFailure if that takes more than buf_size bytes. unescaped_len may be NULL. */
+JSON_Status json_event_unescape(const char *string, size_t len, char *buf, size_t buf_size,
+                                size_t *unescaped_len);
+
+/*  Incremental parsing of a document that arrives in chunks, e.g. while it downloads. Chunks
+    can split the input anywhere; only the token a chunk ends in is kept until the next one
+    completes it, so memory use is bounded by the longest token, not the document.
+    Events are reported to callback as for json_parse_events. If callback is NULL the parser
+    builds the value instead; take it with json_stream_parser_detach_value after finishing.
+    A failed feed or finish leaves the parser failed, feed it nothing more but free it. */
+JSON_Stream_Parser *json_stream_parser_create(JSON_Event_Function callback, void *context);
+JSON_Status json_stream_parser_feed(JSON_Stream_Parser *parser, const char *buf, size_t buf_len);
+JSON_Status json_stream_parser_finish(JSON_Stream_Parser *parser); /* fails if input incomplete */
+JSON_Value *json_stream_parser_detach_value(JSON_Stream_Parser *parser); /* caller frees it */
+void json_stream_parser_free(JSON_Stream_Parser *parser);
+
+/* Arenas */
+JSON_Arena *json_arena_create(size_t block_size); /* grows in blocks of block_size bytes */
+JSON_Arena *json_arena_create_in_buffer(void *buffer,
+                                        size_t buffer_size); /* never allocates or grows */
+void json_arena_reset(JSON_Arena *arena);   /* drops all values, keeps one block for reuse */
+void json_arena_release(JSON_Arena *arena); /* drops all values and frees the arena */
+size_t json_arena_get_used(const JSON_Arena *arena); /* bytes handed out to values */
+
 /* Serialization */
 size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 char *json_serialize_to_string(const JSON_Value *value);
+/*  Serializes in a single pass, handing the output to sink in pieces of up to
+    PARSON_SERIALIZATION_BUFFER_SIZE bytes. Long runs of a string that need no escaping may be
+    handed over as one larger piece. The output isn't NUL terminated. */
+JSON_Status json_serialize_to_sink(const JSON_Value *value, JSON_Sink_Function sink, void *context);
+/*  Serialize a single number or string as json_serialize_to_string would, for writing JSON
+    without building values. Return the length written to buf before its NUL terminator, or 0 if
+    buf is too small. */
+size_t json_serialize_number_to_buffer(double number, char *buf, size_t buf_size_in_bytes);
+size_t json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes);
 
 /* Pretty serialization */
 size_t json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes);
 char *json_serialize_to_string_pretty(const JSON_Value *value);
+JSON_Status json_serialize_to_sink_pretty(const JSON_Value *value, JSON_Sink_Function sink,
+                                          void *context);
 
 void json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and
                                                    json_serialize_to_string_pretty */
 
+/* CBOR (RFC 8949) */
+/*  Encodes value as CBOR into buf. Whole numbers become integers, other numbers single precision
+    floats if that holds them exactly, else double precision ones. With buf NULL nothing is
+    written, but the size needed is still returned. Returns the number of bytes written, or 0 if
+    buf is too small or a string or name isn't valid UTF-8, which CBOR text must be. */
+size_t json_value_to_cbor(const JSON_Value *value, unsigned char *buf, size_t buf_size);
+/*  Decodes the first CBOR item in buf_len bytes of buf. Map keys must be text strings. Tags are
+    ignored and undefined decodes as null; byte strings, other simple values, nan and infinity,
+    which JSON has no equivalent of, fail the decode. Returns NULL in case of error. */
+JSON_Value *json_value_from_cbor(const unsigned char *buf, size_t buf_len);
+/*  Like json_parse_events, for the first CBOR item in buf. Strings point into buf, unless they
+    were sent in chunks: those are joined in PARSON_EVENT_BUFFER_SIZE bytes of scratch space, and
+    longer ones fail the parse. */
+JSON_Status json_parse_cbor_events(const unsigned char *buf, size_t buf_len,
+                                   JSON_Event_Function callback, void *context);
+
+/*  Encodes CBOR item by item, without building values. Objects and arrays start with the number
+    of members or items that follow, or JSON_CBOR_INDEFINITE and are then ended with
+    json_cbor_write_end. A member is its name, written as a string, followed by its value.
+    Failures are sticky, every write after one fails too, so checking the length at the end is
+    enough. With buf NULL nothing is written but the length is still counted. */
+void json_cbor_writer_init(JSON_CBOR_Writer *writer, unsigned char *buf, size_t buf_size);
+JSON_Status json_cbor_write_object(JSON_CBOR_Writer *writer, size_t count);
+JSON_Status json_cbor_write_array(JSON_CBOR_Writer *writer, size_t count);
+JSON_Status json_cbor_write_end(JSON_CBOR_Writer *writer);
+JSON_Status json_cbor_write_string(JSON_CBOR_Writer *writer, const char *string); /* UTF-8 */
+JSON_Status json_cbor_write_number(JSON_CBOR_Writer *writer, double number); /* not nan or inf */
+JSON_Status json_cbor_write_boolean(JSON_CBOR_Writer *writer, int boolean);
+JSON_Status json_cbor_write_null(JSON_CBOR_Writer *writer);
+JSON_Status json_cbor_write_value(JSON_CBOR_Writer *writer, const JSON_Value *value);
+size_t json_cbor_writer_get_length(const JSON_CBOR_Writer *writer); /* 0 if a write failed */
+
 /* Comparing */
 int json_value_equals(const JSON_Value *a, const JSON_Value *b);
 
+/* Merge patches (RFC 7386) */
+/*  Returns a merge patch with just the members that differ between from and to, which turns from
+    into to when applied to it, or an empty object if nothing differs. Values are compared with
+    json_value_equals and arrays are replaced as a whole. Merge patches can't set a member to
+    null, so null members of to end up removed. Returns NULL in case of error. */
+JSON_Value *json_value_diff(const JSON_Value *from, const JSON_Value *to);
+/*  Applies a merge patch in place, e.g. a partial desired properties update to the desired
+    properties. If patch isn't an object it replaces target's contents. Target is left partially
+    patched if allocation fails. */
+JSON_Status json_value_apply_merge_patch(JSON_Value *target, const JSON_Value *patch);
+
 /* Validation
    This is *NOT* JSON Schema. It validates json by checking if object have identically
    named fields with matching types.
@@ -122,6 +337,23 @@ double json_object_dotget_number(const JSON_Object *object,
 int json_object_dotget_boolean(const JSON_Object *object,
                                const char *name); /* returns -1 on fail */
 
+/* A path queried repeatedly, e.g. on every twin update, can be compiled once into names with
+ their hashes worked out. json_path_compile takes the dot notation of dotget functions,
+ json_path_compile_pointer a JSON Pointer (RFC 6901, e.g. "/objectA/items/0/value"), which can
+ also address names containing dots and array items. pathget functions return like dotget ones.
+ Compiling returns NULL if pointer is malformed or allocation fails. */
+JSON_Path *json_path_compile(const char *dotted_path);
+JSON_Path *json_path_compile_pointer(const char *pointer);
+void json_path_free(JSON_Path *path);
+JSON_Value *json_object_pathget_value(const JSON_Object *object, const JSON_Path *path);
+const char *json_object_pathget_string(const JSON_Object *object, const JSON_Path *path);
+JSON_Object *json_object_pathget_object(const JSON_Object *object, const JSON_Path *path);
+JSON_Array *json_object_pathget_array(const JSON_Object *object, const JSON_Path *path);
+double json_object_pathget_number(const JSON_Object *object,
+                                  const JSON_Path *path); /* returns 0 on fail */
+int json_object_pathget_boolean(const JSON_Object *object,
+                                const JSON_Path *path); /* returns -1 on fail */
+
 /* Functions to get available names */
 size_t json_object_get_count(const JSON_Object *object);
 const char *json_object_get_name(const JSON_Object *object, size_t index);
@@ -208,6 +440,14 @@ JSON_Value *json_value_init_string(const char *string); /* copies passed string
 JSON_Value *json_value_init_number(double number);
 JSON_Value *json_value_init_boolean(int boolean);
 JSON_Value *json_value_init_null(void);
+/*  Copies of objects and arrays are lazy, so copying takes the same time whatever the size: each
+    object or array of the copy is only copied, one level at a time, when it's first accessed
+    through the copy, or before it or a container it's in changes in value. A copy that's kept to
+    be compared with value later, e.g. with json_value_diff, then only costs the paths changed
+    since, and parts neither changed nor accessed compare equal without being looked at. Accessing
+    a copy can then fail on allocation, json_value_get_object or json_value_get_array returning
+    NULL, as can changing value. Copies and what they're copies of must not be used from different
+    threads at the same time. Values parsed into an arena are copied in full. */
 JSON_Value *json_value_deep_copy(const JSON_Value *value);
 void json_value_free(JSON_Value *value);
 
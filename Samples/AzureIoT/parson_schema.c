@@ -0,0 +1,229 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "parson_schema.h"
+
+typedef struct {
+    const JSON_Schema *schema; // of the innermost bound object
+    char *out;                 // struct the innermost bound object decodes into
+    size_t depth;              // of the innermost bound object's members
+    size_t bound;              // bound objects open
+    const JSON_Schema *schemas[JSON_SCHEMA_MAX_DEPTH];
+    char *outs[JSON_SCHEMA_MAX_DEPTH];
+} SchemaDecoder;
+
+static const JSON_Schema_Field *FindField(const JSON_Schema *schema, const JSON_Event *event);
+static JSON_Status DecodeEvent(const JSON_Event *event, void *context);
+static bool Append(char **buf, size_t *left, const char *data, size_t len);
+static bool Advance(char **buf, size_t *left, size_t written);
+static bool EncodeObject(const JSON_Schema *schema, const char *in, char **buf, size_t *left);
+
+/// <summary>
+///     Finds the field an event's name refers to.
+/// </summary>
+/// <returns>The field, or NULL if the schema has no field of that name</returns>
+static const JSON_Schema_Field *FindField(const JSON_Schema *schema, const JSON_Event *event)
+{
+    for (size_t i = 0; i < schema->count; i++) {
+        const JSON_Schema_Field *field = &schema->fields[i];
+        if (event->name_escaped ? json_event_name_equals(event, field->name)
+                                : field->name_len == event->name_len &&
+                                      memcmp(field->name, event->name, event->name_len) == 0) {
+            return field;
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Called by json_parse_events for each value; stores members of bound objects in their
+///     structs and follows OBJECT fields into nested structs.
+/// </summary>
+static JSON_Status DecodeEvent(const JSON_Event *event, void *context)
+{
+    SchemaDecoder *decoder = (SchemaDecoder *)context;
+
+    if (event->depth == 0) {
+        // The document itself, only an object can be bound.
+        if (event->type == JSONEventObjectStart) {
+            decoder->bound = 1;
+            return JSONSuccess;
+        }
+        return event->type == JSONEventObjectEnd ? JSONSuccess : JSONFailure;
+    }
+    if (event->type == JSONEventObjectEnd || event->type == JSONEventArrayEnd) {
+        if (event->type == JSONEventObjectEnd && event->depth + 1 == decoder->depth &&
+            decoder->bound > 1) {
+            decoder->bound--;
+            decoder->depth--;
+            decoder->schema = decoder->schemas[decoder->bound - 1];
+            decoder->out = decoder->outs[decoder->bound - 1];
+        }
+        return JSONSuccess;
+    }
+    if (event->depth != decoder->depth) {
+        return JSONSuccess; // inside a value the schema doesn't describe
+    }
+
+    const JSON_Schema_Field *field = FindField(decoder->schema, event);
+    if (field == NULL) {
+        return JSONSuccess;
+    }
+    void *member = decoder->out + field->offset;
+    char *has = decoder->out + field->has_offset;
+    switch (event->type) {
+    case JSONEventObjectStart:
+        if (field->kind != JSONSchemaObject || decoder->bound == JSON_SCHEMA_MAX_DEPTH) {
+            return JSONSuccess;
+        }
+        decoder->schema = field->nested();
+        decoder->out = (char *)member;
+        decoder->schemas[decoder->bound] = decoder->schema;
+        decoder->outs[decoder->bound] = decoder->out;
+        decoder->bound++;
+        decoder->depth++;
+        break;
+    case JSONEventBoolean:
+        if (field->kind != JSONSchemaBoolean) {
+            return JSONSuccess;
+        }
+        *(int *)member = event->boolean;
+        break;
+    case JSONEventNumber:
+        if (field->kind == JSONSchemaNumber) {
+            *(double *)member = event->number;
+        } else if (field->kind == JSONSchemaInteger && event->number >= (double)LONG_MIN &&
+                   event->number < -(double)LONG_MIN) {
+            *(long *)member = (long)event->number;
+        } else {
+            return JSONSuccess;
+        }
+        break;
+    case JSONEventString:
+        if (field->kind != JSONSchemaString) {
+            return JSONSuccess;
+        }
+        if (event->string_escaped) {
+            if (json_event_unescape(event->string, event->string_len, (char *)member,
+                                    field->size, NULL) == JSONFailure) {
+                return JSONFailure;
+            }
+            break;
+        }
+        if (event->string_len >= field->size) {
+            return JSONFailure;
+        }
+        memcpy(member, event->string, event->string_len);
+        ((char *)member)[event->string_len] = '\0';
+        break;
+    default:
+        return JSONSuccess; // arrays and nulls aren't bound
+    }
+    *has = 1;
+    return JSONSuccess;
+}
+
+JSON_Status json_schema_decode(const JSON_Schema *schema, const char *buf, size_t buf_len,
+                               void *out)
+{
+    SchemaDecoder decoder = {.schema = schema, .out = (char *)out, .depth = 1};
+    decoder.schemas[0] = schema;
+    decoder.outs[0] = (char *)out;
+    memset(out, 0, schema->size);
+    if (json_parse_events(buf, buf_len, DecodeEvent, &decoder) == JSONFailure ||
+        decoder.bound == 0) {
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/// <summary>
+///     Appends len bytes of data to buf, keeping room for a NUL terminator.
+/// </summary>
+static bool Append(char **buf, size_t *left, const char *data, size_t len)
+{
+    if (len >= *left) {
+        return false;
+    }
+    memcpy(*buf, data, len);
+    *buf += len;
+    *left -= len;
+    return true;
+}
+
+/// <summary>
+///     Moves past what json_serialize_*_to_buffer wrote to buf, 0 bytes meaning it didn't fit.
+/// </summary>
+static bool Advance(char **buf, size_t *left, size_t written)
+{
+    if (written == 0) {
+        return false;
+    }
+    *buf += written;
+    *left -= written;
+    return true;
+}
+
+/// <summary>
+///     Encodes the present fields of a struct as a JSON object.
+/// </summary>
+static bool EncodeObject(const JSON_Schema *schema, const char *in, char **buf, size_t *left)
+{
+    bool first = true;
+    if (!Append(buf, left, "{", 1)) {
+        return false;
+    }
+    for (size_t i = 0; i < schema->count; i++) {
+        const JSON_Schema_Field *field = &schema->fields[i];
+        const void *member = in + field->offset;
+        bool ok = false;
+        if (!in[field->has_offset]) {
+            continue;
+        }
+        if ((!first && !Append(buf, left, ",", 1)) || !Append(buf, left, "\"", 1) ||
+            !Append(buf, left, field->name, field->name_len) || !Append(buf, left, "\":", 2)) {
+            return false;
+        }
+        first = false;
+        switch (field->kind) {
+        case JSONSchemaBoolean:
+            ok = *(const int *)member ? Append(buf, left, "true", 4)
+                                      : Append(buf, left, "false", 5);
+            break;
+        case JSONSchemaNumber:
+            ok = Advance(buf, left,
+                         json_serialize_number_to_buffer(*(const double *)member, *buf, *left));
+            break;
+        case JSONSchemaInteger:
+            ok = Advance(buf, left, json_serialize_number_to_buffer((double)*(const long *)member,
+                                                                    *buf, *left));
+            break;
+        case JSONSchemaString:
+            ok = Advance(buf, left,
+                         json_serialize_string_to_buffer((const char *)member, *buf, *left));
+            break;
+        case JSONSchemaObject:
+            ok = EncodeObject(field->nested(), (const char *)member, buf, left);
+            break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return Append(buf, left, "}", 1);
+}
+
+size_t json_schema_encode(const JSON_Schema *schema, const void *in, char *buf, size_t buf_size)
+{
+    char *end = buf;
+    size_t left = buf_size;
+    if (buf == NULL || !EncodeObject(schema, (const char *)in, &end, &left)) {
+        return 0;
+    }
+    *end = '\0';
+    return (size_t)(end - buf);
+}
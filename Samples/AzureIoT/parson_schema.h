@@ -0,0 +1,120 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "parson.h"
+
+/// <summary>
+/// Binds JSON objects directly to C structs, without building parson values. A struct is
+/// described once by an X-macro listing its fields, each as FIELD(kind, name, arg):
+///
+///     #define STATUS_LED(FIELD) FIELD(BOOLEAN, value, 0)
+///     #define DESIRED(FIELD) FIELD(OBJECT, StatusLED, StatusLedProperty) FIELD(STRING, id, 16)
+///
+///     JSON_SCHEMA_STRUCT(StatusLedProperty, STATUS_LED)   // in a header or .c file
+///     JSON_SCHEMA_STRUCT(DesiredProperties, DESIRED)
+///     JSON_SCHEMA_DEFINE(StatusLedProperty, STATUS_LED)   // in exactly one .c file
+///     JSON_SCHEMA_DEFINE(DesiredProperties, DESIRED)
+///
+/// The kinds are BOOLEAN (int), NUMBER (double), INTEGER (long), STRING (char array of arg
+/// bytes) and OBJECT (a struct of type arg, itself declared with JSON_SCHEMA_STRUCT). Each field
+/// is followed in the struct by has_name, set when the field is present. The JSON name of a
+/// field is its C name.
+/// </summary>
+#define JSON_SCHEMA_STRUCT(type, FIELDS)       \
+    typedef struct {                           \
+        FIELDS(JSON_SCHEMA_MEMBER)             \
+    } type;                                    \
+    const JSON_Schema *type##_schema(void);
+
+/// <summary>
+/// Defines type##_schema(), which returns the description of type that json_schema_decode
+/// and json_schema_encode work from. Schemas of OBJECT fields must be defined first.
+/// </summary>
+#define JSON_SCHEMA_DEFINE(type, FIELDS)                                                 \
+    const JSON_Schema *type##_schema(void)                                               \
+    {                                                                                    \
+        typedef type json_schema_type;                                                   \
+        static const JSON_Schema_Field fields[] = {FIELDS(JSON_SCHEMA_DESCRIBE)};        \
+        static const JSON_Schema schema = {fields, sizeof(fields) / sizeof(fields[0]),   \
+                                           sizeof(type)};                                \
+        return &schema;                                                                  \
+    }
+
+typedef enum {
+    JSONSchemaBoolean,
+    JSONSchemaNumber,
+    JSONSchemaInteger,
+    JSONSchemaString,
+    JSONSchemaObject
+} JSON_Schema_Kind;
+
+typedef struct json_schema_t JSON_Schema;
+
+typedef struct {
+    const char *name;
+    size_t name_len;
+    JSON_Schema_Kind kind;
+    size_t offset;     // of the member
+    size_t has_offset; // of its has_ flag
+    size_t size;       // of the member, the capacity of strings
+    const JSON_Schema *(*nested)(void); // schema of an OBJECT field
+} JSON_Schema_Field;
+
+struct json_schema_t {
+    const JSON_Schema_Field *fields;
+    size_t count;
+    size_t size; // of the struct
+};
+
+/// <summary>
+/// Decodes the JSON object in buf_len bytes of buf into the struct out, which is cleared
+/// first. Names the schema doesn't have and values of the wrong type are skipped. Memory
+/// use doesn't depend on the document; OBJECT fields can be nested JSON_SCHEMA_MAX_DEPTH deep.
+/// Like json_parse_events, it accepts a member name given twice, and the last value wins,
+/// where json_parse_string would fail; callers that need that strictness have to check for
+/// duplicate names themselves.
+/// </summary>
+/// <returns>JSONFailure if the JSON is invalid, isn't an object, or has a string too long for
+/// its field</returns>
+JSON_Status json_schema_decode(const JSON_Schema *schema, const char *buf, size_t buf_len,
+                               void *out);
+
+/// <summary>
+/// Encodes the fields of the struct in whose has_ flag is set, as a JSON object, into buf.
+/// </summary>
+/// <returns>The length written before the NUL terminator, or 0 if buf is too small</returns>
+size_t json_schema_encode(const JSON_Schema *schema, const void *in, char *buf, size_t buf_size);
+
+#define JSON_SCHEMA_MAX_DEPTH 8
+
+// Implementation of the macros above
+#define JSON_SCHEMA_MEMBER(kind, name, arg) \
+    JSON_SCHEMA_MEMBER_##kind(name, arg) unsigned char has_##name;
+#define JSON_SCHEMA_MEMBER_BOOLEAN(name, arg) int name;
+#define JSON_SCHEMA_MEMBER_NUMBER(name, arg) double name;
+#define JSON_SCHEMA_MEMBER_INTEGER(name, arg) long name;
+#define JSON_SCHEMA_MEMBER_STRING(name, arg) char name[arg];
+#define JSON_SCHEMA_MEMBER_OBJECT(name, arg) arg name;
+
+#define JSON_SCHEMA_DESCRIBE(kind, name, arg)                                            \
+    {#name,                                                                              \
+     sizeof(#name) - 1,                                                                  \
+     JSON_SCHEMA_KIND_##kind,                                                            \
+     offsetof(json_schema_type, name),                                                   \
+     offsetof(json_schema_type, has_##name),                                             \
+     sizeof(((json_schema_type *)0)->name),                                              \
+     JSON_SCHEMA_NESTED_##kind(arg)},
+#define JSON_SCHEMA_KIND_BOOLEAN JSONSchemaBoolean
+#define JSON_SCHEMA_KIND_NUMBER JSONSchemaNumber
+#define JSON_SCHEMA_KIND_INTEGER JSONSchemaInteger
+#define JSON_SCHEMA_KIND_STRING JSONSchemaString
+#define JSON_SCHEMA_KIND_OBJECT JSONSchemaObject
+#define JSON_SCHEMA_NESTED_BOOLEAN(arg) NULL
+#define JSON_SCHEMA_NESTED_NUMBER(arg) NULL
+#define JSON_SCHEMA_NESTED_INTEGER(arg) NULL
+#define JSON_SCHEMA_NESTED_STRING(arg) NULL
+#define JSON_SCHEMA_NESTED_OBJECT(arg) arg##_schema
@@ -0,0 +1,109 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "provisioning_cache.h"
+
+// Identifies the cache layout; change it when ProvisioningCacheRecord changes.
+static const uint32_t ProvisioningCacheMagic = 0x31304350; // "PC01"
+
+static uint32_t GetChecksum(const ProvisioningCacheEntry *entry);
+static int IsTerminated(const char *field, size_t size);
+static int WriteRecord(int fd, off_t offset, const ProvisioningCacheRecord *record);
+
+static uint32_t GetChecksum(const ProvisioningCacheEntry *entry)
+{
+    // 32-bit FNV-1a.
+    const unsigned char *bytes = (const unsigned char *)entry;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(*entry); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int IsTerminated(const char *field, size_t size)
+{
+    return memchr(field, '\0', size) != NULL;
+}
+
+static int WriteRecord(int fd, off_t offset, const ProvisioningCacheRecord *record)
+{
+    const char *bytes = (const char *)record;
+    size_t length = sizeof(*record);
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_Debug("ERROR: Could not write provisioning cache: %s (%d).\n", strerror(errno),
+                      errno);
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t)written;
+        offset += written;
+    }
+    return 0;
+}
+
+int ProvisioningCache_Load(int fd, off_t offset, ProvisioningCacheEntry *entry)
+{
+    ProvisioningCacheRecord record;
+    ssize_t bytesRead = pread(fd, &record, sizeof(record), offset);
+    if (bytesRead == -1) {
+        Log_Debug("ERROR: Could not read provisioning cache: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (bytesRead != sizeof(record) || record.magic != ProvisioningCacheMagic ||
+        record.checksum != GetChecksum(&record.entry) ||
+        !IsTerminated(record.entry.hubHostName, sizeof(record.entry.hubHostName)) ||
+        !IsTerminated(record.entry.deviceId, sizeof(record.entry.deviceId)) ||
+        record.entry.hubHostName[0] == '\0' || record.entry.deviceId[0] == '\0') {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *entry = record.entry;
+    return 0;
+}
+
+int ProvisioningCache_Save(int fd, off_t offset, const ProvisioningCacheEntry *entry)
+{
+    if (!IsTerminated(entry->hubHostName, sizeof(entry->hubHostName)) ||
+        !IsTerminated(entry->deviceId, sizeof(entry->deviceId))) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    // Rewriting the same entry after every provisioning would only wear the flash.
+    ProvisioningCacheEntry cached;
+    if (ProvisioningCache_Load(fd, offset, &cached) == 0 &&
+        strcmp(cached.hubHostName, entry->hubHostName) == 0 &&
+        strcmp(cached.deviceId, entry->deviceId) == 0) {
+        return 0;
+    }
+
+    // Zero the unused ends of the strings, so the checksum only depends on their contents.
+    ProvisioningCacheRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = ProvisioningCacheMagic;
+    strcpy(record.entry.hubHostName, entry->hubHostName);
+    strcpy(record.entry.deviceId, entry->deviceId);
+    record.checksum = GetChecksum(&record.entry);
+    return WriteRecord(fd, offset, &record);
+}
+
+int ProvisioningCache_Clear(int fd, off_t offset)
+{
+    ProvisioningCacheRecord record;
+    memset(&record, 0, sizeof(record));
+    return WriteRecord(fd, offset, &record);
+}
@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/// <summary>
+/// Longest IoT Hub host name, and device ID, that a provisioning cache holds. An Azure Sphere
+/// device ID is 128 characters.
+/// </summary>
+#define PROVISIONING_CACHE_HOST_NAME_MAX_LENGTH 127
+#define PROVISIONING_CACHE_DEVICE_ID_MAX_LENGTH 128
+
+/// <summary>
+/// Bytes of storage a provisioning cache uses, from the offset given to its functions.
+/// </summary>
+#define PROVISIONING_CACHE_STORAGE_BYTES (sizeof(ProvisioningCacheRecord))
+
+/// <summary>
+/// Where the Device Provisioning Service assigned the device: the IoT Hub to connect to, and
+/// the device's ID there.
+/// </summary>
+typedef struct {
+    char hubHostName[PROVISIONING_CACHE_HOST_NAME_MAX_LENGTH + 1];
+    char deviceId[PROVISIONING_CACHE_DEVICE_ID_MAX_LENGTH + 1];
+} ProvisioningCacheEntry;
+
+/// <summary>
+/// Layout of the cache in storage. The checksum covers the entry, so a write that was cut short
+/// by a restart reads back as an empty cache.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    uint32_t checksum;
+    ProvisioningCacheEntry entry;
+} ProvisioningCacheRecord;
+
+/// <summary>
+/// Reads the provisioning result cached at offset in fd.
+/// </summary>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information. errno is
+/// ENOENT if nothing valid is cached, for example on first use.</returns>
+int ProvisioningCache_Load(int fd, off_t offset, ProvisioningCacheEntry *entry);
+
+/// <summary>
+/// Caches a provisioning result at offset in fd. Nothing is written if it is already cached.
+/// </summary>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int ProvisioningCache_Save(int fd, off_t offset, const ProvisioningCacheEntry *entry);
+
+/// <summary>
+/// Removes the provisioning result cached at offset in fd.
+/// </summary>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int ProvisioningCache_Clear(int fd, off_t offset);
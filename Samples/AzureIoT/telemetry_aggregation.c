@@ -0,0 +1,191 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "telemetry_aggregation.h"
+
+typedef struct {
+    float value;
+    float weight;
+} WeightedSample;
+
+static void ClearPane(AggregationPane *pane);
+static uint32_t NextRandom(AggregationSeries *series);
+static void SampleValue(AggregationSeries *series, AggregationPane *pane, double value);
+static void CompactSamples(AggregationSeries *series, AggregationPane *pane);
+
+static void ClearPane(AggregationPane *pane)
+{
+    memset(pane, 0, sizeof(*pane));
+    pane->sampleWeight = 1;
+}
+
+/// <summary>
+///     xorshift32, so that sampling doesn't disturb the application's rand() sequence.
+/// </summary>
+static uint32_t NextRandom(AggregationSeries *series)
+{
+    uint32_t x = series->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    series->randomState = x;
+    return x;
+}
+
+/// <summary>
+///     Keeps one value, picked at random, of each run of sampleWeight values.
+/// </summary>
+static void SampleValue(AggregationSeries *series, AggregationPane *pane, double value)
+{
+    if (pane->runPosition == pane->runPick) {
+        pane->samples[pane->sampleCount++] = (float)value;
+    }
+    if (++pane->runPosition == pane->sampleWeight) {
+        pane->runPosition = 0;
+        pane->runPick = NextRandom(series) % pane->sampleWeight;
+    }
+
+    if (pane->sampleCount == AGGREGATION_PANE_SAMPLES) {
+        CompactSamples(series, pane);
+    }
+}
+
+/// <summary>
+///     Halves a full sample by sorting it and keeping every other value, from a random start, so
+///     each kept value stands for twice as many. Values near each other in rank are dropped
+///     together, which loses far less rank accuracy than dropping values at random.
+/// </summary>
+static void CompactSamples(AggregationSeries *series, AggregationPane *pane)
+{
+    for (unsigned int i = 1; i < pane->sampleCount; ++i) {
+        float sample = pane->samples[i];
+        unsigned int j = i;
+        for (; j > 0 && pane->samples[j - 1] > sample; --j) {
+            pane->samples[j] = pane->samples[j - 1];
+        }
+        pane->samples[j] = sample;
+    }
+
+    unsigned int kept = 0;
+    for (unsigned int i = NextRandom(series) & 1; i < pane->sampleCount; i += 2) {
+        pane->samples[kept++] = pane->samples[i];
+    }
+    pane->sampleCount = kept;
+    pane->sampleWeight *= 2;
+    pane->runPosition = 0;
+    pane->runPick = NextRandom(series) % pane->sampleWeight;
+}
+
+bool AggregationSeries_Init(AggregationSeries *series, unsigned int paneCount)
+{
+    if (paneCount == 0 || paneCount > AGGREGATION_MAX_PANES) {
+        return false;
+    }
+
+    memset(series, 0, sizeof(*series));
+    series->paneCount = paneCount;
+    series->randomState = 2463534242u;
+    for (unsigned int i = 0; i < paneCount; ++i) {
+        ClearPane(&series->panes[i]);
+    }
+    return true;
+}
+
+void AggregationSeries_Add(AggregationSeries *series, double value)
+{
+    AggregationPane *pane = &series->panes[series->newestPane];
+
+    // Welford's update keeps the variance accurate when values are large relative to their
+    // spread, unlike a running sum of squares.
+    ++pane->count;
+    double delta = value - pane->mean;
+    pane->mean += delta / (double)pane->count;
+    pane->m2 += delta * (value - pane->mean);
+    if (pane->count == 1 || value < pane->min) {
+        pane->min = value;
+    }
+    if (pane->count == 1 || value > pane->max) {
+        pane->max = value;
+    }
+
+    SampleValue(series, pane, value);
+}
+
+bool AggregationSeries_GetSummary(const AggregationSeries *series, AggregationSummary *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    double m2 = 0;
+
+    // Panes are merged with Chan et al.'s pairwise update of the mean and squared differences.
+    for (unsigned int i = 0; i < series->paneCount; ++i) {
+        const AggregationPane *pane = &series->panes[i];
+        if (pane->count == 0) {
+            continue;
+        }
+
+        if (summary->count == 0) {
+            summary->min = pane->min;
+            summary->max = pane->max;
+        } else {
+            summary->min = fmin(summary->min, pane->min);
+            summary->max = fmax(summary->max, pane->max);
+        }
+
+        double count = (double)summary->count + (double)pane->count;
+        double delta = pane->mean - summary->mean;
+        summary->mean += delta * (double)pane->count / count;
+        m2 += pane->m2 + delta * delta * (double)summary->count * (double)pane->count / count;
+        summary->count += pane->count;
+    }
+
+    if (summary->count > 1) {
+        summary->variance = m2 / (double)(summary->count - 1);
+    }
+    return summary->count > 0;
+}
+
+double AggregationSeries_GetPercentile(const AggregationSeries *series, double percentile)
+{
+    WeightedSample samples[AGGREGATION_MAX_PANES * AGGREGATION_PANE_SAMPLES];
+    size_t sampleCount = 0;
+    double totalWeight = 0;
+
+    // Each sampled value stands for count / sampleCount values of its pane, which also accounts
+    // for the values of a run not sampled yet. Insertion sort is enough for this many samples.
+    for (unsigned int i = 0; i < series->paneCount; ++i) {
+        const AggregationPane *pane = &series->panes[i];
+        for (unsigned int j = 0; j < pane->sampleCount; ++j) {
+            WeightedSample sample = {pane->samples[j],
+                                     (float)pane->count / (float)pane->sampleCount};
+            size_t k = sampleCount++;
+            for (; k > 0 && samples[k - 1].value > sample.value; --k) {
+                samples[k] = samples[k - 1];
+            }
+            samples[k] = sample;
+            totalWeight += sample.weight;
+        }
+    }
+
+    if (sampleCount == 0) {
+        return NAN;
+    }
+
+    double rank = fmin(fmax(percentile, 0), 100) / 100 * totalWeight;
+    double weight = 0;
+    for (size_t i = 0; i < sampleCount; ++i) {
+        weight += samples[i].weight;
+        if (weight >= rank) {
+            return samples[i].value;
+        }
+    }
+    return samples[sampleCount - 1].value;
+}
+
+void AggregationSeries_Slide(AggregationSeries *series)
+{
+    series->newestPane = (series->newestPane + 1) % series->paneCount;
+    ClearPane(&series->panes[series->newestPane]);
+}
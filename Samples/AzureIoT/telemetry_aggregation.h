@@ -0,0 +1,96 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>
+/// Largest number of panes a window can be divided into.
+/// </summary>
+#define AGGREGATION_MAX_PANES 8
+
+/// <summary>
+/// Number of samples each pane keeps for estimating percentiles.
+/// </summary>
+#define AGGREGATION_PANE_SAMPLES 32
+
+/// <summary>
+/// Statistics of the values added to one pane, and a sample of them that each stand for
+/// sampleWeight values: one picked at random from each run of sampleWeight values. When the
+/// sample is full, every other sampled value is dropped and the weight doubles.
+/// </summary>
+typedef struct {
+    unsigned long count;
+    double mean;
+    double m2; // sum of squared differences from the mean
+    double min;
+    double max;
+    uint32_t sampleWeight;
+    uint32_t runPosition; // of the next value in its run of sampleWeight values
+    uint32_t runPick;     // position of the value to sample from the current run
+    unsigned int sampleCount;
+    float samples[AGGREGATION_PANE_SAMPLES];
+} AggregationPane;
+
+/// <summary>
+/// Summarizes a series of values over a window, in memory that doesn't depend on the number of
+/// values. The window is divided into panes, and values are added to the newest pane; each call
+/// to <see cref="AggregationSeries_Slide" /> starts a new pane and forgets the oldest. With one
+/// pane the window is tumbling; with more it slides by a pane at a time:
+///
+///     AggregationSeries_Init(&series, windowSeconds / slideSeconds);
+///     AggregationSeries_Add(&series, value);           // for each value
+///     AggregationSeries_GetSummary(&series, &summary); // every slideSeconds, then
+///     AggregationSeries_Slide(&series);
+///
+/// Count, minimum, maximum, mean and variance are exact. Percentiles are estimated from up to
+/// AGGREGATION_PANE_SAMPLES values sampled from each pane, and are exact while no pane has had
+/// more values than that.
+/// </summary>
+typedef struct {
+    unsigned int paneCount;
+    unsigned int newestPane;
+    uint32_t randomState;
+    AggregationPane panes[AGGREGATION_MAX_PANES];
+} AggregationSeries;
+
+/// <summary>
+/// Summary of the values in a series' window.
+/// </summary>
+typedef struct {
+    unsigned long count;
+    double min;
+    double max;
+    double mean;
+    double variance; // of the sample, 0 for fewer than two values
+} AggregationSummary;
+
+/// <summary>
+/// Initializes an empty series whose window is paneCount panes, from 1 to AGGREGATION_MAX_PANES.
+/// </summary>
+/// <returns>false if paneCount is out of range</returns>
+bool AggregationSeries_Init(AggregationSeries *series, unsigned int paneCount);
+
+/// <summary>
+/// Adds a value to the newest pane.
+/// </summary>
+void AggregationSeries_Add(AggregationSeries *series, double value);
+
+/// <summary>
+/// Summarizes the values in the window.
+/// </summary>
+/// <returns>false if the window holds no values</returns>
+bool AggregationSeries_GetSummary(const AggregationSeries *series, AggregationSummary *summary);
+
+/// <summary>
+/// Estimates the value below which percentile percent of the values in the window fall.
+/// </summary>
+/// <returns>The estimate, or NAN if the window holds no values</returns>
+double AggregationSeries_GetPercentile(const AggregationSeries *series, double percentile);
+
+/// <summary>
+/// Starts a new, empty pane, dropping the oldest pane's values from the window.
+/// </summary>
+void AggregationSeries_Slide(AggregationSeries *series);
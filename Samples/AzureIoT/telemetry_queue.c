@@ -0,0 +1,165 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "telemetry_queue.h"
+
+// Identifies the queue layout; change it when TelemetryQueueHeader or TelemetryQueueSlot change.
+static const uint32_t TelemetryQueueMagic = 0x31305154; // "TQ01"
+
+static off_t GetSlotOffset(const TelemetryQueue *queue, unsigned int index);
+static int WriteAll(int fd, const void *data, size_t length, off_t offset);
+static int WriteHeader(TelemetryQueue *queue);
+
+static off_t GetSlotOffset(const TelemetryQueue *queue, unsigned int index)
+{
+    return queue->offset + (off_t)sizeof(TelemetryQueueHeader) +
+           (off_t)(index % TELEMETRY_QUEUE_CAPACITY) * (off_t)sizeof(TelemetryQueueSlot);
+}
+
+static int WriteAll(int fd, const void *data, size_t length, off_t offset)
+{
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EDQUOT if the file would exceed the size given in the application manifest.
+            Log_Debug("ERROR: Could not write telemetry queue: %s (%d).\n", strerror(errno),
+                      errno);
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t)written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int WriteHeader(TelemetryQueue *queue)
+{
+    return WriteAll(queue->fd, &queue->header, sizeof(queue->header), queue->offset);
+}
+
+int TelemetryQueue_Open(TelemetryQueue *queue, int fd, off_t offset,
+                        TelemetryQueueOverflow overflow)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->fd = fd;
+    queue->offset = offset;
+    queue->overflow = overflow;
+
+    ssize_t bytesRead = pread(fd, &queue->header, sizeof(queue->header), offset);
+    if (bytesRead == -1) {
+        Log_Debug("ERROR: Could not read telemetry queue: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (bytesRead == sizeof(queue->header) && queue->header.magic == TelemetryQueueMagic &&
+        queue->header.head < TELEMETRY_QUEUE_CAPACITY &&
+        queue->header.count <= TELEMETRY_QUEUE_CAPACITY) {
+        return 0;
+    }
+
+    queue->header.magic = TelemetryQueueMagic;
+    queue->header.head = 0;
+    queue->header.count = 0;
+    return WriteHeader(queue);
+}
+
+int TelemetryQueue_Push(TelemetryQueue *queue, const char *message, size_t length,
+                        time_t createdTime)
+{
+    if (length > TELEMETRY_QUEUE_MESSAGE_MAX_BYTES) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    TelemetryQueueHeader *header = &queue->header;
+    if (header->count == TELEMETRY_QUEUE_CAPACITY) {
+        ++queue->dropped;
+        if (queue->overflow == TelemetryQueueOverflow_DropNewest) {
+            return 0;
+        }
+    }
+
+    // Only the used part of the slot is written. The header is written last, so a restart
+    // in between loses at most this message.
+    TelemetryQueueSlot slot;
+    slot.createdTime = (int64_t)createdTime;
+    slot.length = (uint16_t)length;
+    memcpy(slot.message, message, length);
+    if (WriteAll(queue->fd, &slot, offsetof(TelemetryQueueSlot, message) + length,
+                 GetSlotOffset(queue, (unsigned int)header->head + header->count)) == -1) {
+        return -1;
+    }
+
+    if (header->count == TELEMETRY_QUEUE_CAPACITY) {
+        header->head = (uint16_t)((header->head + 1) % TELEMETRY_QUEUE_CAPACITY);
+        ++queue->headSequence;
+    } else {
+        ++header->count;
+    }
+    ++queue->queued;
+    return WriteHeader(queue);
+}
+
+ssize_t TelemetryQueue_Peek(const TelemetryQueue *queue, char *buffer, size_t bufferSize,
+                            time_t *createdTime)
+{
+    if (queue->header.count == 0) {
+        return 0;
+    }
+
+    TelemetryQueueSlot slot;
+    off_t slotOffset = GetSlotOffset(queue, queue->header.head);
+    ssize_t bytesRead = pread(queue->fd, &slot, sizeof(slot), slotOffset);
+    if (bytesRead == -1) {
+        Log_Debug("ERROR: Could not read telemetry queue: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    // The last slot in the file may be shorter than sizeof(slot), as only its message is written.
+    size_t messageOffset = offsetof(TelemetryQueueSlot, message);
+    if ((size_t)bytesRead < messageOffset || slot.length > TELEMETRY_QUEUE_MESSAGE_MAX_BYTES ||
+        (size_t)bytesRead - messageOffset < slot.length) {
+        errno = EIO;
+        return -1;
+    }
+    if (slot.length >= bufferSize) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy(buffer, slot.message, slot.length);
+    buffer[slot.length] = '\0';
+    if (createdTime != NULL) {
+        *createdTime = (time_t)slot.createdTime;
+    }
+    return slot.length;
+}
+
+int TelemetryQueue_Pop(TelemetryQueue *queue)
+{
+    if (queue->header.count == 0) {
+        return 0;
+    }
+
+    queue->header.head = (uint16_t)((queue->header.head + 1) % TELEMETRY_QUEUE_CAPACITY);
+    --queue->header.count;
+    ++queue->headSequence;
+    return WriteHeader(queue);
+}
+
+size_t TelemetryQueue_GetCount(const TelemetryQueue *queue)
+{
+    return queue->header.count;
+}
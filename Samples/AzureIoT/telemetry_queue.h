@@ -0,0 +1,108 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/// <summary>
+/// Largest message, in bytes, that a telemetry queue holds.
+/// </summary>
+#define TELEMETRY_QUEUE_MESSAGE_MAX_BYTES 512
+
+/// <summary>
+/// Number of messages a telemetry queue holds.
+/// </summary>
+#define TELEMETRY_QUEUE_CAPACITY 14
+
+/// <summary>
+/// Bytes of storage a telemetry queue uses, from the offset given to
+/// <see cref="TelemetryQueue_Open" />.
+/// </summary>
+#define TELEMETRY_QUEUE_STORAGE_BYTES \
+    (sizeof(TelemetryQueueHeader) + TELEMETRY_QUEUE_CAPACITY * sizeof(TelemetryQueueSlot))
+
+/// <summary>
+/// What <see cref="TelemetryQueue_Push" /> does when the queue is full.
+/// </summary>
+typedef enum {
+    // The oldest message is overwritten, so the queue keeps the latest data.
+    TelemetryQueueOverflow_DropOldest,
+    // The new message is discarded, so the queue keeps the earliest data.
+    TelemetryQueueOverflow_DropNewest
+} TelemetryQueueOverflow;
+
+/// <summary>
+/// Layout of the queue in storage: a header, followed by TELEMETRY_QUEUE_CAPACITY slots.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    uint16_t head;
+    uint16_t count;
+} TelemetryQueueHeader;
+
+typedef struct {
+    int64_t createdTime;
+    uint16_t length;
+    char message[TELEMETRY_QUEUE_MESSAGE_MAX_BYTES];
+} TelemetryQueueSlot;
+
+/// <summary>
+/// A bounded first-in first-out queue of messages kept in a file, such as the application's
+/// mutable storage, so that messages which could not be sent survive a restart. The head and
+/// count are cached; every change writes through to the file.
+/// </summary>
+typedef struct {
+    int fd;
+    off_t offset;
+    TelemetryQueueOverflow overflow;
+    TelemetryQueueHeader header;
+
+    // Messages pushed, and messages dropped because the queue was full, since it was opened.
+    unsigned long queued;
+    unsigned long dropped;
+
+    // Messages removed from the head of the queue since it was opened, popped or dropped, which
+    // identifies the oldest message even after its slot is reused.
+    unsigned long headSequence;
+} TelemetryQueue;
+
+/// <summary>
+/// Opens the queue stored at offset in fd, which stays owned by the caller. If the storage
+/// doesn't hold a valid queue, for example on first use, an empty queue is written.
+/// </summary>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int TelemetryQueue_Open(TelemetryQueue *queue, int fd, off_t offset,
+                        TelemetryQueueOverflow overflow);
+
+/// <summary>
+/// Appends a message of length bytes, created at createdTime, to the queue. When the queue is
+/// full, the message or the oldest one is dropped, as chosen when the queue was opened.
+/// </summary>
+/// <returns>0 if the message was queued or dropped, -1 if it is too long or the storage could
+/// not be written, in which case errno contains more information.</returns>
+int TelemetryQueue_Push(TelemetryQueue *queue, const char *message, size_t length,
+                        time_t createdTime);
+
+/// <summary>
+/// Copies the oldest message, which stays in the queue, into buffer and null-terminates it.
+/// </summary>
+/// <returns>The length of the message, 0 if the queue is empty, or -1 if the message could not
+/// be read or does not fit in bufferSize bytes, in which case errno contains more information.
+/// </returns>
+ssize_t TelemetryQueue_Peek(const TelemetryQueue *queue, char *buffer, size_t bufferSize,
+                            time_t *createdTime);
+
+/// <summary>
+/// Removes the oldest message from the queue.
+/// </summary>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int TelemetryQueue_Pop(TelemetryQueue *queue);
+
+/// <summary>
+/// Returns the number of messages in the queue.
+/// </summary>
+size_t TelemetryQueue_GetCount(const TelemetryQueue *queue);